@@ -46,6 +46,22 @@ typedef struct FLACFILE {
 
    ALLEGRO_FILE *fh;
    uint64_t loop_start, loop_end; /* in samples */
+
+   /* Byte offset of the first audio frame. */
+   uint64_t first_frame;
+
+   /* Frame start positions, from the SEEKTABLE block and from decoding. */
+   ACODEC_SEEK_INDEX *index;
+   ALLEGRO_USTR *filename;
+   int64_t file_size;
+
+   /* Set when we moved the file position behind the decoder's back, the
+    * next frame header tells us where we are.
+    */
+   bool resync;
+
+   bool seek_pending;
+   uint64_t seek_sample;
 } FLACFILE;
 
 
@@ -76,6 +92,8 @@ static struct
    FLAC__bool (*FLAC__stream_decoder_seek_absolute)(FLAC__StreamDecoder *decoder, FLAC__uint64 sample);
    FLAC__bool (*FLAC__stream_decoder_flush)(FLAC__StreamDecoder *decoder);
    FLAC__bool (*FLAC__stream_decoder_finish)(FLAC__StreamDecoder *decoder);
+   FLAC__bool (*FLAC__stream_decoder_set_metadata_respond)(FLAC__StreamDecoder *decoder, FLAC__MetadataType type);
+   FLAC__bool (*FLAC__stream_decoder_get_decode_position)(const FLAC__StreamDecoder *decoder, FLAC__uint64 *position);
 } lib;
 
 
@@ -136,6 +154,8 @@ static bool init_dynlib(void)
    INITSYM(FLAC__stream_decoder_seek_absolute);
    INITSYM(FLAC__stream_decoder_flush);
    INITSYM(FLAC__stream_decoder_finish);
+   INITSYM(FLAC__stream_decoder_set_metadata_respond);
+   INITSYM(FLAC__stream_decoder_get_decode_position);
 
    return true;
 
@@ -237,6 +257,21 @@ static void metadata_callback(const FLAC__StreamDecoder *decoder,
       out->channels = metadata->data.stream_info.channels;
       out->sample_size = metadata->data.stream_info.bits_per_sample / 8;
    }
+   else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE && out->index) {
+      const FLAC__StreamMetadata_SeekTable *table = &metadata->data.seek_table;
+      unsigned i;
+
+      /* Offsets are relative to the first frame, which we don't know yet.
+       * flac_open fixes them up once all metadata has been read.
+       */
+      for (i = 0; i < table->num_points; i++) {
+         const FLAC__StreamMetadata_SeekPoint *point = &table->points[i];
+         if (point->sample_number == FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER)
+            continue;
+         _al_acodec_add_seek_point(out->index, point->sample_number,
+            point->stream_offset);
+      }
+   }
 }
 
 
@@ -283,6 +318,15 @@ static FLAC__StreamDecoderWriteStatus write_callback(
    (void)decoder;
    (void)client_data;
 
+   if (ff->resync) {
+      if (frame->header.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER)
+         ff->decoded_samples = frame->header.number.sample_number;
+      else
+         ff->decoded_samples =
+            (uint64_t)frame->header.number.frame_number * len;
+      ff->resync = false;
+   }
+
    /* Flatten the array */
    /* TODO: test this array flattening process on 5.1 and higher flac files */
    out_index = 0;
@@ -348,6 +392,12 @@ static void flac_close(FLACFILE *ff)
 {
    lib.FLAC__stream_decoder_finish(ff->decoder);
    lib.FLAC__stream_decoder_delete(ff->decoder);
+   if (ff->filename) {
+      _al_acodec_save_seek_index(ff->index, al_cstr(ff->filename),
+         ff->file_size);
+      al_ustr_free(ff->filename);
+   }
+   _al_acodec_destroy_seek_index(ff->index);
    /* Don't close ff->fh here. */
    al_free(ff);
 }
@@ -356,10 +406,37 @@ static void flac_close(FLACFILE *ff)
 static double flac_stream_get_position(ALLEGRO_AUDIO_STREAM *stream)
 {
    FLACFILE *ff = (FLACFILE *)stream->extra;
+   if (ff->seek_pending)
+      return ff->seek_sample / ff->sample_rate;
    return ff->streamed_samples / ff->sample_rate;
 }
 
 
+/* Decodes the next frame and remembers where it started. */
+static bool decode_frame(FLACFILE *ff)
+{
+   uint64_t sample = ff->decoded_samples;
+   FLAC__uint64 pos;
+   bool have_pos;
+
+   have_pos = !ff->resync &&
+      lib.FLAC__stream_decoder_get_decode_position(ff->decoder, &pos);
+
+   if (!lib.FLAC__stream_decoder_process_single(ff->decoder))
+      return false;
+
+   /* The decode position is at a frame boundary only if the frame we just
+    * decoded started there.
+    */
+   if (have_pos && ff->decoded_samples > sample)
+      _al_acodec_add_seek_point(ff->index, sample, pos);
+   return true;
+}
+
+
+static bool real_seek(ALLEGRO_AUDIO_STREAM *stream, uint64_t sample);
+
+
 /*
  *  Updates 'stream' with the next chunk of data.
  *  Returns the actual number of bytes written.
@@ -374,6 +451,9 @@ static size_t flac_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
    size_t read_bytes;
    FLACFILE *ff = (FLACFILE *)stream->extra;
 
+   if (ff->seek_pending)
+      real_seek(stream, ff->seek_sample);
+
    bytes_per_sample = ff->sample_size * ff->channels;
    wanted_samples = buf_size / bytes_per_sample;
 
@@ -391,7 +471,7 @@ static size_t flac_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
        * buffer keeps growing - so only refill when needed.
        */
       if (!read_samples) {
-         if (!lib.FLAC__stream_decoder_process_single(ff->decoder))
+         if (!decode_frame(ff))
             break;
          read_samples = ff->decoded_samples - ff->streamed_samples;
          if (!read_samples) {
@@ -426,29 +506,93 @@ static void flac_stream_close(ALLEGRO_AUDIO_STREAM *stream)
    flac_close(ff);
 }
 
+/* Moves to the last indexed frame before the wanted sample and decodes from
+ * there, without any help from libFLAC's bisection search.
+ */
+static bool indexed_seek(FLACFILE *ff, uint64_t sample)
+{
+   ACODEC_SEEK_POINT point;
+   uint64_t buffered;
+   uint64_t skip;
+   int bytes_per_sample = ff->sample_size * ff->channels;
+
+   if (!_al_acodec_find_seek_point(ff->index, sample, &point))
+      return false;
+
+   lib.FLAC__stream_decoder_flush(ff->decoder);
+   if (!al_fseek(ff->fh, point.offset, ALLEGRO_SEEK_SET))
+      return false;
+
+   ff->buffer_pos = 0;
+   ff->resync = true;
+   do {
+      uint64_t before = ff->decoded_samples;
+      if (!lib.FLAC__stream_decoder_process_single(ff->decoder) || ff->resync)
+         return false;
+      if (ff->decoded_samples == before)
+         return false;
+      /* The index was wrong if the first frame already starts too late. */
+      buffered = ff->buffer_pos / bytes_per_sample;
+      if (ff->decoded_samples - buffered > sample)
+         return false;
+   } while (ff->decoded_samples <= sample);
+
+   /* Drop the samples in front of the seek target. */
+   skip = (sample - (ff->decoded_samples - buffered)) * bytes_per_sample;
+   memmove(ff->buffer, ff->buffer + skip, ff->buffer_pos - skip);
+   ff->buffer_pos -= skip;
+   ff->streamed_samples = sample;
+   return true;
+}
+
 static bool real_seek(ALLEGRO_AUDIO_STREAM *stream, uint64_t sample)
 {
    FLACFILE *ff = stream->extra;
 
+   ff->seek_pending = false;
+   if (indexed_seek(ff, sample))
+      return true;
+   ff->resync = false;
+
    /* We use ff->streamed_samples as the exact sample position for looping and
     * returning the position. Therefore we also use it as reference position
     * when seeking - that is, we call flush below to make the FLAC decoder
     * discard any additional samples it may have buffered already.
+    * The frame containing the target sample is passed to write_callback
+    * starting at the target sample, so after this decoded_samples is again
+    * at a frame boundary.
     * */
    lib.FLAC__stream_decoder_flush(ff->decoder);
-   lib.FLAC__stream_decoder_seek_absolute(ff->decoder, sample);
-
    ff->buffer_pos = 0;
    ff->streamed_samples = sample;
    ff->decoded_samples = sample;
+   lib.FLAC__stream_decoder_seek_absolute(ff->decoder, sample);
    return true;
 }
 
+static double flac_stream_get_length(ALLEGRO_AUDIO_STREAM *stream);
+
 static bool flac_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 {
    FLACFILE *ff = stream->extra;
-   uint64_t sample = time * ff->sample_rate;
-   return real_seek(stream, sample);
+   uint64_t sample;
+
+   /* The length is 0 if STREAMINFO did not know it. */
+   if (time < 0.0 || (ff->total_samples > 0 &&
+         time >= flac_stream_get_length(stream)))
+      return false;
+   sample = time * ff->sample_rate;
+
+   /* Nobody else is going to do it. */
+   if (!_al_acodec_feed_thread_is_busy(stream))
+      return real_seek(stream, sample);
+
+   /* Done by the feeder thread, which then decodes ahead from the new
+    * position straight away.
+    */
+   ff->seek_sample = sample;
+   ff->seek_pending = true;
+   return true;
 }
 
 static bool flac_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
@@ -472,10 +616,12 @@ static bool flac_stream_set_loop(ALLEGRO_AUDIO_STREAM *stream, double start,
    return true;
 }
 
-static FLACFILE *flac_open(ALLEGRO_FILE* f)
+static FLACFILE *flac_open(ALLEGRO_FILE* f, const char *filename)
 {
    FLACFILE *ff;
    FLAC__StreamDecoderInitStatus init_status;
+   FLAC__uint64 first_frame;
+   unsigned i;
 
    if (!init_dynlib()) {
       return NULL;
@@ -495,6 +641,10 @@ static FLACFILE *flac_open(ALLEGRO_FILE* f)
       goto error;
    }
 
+   ff->index = _al_acodec_create_seek_index(0);
+   lib.FLAC__stream_decoder_set_metadata_respond(ff->decoder,
+      FLAC__METADATA_TYPE_SEEKTABLE);
+
    init_status = lib.FLAC__stream_decoder_init_stream(ff->decoder, read_callback,
       seek_callback, tell_callback, length_callback, eof_callback,
       write_callback, metadata_callback, error_callback, ff);
@@ -515,6 +665,29 @@ static FLACFILE *flac_open(ALLEGRO_FILE* f)
       goto error;
    }
 
+   if (ff->index) {
+      if (lib.FLAC__stream_decoder_get_decode_position(ff->decoder,
+            &first_frame)) {
+         ff->first_frame = first_frame;
+         for (i = 0; i < _al_vector_size(&ff->index->points); i++) {
+            ACODEC_SEEK_POINT *p = _al_vector_ref(&ff->index->points, i);
+            p->offset += ff->first_frame;
+         }
+      }
+      else {
+         _al_vector_free(&ff->index->points);
+      }
+      ff->index->modified = false;
+
+      /* Frames we decode add more points, about four per second. */
+      ff->index->min_spacing = ff->sample_rate / 4;
+      ff->file_size = al_fsize(f);
+      if (filename) {
+         ff->filename = al_ustr_new(filename);
+         _al_acodec_load_seek_index(ff->index, filename, ff->file_size);
+      }
+   }
+
    ALLEGRO_INFO("Loaded FLAC sample with properties:\n");
    ALLEGRO_INFO("    channels %d\n", ff->channels);
    ALLEGRO_INFO("    sample_size %d\n", ff->sample_size);
@@ -527,6 +700,8 @@ error:
    if (ff) {
       if (ff->decoder)
          lib.FLAC__stream_decoder_delete(ff->decoder);
+      al_ustr_free(ff->filename);
+      _al_acodec_destroy_seek_index(ff->index);
       al_free(ff);
    }
    return NULL;
@@ -554,7 +729,7 @@ ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
    ALLEGRO_SAMPLE *sample;
    FLACFILE *ff;
 
-   ff = flac_open(f);
+   ff = flac_open(f, NULL);
    if (!ff) {
       return NULL;
    }
@@ -577,32 +752,13 @@ ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
    return sample;
 }
 
-ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream(const char *filename,
-   size_t buffer_count, unsigned int samples)
-{
-   ALLEGRO_FILE *f;
-   ALLEGRO_AUDIO_STREAM *stream;
-   ASSERT(filename);
-
-   f = al_fopen(filename, "rb");
-   if (!f)
-      return NULL;
-
-   stream = _al_load_flac_audio_stream_f(f, buffer_count, samples);
-   if (!stream) {
-      al_fclose(f);
-   }
-
-   return stream;
-}
-
-ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream_f(ALLEGRO_FILE* f,
-   size_t buffer_count, unsigned int samples)
+static ALLEGRO_AUDIO_STREAM *flac_stream_open(ALLEGRO_FILE* f,
+   const char *filename, size_t buffer_count, unsigned int samples)
 {
    ALLEGRO_AUDIO_STREAM *stream;
    FLACFILE *ff;
 
-   ff = flac_open(f);
+   ff = flac_open(f, filename);
    if (!ff) {
       return NULL;
    }
@@ -632,5 +788,30 @@ ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream_f(ALLEGRO_FILE* f,
    return stream;
 }
 
+ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream(const char *filename,
+   size_t buffer_count, unsigned int samples)
+{
+   ALLEGRO_FILE *f;
+   ALLEGRO_AUDIO_STREAM *stream;
+   ASSERT(filename);
+
+   f = al_fopen(filename, "rb");
+   if (!f)
+      return NULL;
+
+   stream = flac_stream_open(f, filename, buffer_count, samples);
+   if (!stream) {
+      al_fclose(f);
+   }
+
+   return stream;
+}
+
+ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream_f(ALLEGRO_FILE* f,
+   size_t buffer_count, unsigned int samples)
+{
+   return flac_stream_open(f, NULL, buffer_count, samples);
+}
+
 
 /* vim: set sts=3 sw=3 et: */
@@ -5,6 +5,8 @@
 #include "allegro5/internal/aintern_system.h"
 #include "helper.h"
 
+ALLEGRO_DEBUG_CHANNEL("acodec")
+
 void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 {
    stream->feed_thread = al_create_thread(_al_kcm_feed_stream, stream);
@@ -15,22 +17,203 @@ void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 
 void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 {
-   ALLEGRO_EVENT quit_event;
+   /* The thread may already be gone if the stream was queued on another. */
+   _al_kcm_stop_feed_thread(stream);
+}
+
+/* Returns true if the feeder thread will be asked for more data soon, which
+ * is only the case while the stream is attached and playing.  Call with the
+ * stream mutex held.
+ */
+bool _al_acodec_feed_thread_is_busy(ALLEGRO_AUDIO_STREAM *stream)
+{
+   return stream->feed_thread && !stream->quit_feed_thread &&
+      stream->spl.is_playing && stream->spl.parent.u.ptr;
+}
+
+ACODEC_SEEK_INDEX *_al_acodec_create_seek_index(int64_t min_spacing)
+{
+   ACODEC_SEEK_INDEX *index = al_calloc(1, sizeof *index);
+   if (!index)
+      return NULL;
+   _al_vector_init(&index->points, sizeof(ACODEC_SEEK_POINT));
+   index->min_spacing = min_spacing;
+   return index;
+}
+
+void _al_acodec_destroy_seek_index(ACODEC_SEEK_INDEX *index)
+{
+   if (index) {
+      _al_vector_free(&index->points);
+      al_free(index);
+   }
+}
+
+/* Returns the number of points with a sample position <= sample. */
+static unsigned count_points_before(ACODEC_SEEK_INDEX *index, int64_t sample)
+{
+   unsigned lo = 0;
+   unsigned hi = _al_vector_size(&index->points);
+
+   while (lo < hi) {
+      unsigned mid = lo + (hi - lo) / 2;
+      ACODEC_SEEK_POINT *p = _al_vector_ref(&index->points, mid);
+      if (p->sample <= sample)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+void _al_acodec_add_seek_point(ACODEC_SEEK_INDEX *index, int64_t sample,
+   int64_t offset)
+{
+   unsigned i;
+   ACODEC_SEEK_POINT *p;
+
+   if (!index || sample < 0 || offset < 0)
+      return;
+
+   /* Points closer together than min_spacing don't make seeking noticeably
+    * faster, so keep the index small by dropping them.
+    */
+   i = count_points_before(index, sample);
+   if (i > 0) {
+      p = _al_vector_ref(&index->points, i - 1);
+      if (sample - p->sample < index->min_spacing)
+         return;
+   }
+   if (i < _al_vector_size(&index->points)) {
+      p = _al_vector_ref(&index->points, i);
+      if (p->sample - sample < index->min_spacing)
+         return;
+   }
+
+   p = _al_vector_alloc_mid(&index->points, i);
+   p->sample = sample;
+   p->offset = offset;
+   index->modified = true;
+}
+
+/* Finds the last point at or before the given sample position. */
+bool _al_acodec_find_seek_point(ACODEC_SEEK_INDEX *index, int64_t sample,
+   ACODEC_SEEK_POINT *point)
+{
+   unsigned i;
+
+   if (!index)
+      return false;
+
+   i = count_points_before(index, sample);
+   if (i == 0)
+      return false;
+
+   *point = *(ACODEC_SEEK_POINT *)_al_vector_ref(&index->points, i - 1);
+   return true;
+}
+
+/* Seek indices can be saved next to the audio file, if enabled in the
+ * system configuration.  The saved index records the size of the audio file
+ * so a stale index is ignored.
+ */
+static ALLEGRO_USTR *get_seek_index_path(const char *filename)
+{
+   ALLEGRO_CONFIG *config = al_get_system_config();
+   const char *value;
+
+   if (!config || !filename)
+      return NULL;
+
+   value = al_get_config_value(config, "acodec", "save_seek_index");
+   if (!value || 0 != _al_stricmp(value, "true"))
+      return NULL;
+
+   return al_ustr_newf("%s.seekidx", filename);
+}
+
+static int64_t read64le(ALLEGRO_FILE *f)
+{
+   uint32_t lo = al_fread32le(f);
+   uint32_t hi = al_fread32le(f);
+   return (int64_t)(((uint64_t)hi << 32) | lo);
+}
+
+static void write64le(ALLEGRO_FILE *f, int64_t v)
+{
+   al_fwrite32le(f, (uint32_t)v);
+   al_fwrite32le(f, (uint32_t)((uint64_t)v >> 32));
+}
+
+void _al_acodec_load_seek_index(ACODEC_SEEK_INDEX *index,
+   const char *filename, int64_t file_size)
+{
+   ALLEGRO_USTR *path = get_seek_index_path(filename);
+   ALLEGRO_FILE *f;
+   char magic[4];
+   int32_t count;
+   int32_t i;
+
+   if (!path || !index)
+      goto done;
+
+   f = al_fopen(al_cstr(path), "rb");
+   if (!f)
+      goto done;
+
+   if (al_fread(f, magic, 4) != 4 || memcmp(magic, "A5SI", 4) != 0 ||
+         read64le(f) != file_size) {
+      ALLEGRO_WARN("Ignoring stale seek index %s\n", al_cstr(path));
+      al_fclose(f);
+      goto done;
+   }
+
+   count = al_fread32le(f);
+   for (i = 0; i < count && !al_feof(f); i++) {
+      int64_t sample = read64le(f);
+      int64_t offset = read64le(f);
+      if (al_feof(f))
+         break;
+      _al_acodec_add_seek_point(index, sample, offset);
+   }
+   al_fclose(f);
+
+   index->modified = false;
+   ALLEGRO_DEBUG("Loaded %u seek points from %s\n",
+      (unsigned)_al_vector_size(&index->points), al_cstr(path));
+
+done:
+   al_ustr_free(path);
+}
+
+void _al_acodec_save_seek_index(ACODEC_SEEK_INDEX *index,
+   const char *filename, int64_t file_size)
+{
+   ALLEGRO_USTR *path = get_seek_index_path(filename);
+   ALLEGRO_FILE *f;
+   unsigned i;
+
+   if (!path || !index || !index->modified)
+      goto done;
+
+   f = al_fopen(al_cstr(path), "wb");
+   if (!f) {
+      ALLEGRO_WARN("Could not write seek index %s\n", al_cstr(path));
+      goto done;
+   }
 
-   /* Need to wait for the thread to start, otherwise the quit event may be
-    * sent before the event source is registered with the queue. */
-   al_lock_mutex(stream->feed_thread_started_mutex);
-   while (!stream->feed_thread_started) {
-      al_wait_cond(stream->feed_thread_started_cond, stream->feed_thread_started_mutex);
+   al_fwrite(f, "A5SI", 4);
+   write64le(f, file_size);
+   al_fwrite32le(f, _al_vector_size(&index->points));
+   for (i = 0; i < _al_vector_size(&index->points); i++) {
+      ACODEC_SEEK_POINT *p = _al_vector_ref(&index->points, i);
+      write64le(f, p->sample);
+      write64le(f, p->offset);
    }
-   al_unlock_mutex(stream->feed_thread_started_mutex);
+   al_fclose(f);
 
-   quit_event.type = _KCM_STREAM_FEEDER_QUIT_EVENT_TYPE;
-   al_emit_user_event(al_get_audio_stream_event_source(stream), &quit_event, NULL);
-   al_join_thread(stream->feed_thread, NULL);
-   al_destroy_thread(stream->feed_thread);
-   al_destroy_cond(stream->feed_thread_started_cond);
-   al_destroy_mutex(stream->feed_thread_started_mutex);
+   index->modified = false;
 
-   stream->feed_thread = NULL;
+done:
+   al_ustr_free(path);
 }
@@ -1,7 +1,37 @@
 #ifndef __al_included_acodec_helper_h
 #define __al_included_acodec_helper_h
 
+#include "allegro5/internal/aintern_vector.h"
+
 void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
 void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
+bool _al_acodec_feed_thread_is_busy(ALLEGRO_AUDIO_STREAM *stream);
+
+/* A seek index maps sample positions to byte offsets in the file at which
+ * the decoder can resume, so that streams can seek without having the codec
+ * library bisect the file.  The offsets are only hints; the codecs check
+ * where they actually ended up and decode forward from there.
+ */
+typedef struct ACODEC_SEEK_INDEX {
+   _AL_VECTOR points;         /* ACODEC_SEEK_POINT, sorted by sample */
+   int64_t min_spacing;       /* in samples */
+   bool modified;
+} ACODEC_SEEK_INDEX;
+
+typedef struct ACODEC_SEEK_POINT {
+   int64_t sample;
+   int64_t offset;
+} ACODEC_SEEK_POINT;
+
+ACODEC_SEEK_INDEX *_al_acodec_create_seek_index(int64_t min_spacing);
+void _al_acodec_destroy_seek_index(ACODEC_SEEK_INDEX *index);
+void _al_acodec_add_seek_point(ACODEC_SEEK_INDEX *index, int64_t sample,
+   int64_t offset);
+bool _al_acodec_find_seek_point(ACODEC_SEEK_INDEX *index, int64_t sample,
+   ACODEC_SEEK_POINT *point);
+void _al_acodec_load_seek_index(ACODEC_SEEK_INDEX *index,
+   const char *filename, int64_t file_size);
+void _al_acodec_save_seek_index(ACODEC_SEEK_INDEX *index,
+   const char *filename, int64_t file_size);
 
 #endif
@@ -36,8 +36,20 @@ struct AL_OV_DATA {
    int bitstream;
    double loop_start;
    double loop_end;
+   ACODEC_SEEK_INDEX *index;
+   ALLEGRO_USTR *filename;
+   int64_t file_size;
+   int64_t data_start;
+   bool index_scanned;
+   bool seek_pending;
+   double seek_time;
 };
 
+/* If an indexed seek lands further than this before the wanted position we
+ * let vorbisfile find the position itself instead of decoding up to it.
+ */
+#define MAX_SKIP_SECS   2
+
 
 /* dynamic loading support (Windows only currently) */
 #ifdef ALLEGRO_CFG_ACODEC_VORBISFILE_DLL
@@ -54,13 +66,17 @@ static struct
    int (*ov_open_callbacks)(void *, OggVorbis_File *, const char *, long, ov_callbacks);
    double (*ov_time_total)(OggVorbis_File *, int);
    int (*ov_time_seek_lap)(OggVorbis_File *, double);
+   int (*ov_raw_seek_lap)(OggVorbis_File *, ogg_int64_t);
    double (*ov_time_tell)(OggVorbis_File *);
+   ogg_int64_t (*ov_pcm_tell)(OggVorbis_File *);
    long (*ov_read)(OggVorbis_File *, char *, int, int, int, int, int *);
 #else
    int (*ov_open_callbacks)(void *, OggVorbis_File *, const char *, long, ov_callbacks);
    ogg_int64_t (*ov_time_total)(OggVorbis_File *, int);
    int (*ov_time_seek)(OggVorbis_File *, ogg_int64_t);
+   int (*ov_raw_seek)(OggVorbis_File *, ogg_int64_t);
    ogg_int64_t (*ov_time_tell)(OggVorbis_File *);
+   ogg_int64_t (*ov_pcm_tell)(OggVorbis_File *);
    long (*ov_read)(OggVorbis_File *, char *, int, int *);
 #endif
 } lib;
@@ -121,12 +137,16 @@ static bool init_dynlib(void)
 #ifndef TREMOR
    INITSYM(ov_time_total);
    INITSYM(ov_time_seek_lap);
+   INITSYM(ov_raw_seek_lap);
    INITSYM(ov_time_tell);
+   INITSYM(ov_pcm_tell);
    INITSYM(ov_read);
 #else
    INITSYM(ov_time_total);
    INITSYM(ov_time_seek);
+   INITSYM(ov_raw_seek);
    INITSYM(ov_time_tell);
+   INITSYM(ov_pcm_tell);
    INITSYM(ov_read);
 #endif
 
@@ -303,11 +323,157 @@ ALLEGRO_SAMPLE *_al_load_ogg_vorbis_f(ALLEGRO_FILE *file)
 }
 
 
-static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
+/* Reads 16-bit samples from the current position. */
+static long read_pcm(AL_OV_DATA *extra, char *data, int length)
 {
-   AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
-   if (time >= extra->loop_end)
+#ifdef ALLEGRO_LITTLE_ENDIAN
+   const int endian = 0;      /* 0 for Little-Endian, 1 for Big-Endian */
+#else
+   const int endian = 1;      /* 0 for Little-Endian, 1 for Big-Endian */
+#endif
+   const int word_size = 2;   /* 1 = 8bit, 2 = 16-bit. nothing else */
+   const int signedness = 1;  /* 0 for unsigned, 1 for signed */
+
+#ifndef TREMOR
+   return lib.ov_read(extra->vf, data, length, endian, word_size, signedness,
+      &extra->bitstream);
+#else
+   (void)endian;
+   (void)word_size;
+   (void)signedness;
+   return lib.ov_read(extra->vf, data, length, &extra->bitstream);
+#endif
+}
+
+
+/* Ogg pages record the granule position, which for Vorbis is the sample
+ * position at the end of the last packet completed on the page.  This means
+ * we can index the whole file by reading just the page headers.
+ */
+static void build_seek_index(AL_OV_DATA *extra, int64_t start)
+{
+   ALLEGRO_FILE *f = extra->file;
+   int64_t resume = al_ftell(f);
+   int64_t pos = start;
+   int64_t last_granule = 0;
+   uint32_t first_serial = 0;
+   bool first_page = true;
+   unsigned char header[27];
+   unsigned char lacing[255];
+
+   if (resume < 0 || !al_fseek(f, start, ALLEGRO_SEEK_SET))
+      return;
+
+   for (;;) {
+      int64_t granule;
+      uint32_t serial;
+      int num_segments;
+      int body_size = 0;
+      int i;
+
+      if (al_fread(f, header, 27) != 27 || memcmp(header, "OggS", 4) != 0)
+         break;
+      num_segments = header[26];
+      if (al_fread(f, lacing, num_segments) != (size_t)num_segments)
+         break;
+      for (i = 0; i < num_segments; i++)
+         body_size += lacing[i];
+
+      granule = 0;
+      for (i = 7; i >= 0; i--)
+         granule = (granule << 8) | header[6 + i];
+      serial = header[14] | (header[15] << 8) | (header[16] << 16) |
+         ((uint32_t)header[17] << 24);
+
+      if (first_page) {
+         first_serial = serial;
+         first_page = false;
+      }
+
+      if (serial == first_serial) {
+         /* Audio on this page starts where the previous page ended.  The
+          * header pages have a granule position of 0 and are not indexed.
+          */
+         if (last_granule > 0)
+            _al_acodec_add_seek_point(extra->index, last_granule, pos);
+         if (granule != -1)
+            last_granule = granule;
+      }
+      else if (header[5] & 0x02) {
+         /* The beginning of a chained stream.  Sample positions restart,
+          * so leave the rest to vorbisfile.
+          */
+         break;
+      }
+
+      pos += 27 + num_segments + body_size;
+      if (!al_fseek(f, pos, ALLEGRO_SEEK_SET))
+         break;
+   }
+
+   /* vorbisfile expects the file position to be where it left it. */
+   al_fseek(f, resume, ALLEGRO_SEEK_SET);
+}
+
+
+static bool skip_samples(AL_OV_DATA *extra, int64_t samples)
+{
+   char buf[4096];
+   int64_t bytes = samples * extra->vi->channels * 2;
+
+   while (bytes > 0) {
+      long read = read_pcm(extra, buf, _ALLEGRO_MIN((int64_t)sizeof(buf), bytes));
+      if (read <= 0)
+         return false;
+      bytes -= read;
+   }
+
+   return true;
+}
+
+
+static bool indexed_seek(AL_OV_DATA *extra, double time)
+{
+   int64_t target = time * extra->vi->rate;
+   ACODEC_SEEK_POINT point;
+   int64_t pos;
+
+   /* Scanning the file takes a while, so wait until the first seek. */
+   if (!extra->index_scanned) {
+      extra->index_scanned = true;
+      if (extra->index && _al_vector_size(&extra->index->points) == 0 &&
+            extra->data_start >= 0)
+         build_seek_index(extra, extra->data_start);
+   }
+
+   if (!_al_acodec_find_seek_point(extra->index, target, &point))
       return false;
+
+#ifndef TREMOR
+   if (lib.ov_raw_seek_lap(extra->vf, point.offset) != 0)
+      return false;
+#else
+   if (lib.ov_raw_seek(extra->vf, point.offset) != 0)
+      return false;
+#endif
+
+   /* The index only holds hints, trust where vorbisfile says we are. */
+   pos = lib.ov_pcm_tell(extra->vf);
+   if (pos < 0 || pos > target ||
+         target - pos > (int64_t)extra->vi->rate * MAX_SKIP_SECS)
+      return false;
+
+   return skip_samples(extra, target - pos);
+}
+
+
+static bool real_seek(AL_OV_DATA *extra, double time)
+{
+   extra->seek_pending = false;
+
+   if (indexed_seek(extra, time))
+      return true;
+
 #ifndef TREMOR
    return (lib.ov_time_seek_lap(extra->vf, time) != -1);
 #else
@@ -316,16 +482,41 @@ static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 }
 
 
+static double ogg_stream_get_length(ALLEGRO_AUDIO_STREAM *stream);
+
+
+static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
+{
+   AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
+   if (time < 0.0 || time >= extra->loop_end ||
+         time >= ogg_stream_get_length(stream))
+      return false;
+
+   /* Nobody else is going to do it. */
+   if (!_al_acodec_feed_thread_is_busy(stream))
+      return real_seek(extra, time);
+
+   /* Seeking may need to read quite a bit of the file, so leave it to the
+    * feeder thread which will decode from the new position right away.
+    */
+   extra->seek_pending = true;
+   extra->seek_time = time;
+   return true;
+}
+
+
 static bool ogg_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
-   return ogg_stream_seek(stream, extra->loop_start);
+   return real_seek(extra, extra->loop_start);
 }
 
 
 static double ogg_stream_get_position(ALLEGRO_AUDIO_STREAM *stream)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
+   if (extra->seek_pending)
+      return extra->seek_time;
 #ifndef TREMOR
    return lib.ov_time_tell(extra->vf);
 #else
@@ -364,6 +555,13 @@ static void ogg_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 
    _al_acodec_stop_feed_thread(stream);
 
+   if (extra->filename) {
+      _al_acodec_save_seek_index(extra->index, al_cstr(extra->filename),
+         extra->file_size);
+      al_ustr_free(extra->filename);
+   }
+   _al_acodec_destroy_seek_index(extra->index);
+
    al_fclose(extra->file);
 
    lib.ov_clear(extra->vf);
@@ -377,26 +575,24 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
                                 size_t buf_size)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
-	
-#ifdef ALLEGRO_LITTLE_ENDIAN
-   const int endian = 0;      /* 0 for Little-Endian, 1 for Big-Endian */
-#else
-   const int endian = 1;      /* 0 for Little-Endian, 1 for Big-Endian */
-#endif
    const int word_size = 2;   /* 1 = 8bit, 2 = 16-bit. nothing else */
-   const int signedness = 1;  /* 0 for unsigned, 1 for signed */
 
    unsigned long pos = 0;
    int read_length = buf_size;
-#ifndef TREMOR
-   double ctime = lib.ov_time_tell(extra->vf);
-#else
-   double ctime = lib.ov_time_tell(extra->vf)/1000.0;
-#endif
+   double ctime;
    double rate = extra->vi->rate;
    double btime = ((double)buf_size / ((double)word_size * (double)extra->vi->channels)) / rate;
    unsigned long read;
-   
+
+   if (extra->seek_pending)
+      real_seek(extra, extra->seek_time);
+
+#ifndef TREMOR
+   ctime = lib.ov_time_tell(extra->vf);
+#else
+   ctime = lib.ov_time_tell(extra->vf)/1000.0;
+#endif
+
    if (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
       if (ctime + btime > extra->loop_end) {
          read_length = (extra->loop_end - ctime) * rate * (double)word_size * (double)extra->vi->channels;
@@ -406,15 +602,7 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
       }
    }
    while (pos < (unsigned long)read_length) {
-#ifndef TREMOR
-      read = lib.ov_read(extra->vf, (char *)data + pos,
-         read_length - pos, endian, word_size, signedness, &extra->bitstream);
-#else
-      (void)endian;
-      (void)signedness;
-      read = lib.ov_read(extra->vf, (char *)data + pos,
-         read_length - pos, &extra->bitstream);
-#endif
+      read = read_pcm(extra, (char *)data + pos, read_length - pos);
       pos += read;
 	   
       /* If nothing read then now to silence from here to the end. */
@@ -433,31 +621,8 @@ static size_t ogg_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
 }
 
 
-ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream(const char *filename,
-   size_t buffer_count, unsigned int samples)
-{
-   ALLEGRO_FILE *f;
-   ALLEGRO_AUDIO_STREAM *stream;
-   ASSERT(filename);
-
-   ALLEGRO_INFO("Loading stream %s.\n", filename);
-   f = al_fopen(filename, "rb");
-   if (!f) {
-      ALLEGRO_WARN("Failed reading %s.\n", filename);
-      return NULL;
-   }
-
-   stream = _al_load_ogg_vorbis_audio_stream_f(f, buffer_count, samples);
-   if (!stream) {
-      al_fclose(f);
-   }
-
-   return stream;
-}
-
-
-ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
-   size_t buffer_count, unsigned int samples)
+static ALLEGRO_AUDIO_STREAM *ogg_stream_open(ALLEGRO_FILE *file,
+   const char *filename, size_t buffer_count, unsigned int samples)
 {
    const int word_size = 2; /* 1 = 8bit, 2 = 16-bit. nothing else */
    OggVorbis_File* vf;
@@ -480,6 +645,13 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
    }
 
    extra->file = file;
+   extra->index = NULL;
+   extra->filename = NULL;
+   extra->file_size = al_fsize(file);
+   extra->seek_pending = false;
+   extra->seek_time = 0.0;
+   extra->index_scanned = false;
+   extra->data_start = al_ftell(file);
    
    vf = al_malloc(sizeof(OggVorbis_File));
    if (lib.ov_open_callbacks(extra, vf, NULL, 0, callbacks) < 0) {
@@ -499,6 +671,12 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
 
    extra->bitstream = -1;
 
+   /* Place a seek point roughly every quarter of a second. */
+   extra->index = _al_acodec_create_seek_index(rate / 4);
+   if (filename) {
+      extra->filename = al_ustr_new(filename);
+      _al_acodec_load_seek_index(extra->index, filename, extra->file_size);
+   }
    ALLEGRO_DEBUG("channels %d\n", channels);
    ALLEGRO_DEBUG("word_size %d\n", word_size);
    ALLEGRO_DEBUG("rate %ld\n", rate);
@@ -509,6 +687,8 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
             _al_word_size_to_depth_conf(word_size),
             _al_count_to_channel_conf(channels));
    if (!stream) {
+      al_ustr_free(extra->filename);
+      _al_acodec_destroy_seek_index(extra->index);
       lib.ov_clear(vf);
       al_free(vf);
       return NULL;
@@ -532,4 +712,34 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
 }
 
 
+ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream(const char *filename,
+   size_t buffer_count, unsigned int samples)
+{
+   ALLEGRO_FILE *f;
+   ALLEGRO_AUDIO_STREAM *stream;
+   ASSERT(filename);
+
+   ALLEGRO_INFO("Loading stream %s.\n", filename);
+   f = al_fopen(filename, "rb");
+   if (!f) {
+      ALLEGRO_WARN("Failed reading %s.\n", filename);
+      return NULL;
+   }
+
+   stream = ogg_stream_open(f, filename, buffer_count, samples);
+   if (!stream) {
+      al_fclose(f);
+   }
+
+   return stream;
+}
+
+
+ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE *file,
+   size_t buffer_count, unsigned int samples)
+{
+   return ogg_stream_open(file, NULL, buffer_count, samples);
+}
+
+
 /* vim: set sts=3 sw=3 et: */
@@ -166,9 +166,14 @@ static AL_VOC_DATA *voc_open(ALLEGRO_FILE *fp)
          READNBYTES(fp, format, 1, NULL);
          READNBYTES(fp, vocdata->channels, 1, NULL);
          vocdata->channels += 1; /* was 0 for mono, 1 for stereo */
+         if (vocdata->channels > 2) {
+            ALLEGRO_WARN("voc_open: unsupported number of channels");
+            return NULL;
+         }
          vocdata->bits = 8; /* only possible codec for Blocktype 8 */
-         vocdata->samplerate = 1000000 / (256 - timeconstant);
-         vocdata->samplerate /= vocdata->channels;
+         /* The time constant is 16 bits here and covers all channels. */
+         vocdata->samplerate = 256000000 /
+            ((65536 - timeconstant) * vocdata->channels);
          vocdata->sample_size = vocdata->channels * vocdata->bits / 8;
          /*
           * Now following there is a blocktype 1 which tells us the length of
@@ -183,7 +188,7 @@ static AL_VOC_DATA *voc_open(ALLEGRO_FILE *fp)
          READNBYTES(fp, x, 1, NULL);
          blocklength += x<<16;
          blocklength -= 2;
-         READNBYTES(fp, x, 2, NULL);
+         al_fseek(fp, 2, ALLEGRO_SEEK_CUR);  // skip time constant and codec
          vocdata->samples = blocklength / vocdata->sample_size;
          vocdata->datapos = al_ftell(fp);
          break;
@@ -205,7 +210,13 @@ static AL_VOC_DATA *voc_open(ALLEGRO_FILE *fp)
             ALLEGRO_WARN("voc_open: unsupported CODEC in voc data");
             return NULL;
          }
-         READNBYTES(fp, x, 4, NULL);         // just skip 4 reserved bytes
+         if (vocdata->channels != 1 && vocdata->channels != 2) {
+            ALLEGRO_WARN("voc_open: unsupported number of channels");
+            return NULL;
+         }
+         al_fseek(fp, 4, ALLEGRO_SEEK_CUR);  // just skip 4 reserved bytes
+         vocdata->sample_size = vocdata->channels * vocdata->bits / 8;
+         vocdata->samples = blocklength / vocdata->sample_size;
          vocdata->datapos = al_ftell(fp);
          break;
       case 2:               //
@@ -257,13 +268,12 @@ ALLEGRO_SAMPLE *_al_load_voc_f(ALLEGRO_FILE *file)
    ALLEGRO_SAMPLE *sample = NULL;
    size_t pos = 0; /* where to write in the buffer */
    size_t read = 0; /*bytes read during last operation */
+   size_t size = 0; /* allocated size of the buffer */
    char* buffer;
 
    size_t bytestoread = 0;
    bool endofvoc = false;
 
-   vocdata = al_malloc(sizeof(AL_VOC_DATA));
-   memset(vocdata, 0, sizeof(*vocdata));
    /*
     * Open file and populate VOC DATA, then create a buffer for the number of
     * samples of the frst block.
@@ -281,22 +291,34 @@ ALLEGRO_SAMPLE *_al_load_voc_f(ALLEGRO_FILE *file)
    /*
     * Let's allocate at least the first block's bytes;
     */
-   buffer = al_malloc(vocdata->samples * vocdata->sample_size);
+   size = vocdata->samples * vocdata->sample_size;
+   buffer = al_malloc(size);
    if (!buffer) {
+      voc_close(vocdata);
       return NULL;
    }
    /*
     * We now need to iterate over data blocks till either we hit end of file
-    * or we find a terminator block.
+    * or we find a terminator block.  Each data block is read with a single
+    * call straight to where it belongs in the buffer.
     */
-   bytestoread = vocdata->samples * vocdata->sample_size;
+   bytestoread = size;
    while(!endofvoc && !al_feof(vocdata->file)) {
       uint32_t blocktype = 0;
       uint32_t x = 0, len = 0;
-      read = al_fread(vocdata->file, buffer, bytestoread);
+      if (pos + bytestoread > size) {
+         char *newbuffer = al_realloc(buffer, pos + bytestoread);
+         if (!newbuffer)
+            break;
+         buffer = newbuffer;
+         size = pos + bytestoread;
+      }
+      read = al_fread(vocdata->file, buffer + pos, bytestoread);
       pos += read;
-      READNBYTES(vocdata->file, blocktype, 1, NULL);   // read next block type
-      if (al_feof(vocdata->file)) break;
+      if (read != bytestoread)
+         break;
+      if (al_fread(vocdata->file, &blocktype, 1) != 1) // read next block type
+         break;
       switch (blocktype) {
          case 0:{  /* we found a terminator block */
             endofvoc = true;
@@ -305,11 +327,13 @@ ALLEGRO_SAMPLE *_al_load_voc_f(ALLEGRO_FILE *file)
          case 2:{  /*we found a continuation block: unlikely but handled */
             x = 0;
             bytestoread = 0;
-            READNBYTES(vocdata->file, bytestoread, 2, NULL);
-            READNBYTES(vocdata->file, x, 1, NULL);
+            if (al_fread(vocdata->file, &bytestoread, 2) != 2 ||
+                al_fread(vocdata->file, &x, 1) != 1) {
+               endofvoc = true;
+               bytestoread = 0;
+               break;
+            }
             bytestoread += x<<16;
-            /* increase subsequently storage */
-            buffer = al_realloc(buffer, sizeof(buffer) + bytestoread);
             break;
             }
          case 1:   // we found a NEW data block starter, I assume this is wrong
@@ -324,15 +348,15 @@ ALLEGRO_SAMPLE *_al_load_voc_f(ALLEGRO_FILE *file)
          case 6:     /* we found a repeat block */
          case 7:{    /* we found an end repeat block */
                      /* all these blocks will be skipped */
-            unsigned int ii;
             len = 0;
             x = 0;
-            READNBYTES(vocdata->file, len, 2, NULL);
-            READNBYTES(vocdata->file, x, 1, NULL);
-            len += x<<16;  // this is the length what's left to skip */
-            for (ii = 0; ii < len ; ++ii) {
-               al_fgetc(vocdata->file);
+            if (al_fread(vocdata->file, &len, 2) != 2 ||
+                al_fread(vocdata->file, &x, 1) != 1) {
+               endofvoc = true;
+               break;
             }
+            len += x<<16;  // this is the length what's left to skip */
+            al_fseek(vocdata->file, len, ALLEGRO_SEEK_CUR);
             bytestoread = 0;  //should let safely check for the next block */
             break;
             }
@@ -341,8 +365,28 @@ ALLEGRO_SAMPLE *_al_load_voc_f(ALLEGRO_FILE *file)
       }
    }
 
-   sample = al_create_sample(buffer, pos, vocdata->samplerate,
-                             _al_word_size_to_depth_conf(vocdata->sample_size),
+#ifdef ALLEGRO_BIG_ENDIAN
+   /* 16-bit VOC data is little endian. */
+   if (vocdata->bits == 16) {
+      uint16_t *p = (uint16_t *)buffer;
+      size_t n = pos / 2;
+      while (n-- > 0) {
+         *p = (*p >> 8) | (*p << 8);
+         p++;
+      }
+   }
+#endif
+
+   if (vocdata->sample_size <= 0 || pos < (size_t)vocdata->sample_size) {
+      ALLEGRO_WARN("No sample data in VOC file.\n");
+      al_free(buffer);
+      voc_close(vocdata);
+      return NULL;
+   }
+
+   sample = al_create_sample(buffer, pos / vocdata->sample_size,
+                             vocdata->samplerate,
+                             _al_word_size_to_depth_conf(vocdata->bits / 8),
                              _al_count_to_channel_conf(vocdata->channels),
                              true);
    if (!sample)
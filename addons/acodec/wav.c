@@ -13,15 +13,22 @@
 ALLEGRO_DEBUG_CHANNEL("wav")
 
 
+#define WAVE_FORMAT_PCM          1
+#define WAVE_FORMAT_IEEE_FLOAT   3
+#define WAVE_FORMAT_EXTENSIBLE   0xFFFE
+
+
 typedef struct WAVFILE
 {
    ALLEGRO_FILE *f; 
    size_t dpos;     /* the starting position of the data chunk */
    int freq;        /* e.g., 44100 */
-   short bits;      /* 8 (unsigned char) or 16 (signed short) */
+   short bits;      /* 8 (unsigned char), 16 or 24 (signed) or 32 (float) */
    short channels;  /* 1 (mono) or 2 (stereo) */
    int sample_size; /* channels * bits/8 */
    int samples;     /* # of samples. size = samples * sample_size */
+   ALLEGRO_AUDIO_DEPTH depth; /* depth of the decoded samples */
+   int out_sample_size;       /* channels * al_get_audio_depth_size(depth) */
    double loop_start;
    double loop_end;
 } WAVFILE;
@@ -62,7 +69,7 @@ static WAVFILE *wav_open(ALLEGRO_FILE *f)
     */
    while (true) {
       int length = 0;
-      short pcm = 0;
+      int pcm = 0;
 
       if (al_fread(f, buffer, 4) != 4)
          goto wav_open_error;
@@ -74,9 +81,10 @@ static WAVFILE *wav_open(ALLEGRO_FILE *f)
          if (length < 16)
             goto wav_open_error;
 
-         /* should be 1 for PCM data */
-         pcm = al_fread16le(f);
-         if (pcm != 1)
+         /* should be 1 for PCM data or 3 for floating point data */
+         pcm = (uint16_t)al_fread16le(f);
+         if (pcm != WAVE_FORMAT_PCM && pcm != WAVE_FORMAT_IEEE_FLOAT &&
+               pcm != WAVE_FORMAT_EXTENSIBLE)
             goto wav_open_error;
 
          /* mono or stereo data */
@@ -91,13 +99,32 @@ static WAVFILE *wav_open(ALLEGRO_FILE *f)
          /* skip six bytes */
          al_fseek(f, 6, ALLEGRO_SEEK_CUR);   
 
-         /* 8 or 16 bit data? */
+         /* 8, 16 or 24 bit integer, or 32 bit float data? */
          wavfile->bits = al_fread16le(f);
-         if ((wavfile->bits != 8) && (wavfile->bits != 16))
+         length -= 16;
+
+         /* The extensible format keeps the real format in the first two
+          * bytes of the sub-format GUID, after cbSize, wValidBitsPerSample
+          * and dwChannelMask.
+          */
+         if (pcm == WAVE_FORMAT_EXTENSIBLE) {
+            if (length < 10)
+               goto wav_open_error;
+            al_fseek(f, 8, ALLEGRO_SEEK_CUR);
+            pcm = (uint16_t)al_fread16le(f);
+            length -= 10;
+         }
+
+         if (pcm == WAVE_FORMAT_PCM) {
+            if (wavfile->bits != 8 && wavfile->bits != 16 &&
+                  wavfile->bits != 24)
+               goto wav_open_error;
+         }
+         else if (pcm != WAVE_FORMAT_IEEE_FLOAT || wavfile->bits != 32) {
             goto wav_open_error;
+         }
 
          /* Skip remainder of chunk */
-         length -= 16;
          if (length > 0)
             al_fseek(f, length, ALLEGRO_SEEK_CUR);
       }
@@ -112,17 +139,13 @@ static WAVFILE *wav_open(ALLEGRO_FILE *f)
    }
 
    /* find out how many samples exist */
-   wavfile->samples = al_fread32le(f);
-
-   if (wavfile->channels == 2) {
-      wavfile->samples = (wavfile->samples + 1) / 2;
-   }
-
-   if (wavfile->bits == 16) {
-      wavfile->samples /= 2;
-   }
-
    wavfile->sample_size = wavfile->channels * wavfile->bits / 8;
+   wavfile->samples = al_fread32le(f) / wavfile->sample_size;
+
+   /* 24 bit samples are unpacked into 32 bits. */
+   wavfile->depth = _al_word_size_to_depth_conf(wavfile->bits / 8);
+   wavfile->out_sample_size = wavfile->channels *
+      al_get_audio_depth_size(wavfile->depth);
 
    wavfile->dpos = al_ftell(f);
 
@@ -139,35 +162,60 @@ wav_open_error:
 /* wav_read:
  *  Reads up to 'samples' number of samples from the wav ALLEGRO_FILE into 'data'.
  *  Returns the actual number of samples written to 'data'.
+ *
+ *  The data is read with a single call straight into 'data'.  Samples which
+ *  are not stored the way Allegro wants them are read into the end of 'data'
+ *  and converted in place, front to back.  This works as the converted
+ *  samples are never smaller than the ones in the file.
  */
 static size_t wav_read(WAVFILE *wavfile, void *data, size_t samples)
 {
+   size_t offset;
    size_t bytes_read;
+   size_t n;
 
    ASSERT(wavfile);
 
-   bytes_read = al_fread(wavfile->f, data, samples * wavfile->sample_size);
+   offset = samples * (wavfile->out_sample_size - wavfile->sample_size);
+   bytes_read = al_fread(wavfile->f, (char *)data + offset,
+      samples * wavfile->sample_size);
+   samples = bytes_read / wavfile->sample_size;
+   n = samples * wavfile->channels;
 
+   if (wavfile->bits == 24) {
+      const uint8_t *src = (uint8_t *)data + offset;
+      int32_t *dst = data;
+
+      while (n-- > 0) {
+         *dst++ = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 |
+            (uint32_t)src[2] << 24) >> 8;
+         src += 3;
+      }
+   }
+#ifdef ALLEGRO_BIG_ENDIAN
    /* PCM data in RIFF WAV files is little endian.
     * PCM data in RIFX WAV files is big endian (which we don't support).
     */
-#ifdef ALLEGRO_BIG_ENDIAN
-   if (wavfile->bits == 16) {
-      uint8_t *p = data;
-      const uint8_t *const end = p + bytes_read - 1; /* in case bytes_read is not even */
-
-      /* swap high/low bytes */
-      while (p < end) {
-         uint8_t *const q = p + 1;
-         const uint8_t tmp = *p;
-         *p = *q;
-         *q = tmp;
-         p = q;       
+   else if (wavfile->bits == 16) {
+      uint16_t *p = data;
+
+      while (n-- > 0) {
+         *p = (*p >> 8) | (*p << 8);
+         p++;
+      }
+   }
+   else if (wavfile->bits == 32) {
+      uint32_t *p = data;
+
+      while (n-- > 0) {
+         *p = (*p >> 24) | ((*p >> 8) & 0xFF00) | ((*p << 8) & 0xFF0000) |
+            (*p << 24);
+         p++;
       }
    }
 #endif
 
-   return bytes_read / wavfile->sample_size;
+   return samples;
 }
 
 
@@ -185,11 +233,11 @@ static void wav_close(WAVFILE *wavfile)
 static bool wav_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
 {
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
-   int align = (wavfile->bits / 8) * wavfile->channels;
-   unsigned long cpos = time * (double)(wavfile->freq * (wavfile->bits / 8) * wavfile->channels);
+   int align = wavfile->sample_size;
+   unsigned long cpos = time * (double)(wavfile->freq * wavfile->sample_size);
    if (time >= wavfile->loop_end)
       return false;
-   cpos += cpos % align;
+   cpos -= cpos % align;
    return al_fseek(wavfile->f, wavfile->dpos + cpos, ALLEGRO_SEEK_SET);
 }
 
@@ -208,7 +256,7 @@ static bool wav_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
 static double wav_stream_get_position(ALLEGRO_AUDIO_STREAM * stream)
 {
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
-   double samples_per = (double)((wavfile->bits / 8) * wavfile->channels) * (double)(wavfile->freq);
+   double samples_per = (double)wavfile->sample_size * (double)(wavfile->freq);
    return ((double)(al_ftell(wavfile->f) - wavfile->dpos) / samples_per);
 }
 
@@ -241,7 +289,7 @@ static size_t wav_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
    double ctime, btime;
 
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
-   bytes_per_sample = (wavfile->bits / 8) * wavfile->channels;
+   bytes_per_sample = wavfile->out_sample_size;
    ctime = wav_stream_get_position(stream);
    btime = ((double)buf_size / (double)bytes_per_sample) / (double)(wavfile->freq);
    
@@ -303,17 +351,20 @@ ALLEGRO_SAMPLE *_al_load_wav_f(ALLEGRO_FILE *fp)
    ALLEGRO_SAMPLE *spl = NULL;
 
    if (wavfile) {
-      size_t n = (wavfile->bits / 8) * wavfile->channels * wavfile->samples;
+      size_t n = wavfile->out_sample_size * wavfile->samples;
       char *data = al_malloc(n);
 
       if (data) {
          spl = al_create_sample(data, wavfile->samples, wavfile->freq,
-            _al_word_size_to_depth_conf(wavfile->bits / 8),
+            wavfile->depth,
             _al_count_to_channel_conf(wavfile->channels), true);
 
          if (spl) {
-            memset(data, 0, n);
-            wav_read(wavfile, data, wavfile->samples);
+            /* Only a truncated file leaves anything to clear. */
+            size_t read = wav_read(wavfile, data, wavfile->samples);
+            al_fill_silence(data + read * wavfile->out_sample_size,
+               wavfile->samples - read, wavfile->depth,
+               _al_count_to_channel_conf(wavfile->channels));
          }
          else {
             al_free(data);
@@ -361,8 +412,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_wav_audio_stream_f(ALLEGRO_FILE* f,
       return NULL;
 
    stream = al_create_audio_stream(buffer_count, samples, wavfile->freq,
-      _al_word_size_to_depth_conf(wavfile->bits / 8),
-      _al_count_to_channel_conf(wavfile->channels));
+      wavfile->depth, _al_count_to_channel_conf(wavfile->channels));
 
    if (stream) {
       stream->extra = wavfile;
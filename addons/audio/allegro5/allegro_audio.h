@@ -53,6 +53,8 @@ extern "C" {
 
 #define ALLEGRO_EVENT_AUDIO_RECORDER_FRAGMENT       (515)
 
+#define ALLEGRO_EVENT_AUDIO_STREAM_QUEUED_STARTED   (516)
+
 typedef struct ALLEGRO_AUDIO_RECORDER_EVENT ALLEGRO_AUDIO_RECORDER_EVENT;
 struct ALLEGRO_AUDIO_RECORDER_EVENT
 {
@@ -279,6 +281,8 @@ ALLEGRO_KCM_AUDIO_FUNC(bool, al_seek_audio_stream_secs, (ALLEGRO_AUDIO_STREAM *s
 ALLEGRO_KCM_AUDIO_FUNC(double, al_get_audio_stream_position_secs, (ALLEGRO_AUDIO_STREAM *stream));
 ALLEGRO_KCM_AUDIO_FUNC(double, al_get_audio_stream_length_secs, (ALLEGRO_AUDIO_STREAM *stream));
 ALLEGRO_KCM_AUDIO_FUNC(bool, al_set_audio_stream_loop_secs, (ALLEGRO_AUDIO_STREAM *stream, double start, double end));
+ALLEGRO_KCM_AUDIO_FUNC(bool, al_queue_audio_stream, (ALLEGRO_AUDIO_STREAM *stream, ALLEGRO_AUDIO_STREAM *next));
+ALLEGRO_KCM_AUDIO_FUNC(unsigned int, al_get_audio_stream_queue_length, (ALLEGRO_AUDIO_STREAM *stream));
 
 ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_audio_stream_event_source, (ALLEGRO_AUDIO_STREAM *stream));
 
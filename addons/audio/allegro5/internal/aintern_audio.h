@@ -274,8 +274,29 @@ struct ALLEGRO_AUDIO_STREAM {
 
    void                  *extra;
                          /* Extra data for use by the flac/vorbis addons. */
+
+   _AL_VECTOR            queue;
+                         /* Vector of ALLEGRO_AUDIO_STREAM*.  Streams queued
+                          * with al_queue_audio_stream.  When the feeder runs
+                          * out of data it takes over the feeder of the first
+                          * one and carries on filling the same fragment.
+                          */
+
+   _AL_VECTOR            queue_starts;
+                         /* Vector of _AL_STREAM_QUEUE_START.  Fragments in
+                          * which a queued stream begins, in the order they
+                          * will be played.
+                          */
+
+   unsigned int          queue_started;
+                         /* Number of queued streams which began playing. */
 };
 
+typedef struct _AL_STREAM_QUEUE_START {
+   void *fragment;
+   unsigned int offset;    /* in samples */
+} _AL_STREAM_QUEUE_START;
+
 bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream);
 
 
@@ -320,6 +341,7 @@ extern void _al_set_error(int error, char* string);
 
 /* Supposedly internal */
 ALLEGRO_KCM_AUDIO_FUNC(void*, _al_kcm_feed_stream, (ALLEGRO_THREAD *self, void *vstream));
+ALLEGRO_KCM_AUDIO_FUNC(void, _al_kcm_stop_feed_thread, (ALLEGRO_AUDIO_STREAM *stream));
 
 /* Helper to emit an event that the stream has got a buffer ready to be refilled. */
 void _al_kcm_emit_stream_events(ALLEGRO_AUDIO_STREAM *stream);
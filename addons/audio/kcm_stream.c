@@ -127,6 +127,9 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
       stream->used_bufs[i] = buffer + MAX_LAG * bytes_per_sample;
    }
 
+   _al_vector_init(&stream->queue, sizeof(ALLEGRO_AUDIO_STREAM *));
+   _al_vector_init(&stream->queue_starts, sizeof(_AL_STREAM_QUEUE_START));
+
    al_init_user_event_source(&stream->spl.es);
 
    /* This can lead to deadlocks on shutdown, hence we don't do it. */
@@ -141,13 +144,25 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
 void al_destroy_audio_stream(ALLEGRO_AUDIO_STREAM *stream)
 {
    if (stream) {
-      if (stream->feed_thread) {
+      /* Streams which were queued on another stream no longer have a feeder
+       * thread, but still need to release their feeder.
+       */
+      if (stream->unload_feeder) {
          stream->unload_feeder(stream);
       }
       /* See commented out call to _al_kcm_register_destructor. */
       /* _al_kcm_unregister_destructor(stream); */
       _al_kcm_detach_from_parent(&stream->spl);
 
+      while (!_al_vector_is_empty(&stream->queue)) {
+         ALLEGRO_AUDIO_STREAM **next = _al_vector_ref_back(&stream->queue);
+         al_destroy_audio_stream(*next);
+         _al_vector_delete_at(&stream->queue,
+            _al_vector_size(&stream->queue) - 1);
+      }
+      _al_vector_free(&stream->queue);
+      _al_vector_free(&stream->queue_starts);
+
       al_destroy_user_event_source(&stream->spl.es);
       al_free(stream->main_buffer);
       al_free(stream->used_bufs);
@@ -522,6 +537,9 @@ static void reset_stopped_stream(ALLEGRO_AUDIO_STREAM *stream)
    stream->spl.pos = stream->spl.spl_data.len;
    stream->spl.pos_bresenham_error = 0;
    stream->consumed_fragments = 0;
+
+   /* Those fragments won't be played any more. */
+   _al_vector_free(&stream->queue_starts);
 }
 
 
@@ -653,10 +671,66 @@ bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream)
 
    stream->spl.pos = 0;
 
+   if (!_al_vector_is_empty(&stream->queue_starts)) {
+      _AL_STREAM_QUEUE_START *start = _al_vector_ref_front(&stream->queue_starts);
+      if (start->fragment == new_buf) {
+         ALLEGRO_EVENT event;
+         event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_QUEUED_STARTED;
+         event.user.timestamp = al_get_time();
+         event.user.data1 = ++stream->queue_started;
+         event.user.data2 = start->offset;
+         _al_vector_delete_at(&stream->queue_starts, 0);
+         al_emit_user_event(&stream->spl.es, &event, NULL);
+      }
+   }
+
    return true;
 }
 
 
+/* Swaps the feeder of the stream with that of the first queued stream.
+ * Afterwards the queued stream holds the finished feeder and can be
+ * destroyed.
+ */
+static ALLEGRO_AUDIO_STREAM *advance_queue(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_AUDIO_STREAM *next;
+   ALLEGRO_AUDIO_STREAM tmp;
+
+   next = *(ALLEGRO_AUDIO_STREAM **)_al_vector_ref_front(&stream->queue);
+   _al_vector_delete_at(&stream->queue, 0);
+
+   tmp.unload_feeder = stream->unload_feeder;
+   tmp.rewind_feeder = stream->rewind_feeder;
+   tmp.seek_feeder = stream->seek_feeder;
+   tmp.get_feeder_position = stream->get_feeder_position;
+   tmp.get_feeder_length = stream->get_feeder_length;
+   tmp.set_feeder_loop = stream->set_feeder_loop;
+   tmp.feeder = stream->feeder;
+   tmp.extra = stream->extra;
+
+   stream->unload_feeder = next->unload_feeder;
+   stream->rewind_feeder = next->rewind_feeder;
+   stream->seek_feeder = next->seek_feeder;
+   stream->get_feeder_position = next->get_feeder_position;
+   stream->get_feeder_length = next->get_feeder_length;
+   stream->set_feeder_loop = next->set_feeder_loop;
+   stream->feeder = next->feeder;
+   stream->extra = next->extra;
+
+   next->unload_feeder = tmp.unload_feeder;
+   next->rewind_feeder = tmp.rewind_feeder;
+   next->seek_feeder = tmp.seek_feeder;
+   next->get_feeder_position = tmp.get_feeder_position;
+   next->get_feeder_length = tmp.get_feeder_length;
+   next->set_feeder_loop = tmp.set_feeder_loop;
+   next->feeder = tmp.feeder;
+   next->extra = tmp.extra;
+
+   return next;
+}
+
+
 /* _al_kcm_feed_stream:
  * A routine running in another thread that feeds the stream buffers as
  * neccesary, usually getting data from some file reader backend.
@@ -683,6 +757,7 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
    while (!stream->quit_feed_thread) {
       char *fragment;
       ALLEGRO_EVENT event;
+      ALLEGRO_AUDIO_STREAM *finished = NULL;
 
       al_wait_for_event(queue, &event);
 
@@ -703,6 +778,32 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
 
          maybe_lock_mutex(stream->spl.mutex);
          bytes_written = stream->feeder(stream, fragment, bytes);
+
+         /* Continue with the next queued stream in the same fragment, so
+          * there is no gap between the two.  Only the finished stream is
+          * left for after the fragment has been handed over.
+          */
+         while (bytes_written < bytes &&
+               !_al_vector_is_empty(&stream->queue)) {
+            const int bytes_per_sample =
+               al_get_channel_count(stream->spl.spl_data.chan_conf) *
+               al_get_audio_depth_size(stream->spl.spl_data.depth);
+            _AL_STREAM_QUEUE_START *start;
+
+            if (finished) {
+               maybe_unlock_mutex(stream->spl.mutex);
+               al_destroy_audio_stream(finished);
+               maybe_lock_mutex(stream->spl.mutex);
+            }
+            finished = advance_queue(stream);
+
+            start = _al_vector_alloc_back(&stream->queue_starts);
+            start->fragment = fragment;
+            start->offset = bytes_written / bytes_per_sample;
+
+            bytes_written += stream->feeder(stream, fragment + bytes_written,
+               bytes - bytes_written);
+         }
          maybe_unlock_mutex(stream->spl.mutex);
 
         /* In case it reaches the end of the stream source, stream feeder will
@@ -723,9 +824,12 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
 
          if (!al_set_audio_stream_fragment(stream, fragment)) {
             ALLEGRO_ERROR("Error setting stream buffer.\n");
+            al_destroy_audio_stream(finished);
             continue;
          }
 
+         al_destroy_audio_stream(finished);
+
          /* The streaming source doesn't feed any more, drain buffers and quit. */
          if (bytes_written != bytes &&
             stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONCE) {
@@ -750,6 +854,36 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
 }
 
 
+/* _al_kcm_stop_feed_thread:
+ *  Stops the thread started for a stream loaded with al_load_audio_stream,
+ *  if it still has one.
+ */
+void _al_kcm_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
+{
+   ALLEGRO_EVENT quit_event;
+
+   if (!stream->feed_thread)
+      return;
+
+   /* Need to wait for the thread to start, otherwise the quit event may be
+    * sent before the event source is registered with the queue. */
+   al_lock_mutex(stream->feed_thread_started_mutex);
+   while (!stream->feed_thread_started) {
+      al_wait_cond(stream->feed_thread_started_cond, stream->feed_thread_started_mutex);
+   }
+   al_unlock_mutex(stream->feed_thread_started_mutex);
+
+   quit_event.type = _KCM_STREAM_FEEDER_QUIT_EVENT_TYPE;
+   al_emit_user_event(al_get_audio_stream_event_source(stream), &quit_event, NULL);
+   al_join_thread(stream->feed_thread, NULL);
+   al_destroy_thread(stream->feed_thread);
+   al_destroy_cond(stream->feed_thread_started_cond);
+   al_destroy_mutex(stream->feed_thread_started_mutex);
+
+   stream->feed_thread = NULL;
+}
+
+
 void _al_kcm_emit_stream_events(ALLEGRO_AUDIO_STREAM *stream)
 {
    /* Emit one event for each stream fragment available right now.
@@ -863,6 +997,61 @@ bool al_set_audio_stream_loop_secs(ALLEGRO_AUDIO_STREAM *stream,
 }
 
 
+/* Function: al_queue_audio_stream
+ */
+bool al_queue_audio_stream(ALLEGRO_AUDIO_STREAM *stream,
+   ALLEGRO_AUDIO_STREAM *next)
+{
+   ALLEGRO_AUDIO_STREAM **slot;
+   ASSERT(stream);
+   ASSERT(next);
+
+   if (!stream->feeder || !next->feeder || next == stream) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "Only streams loaded with al_load_audio_stream can be queued");
+      return false;
+   }
+   if (al_get_audio_stream_attached(next) ||
+         !_al_vector_is_empty(&next->queue)) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "Attempted to queue a stream which is in use");
+      return false;
+   }
+   if (next->spl.spl_data.frequency != stream->spl.spl_data.frequency ||
+         next->spl.spl_data.depth != stream->spl.spl_data.depth ||
+         next->spl.spl_data.chan_conf != stream->spl.spl_data.chan_conf) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "Attempted to queue a stream with a different format");
+      return false;
+   }
+
+   /* From now on the stream's own feeder thread does all the work. */
+   _al_kcm_stop_feed_thread(next);
+
+   maybe_lock_mutex(stream->spl.mutex);
+   slot = _al_vector_alloc_back(&stream->queue);
+   *slot = next;
+   maybe_unlock_mutex(stream->spl.mutex);
+
+   return true;
+}
+
+
+/* Function: al_get_audio_stream_queue_length
+ */
+unsigned int al_get_audio_stream_queue_length(ALLEGRO_AUDIO_STREAM *stream)
+{
+   unsigned int ret;
+   ASSERT(stream);
+
+   maybe_lock_mutex(stream->spl.mutex);
+   ret = _al_vector_size(&stream->queue);
+   maybe_unlock_mutex(stream->spl.mutex);
+
+   return ret;
+}
+
+
 /* Function: al_get_audio_stream_event_source
  */
 ALLEGRO_EVENT_SOURCE *al_get_audio_stream_event_source(
@@ -48,6 +48,10 @@
 typedef struct ALLEGRO_FONT ALLEGRO_FONT;
 typedef struct ALLEGRO_FONT_VTABLE ALLEGRO_FONT_VTABLE;
 
+/* Type: ALLEGRO_TEXT_LAYOUT
+*/
+typedef struct ALLEGRO_TEXT_LAYOUT ALLEGRO_TEXT_LAYOUT;
+
 struct ALLEGRO_FONT
 {
    void *data;
@@ -70,6 +74,10 @@ struct ALLEGRO_FONT_VTABLE
       const ALLEGRO_USTR *text, int *bbx, int *bby, int *bbw, int *bbh));
    ALLEGRO_FONT_METHOD(int, get_font_ranges, (ALLEGRO_FONT *font,
       int ranges_count, int *ranges));
+   ALLEGRO_FONT_METHOD(void, cache_glyphs, (ALLEGRO_FONT *font,
+      int ranges_count, const int *ranges));
+   ALLEGRO_FONT_METHOD(int, get_glyph_advance, (const ALLEGRO_FONT *font,
+      int codepoint1, int codepoint2));
 };
 
 enum {
@@ -111,6 +119,10 @@ ALLEGRO_FONT_FUNC(void, al_shutdown_font_addon, (void));
 ALLEGRO_FONT_FUNC(uint32_t, al_get_allegro_font_version, (void));
 ALLEGRO_FONT_FUNC(int, al_get_font_ranges, (ALLEGRO_FONT *font,
    int ranges_count, int *ranges));
+ALLEGRO_FONT_FUNC(void, al_cache_font_glyphs, (ALLEGRO_FONT *font,
+   char const *text));
+ALLEGRO_FONT_FUNC(void, al_cache_font_glyph_ranges, (ALLEGRO_FONT *font,
+   int ranges_count, const int *ranges));
 
 ALLEGRO_FONT_FUNC(void, al_draw_multiline_text, (const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, float max_width, float line_height, int flags, const char *text));
 ALLEGRO_FONT_FUNC(void, al_draw_multiline_textf, (const ALLEGRO_FONT *font, ALLEGRO_COLOR color, float x, float y, float max_width, float line_height, int flags, const char *format, ...));
@@ -126,6 +138,23 @@ ALLEGRO_FONT_FUNC(void, al_do_multiline_ustr, (const ALLEGRO_FONT *font,
    bool (*cb)(int line_num, const ALLEGRO_USTR *line, void *extra),
    void *extra));
 
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_LAYOUT *, al_create_text_layout, (const ALLEGRO_FONT *font,
+   float max_width));
+ALLEGRO_FONT_FUNC(void, al_destroy_text_layout, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(void, al_append_text_layout_text, (ALLEGRO_TEXT_LAYOUT *layout,
+   const char *text));
+ALLEGRO_FONT_FUNC(void, al_append_text_layout_ustr, (ALLEGRO_TEXT_LAYOUT *layout,
+   const ALLEGRO_USTR *ustr));
+ALLEGRO_FONT_FUNC(void, al_clear_text_layout, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_count, (const ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(const ALLEGRO_USTR *, al_get_text_layout_line, (const ALLEGRO_TEXT_LAYOUT *layout,
+   int line, ALLEGRO_USTR_INFO *info));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_width, (const ALLEGRO_TEXT_LAYOUT *layout,
+   int line));
+ALLEGRO_FONT_FUNC(void, al_draw_text_layout, (const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y, float line_height, int flags,
+   int first_line, int num_lines));
+
 
 #ifdef __cplusplus
    }
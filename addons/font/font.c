@@ -106,6 +106,14 @@ static void color_get_text_dimensions(ALLEGRO_FONT const *f,
 
 
 
+/* The lookup table of a color font covers the code points below
+ * LOOKUP_BLOCKS * LOOKUP_BLOCK_SIZE.
+ */
+#define LOOKUP_BLOCK_SIZE  256
+#define LOOKUP_BLOCKS      256
+
+
+
 static ALLEGRO_FONT_COLOR_DATA *_al_font_find_page(
    ALLEGRO_FONT_COLOR_DATA *cf, int ch)
 {
@@ -118,22 +126,93 @@ static ALLEGRO_FONT_COLOR_DATA *_al_font_find_page(
 }
 
 
-/* _color_find_glyph:
- *  Helper for color vtable entries, below.
+
+static void free_lookup(ALLEGRO_FONT_COLOR_DATA *cf)
+{
+    int i;
+
+    if (!cf->lookup)
+        return;
+    for (i = 0; i < LOOKUP_BLOCKS; i++)
+        al_free(cf->lookup[i]);
+    al_free(cf->lookup);
+    cf->lookup = NULL;
+}
+
+
+
+/* _al_font_color_init_lookup:
+ *  Fills in the lookup table of a color font, once all its ranges are
+ *  there. Without it, finding a glyph walks the list of ranges. If there
+ *  is not enough memory, the font works without the table.
  */
-static ALLEGRO_BITMAP* _al_font_color_find_glyph(const ALLEGRO_FONT* f, int ch)
+void _al_font_color_init_lookup(ALLEGRO_FONT_COLOR_DATA *first)
 {
-    ALLEGRO_FONT_COLOR_DATA* cf = (ALLEGRO_FONT_COLOR_DATA*)(f->data);
+    ALLEGRO_FONT_COLOR_DATA *cf;
+    int ch;
+
+    free_lookup(first);
+    first->lookup = al_calloc(LOOKUP_BLOCKS, sizeof(ALLEGRO_BITMAP **));
+    if (!first->lookup)
+        return;
+
+    for (cf = first; cf; cf = cf->next) {
+        for (ch = cf->begin; ch < cf->end; ch++) {
+            ALLEGRO_BITMAP ***block = &first->lookup[ch / LOOKUP_BLOCK_SIZE];
+
+            if (ch >= LOOKUP_BLOCKS * LOOKUP_BLOCK_SIZE)
+                break;
+            /* With overlapping ranges, the first one has the glyph. */
+            if (_al_font_find_page(first, ch) != cf)
+                continue;
+            if (!*block) {
+                *block = al_calloc(LOOKUP_BLOCK_SIZE, sizeof(ALLEGRO_BITMAP *));
+                if (!*block) {
+                    free_lookup(first);
+                    return;
+                }
+            }
+            (*block)[ch % LOOKUP_BLOCK_SIZE] = cf->bitmaps[ch - cf->begin];
+        }
+    }
+}
+
+
+
+static ALLEGRO_BITMAP *find_glyph(ALLEGRO_FONT_COLOR_DATA *cf, int ch)
+{
+    if (cf->lookup && ch >= 0 && ch < LOOKUP_BLOCKS * LOOKUP_BLOCK_SIZE) {
+        ALLEGRO_BITMAP **block = cf->lookup[ch / LOOKUP_BLOCK_SIZE];
+        return block ? block[ch % LOOKUP_BLOCK_SIZE] : NULL;
+    }
 
     cf = _al_font_find_page(cf, ch);
     if (cf) {
         return cf->bitmaps[ch - cf->begin];
     }
+    return NULL;
+}
+
+
+/* _color_find_glyph:
+ *  Helper for color vtable entries, below.
+ */
+static ALLEGRO_BITMAP* _al_font_color_find_glyph(const ALLEGRO_FONT* f, int ch)
+{
+    ALLEGRO_FONT_COLOR_DATA* cf = (ALLEGRO_FONT_COLOR_DATA*)(f->data);
+    ALLEGRO_BITMAP *g;
+
+    if (!cf)
+        return NULL;
+
+    g = find_glyph(cf, ch);
+    if (g)
+        return g;
 
     /* if we don't find the character, then search for the missing
-       glyph, but don't get stuck in a loop. */
+       glyph. */
     if (ch != al_font_404_character)
-        return _al_font_color_find_glyph(f, al_font_404_character);
+        return find_glyph(cf, al_font_404_character);
     return 0;
 }
 
@@ -179,6 +258,8 @@ static int color_render_char(const ALLEGRO_FONT* f,
    return w;
 }
 
+#define COLOR_RENDER_QUADS   64
+
 /* color_render:
  *  (color vtable entry)
  *  Renders a color font onto a bitmap, at the specified location, using
@@ -189,6 +270,13 @@ static int color_render(const ALLEGRO_FONT* f, ALLEGRO_COLOR color,
    const ALLEGRO_USTR *text,
     float x, float y)
 {
+    /* Glyphs are collected while they come from the same bitmap, and
+     * drawn with one call.
+     */
+    float quads[COLOR_RENDER_QUADS * 6];
+    int num_quads = 0;
+    ALLEGRO_BITMAP *sheet = NULL;
+    int h = f->vtable->font_height(f);
     int pos = 0;
     int advance = 0;
     int32_t ch;
@@ -196,8 +284,34 @@ static int color_render(const ALLEGRO_FONT* f, ALLEGRO_COLOR color,
 
     al_hold_bitmap_drawing(true);
     while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-        advance += f->vtable->render_char(f, color, ch, x + advance, y);
+        ALLEGRO_BITMAP *g = _al_font_color_find_glyph(f, ch);
+        ALLEGRO_BITMAP *parent;
+        float *q;
+
+        if (!g)
+           continue;
+
+        parent = g->parent ? g->parent : g;
+        if (num_quads == COLOR_RENDER_QUADS ||
+              (num_quads > 0 && parent != sheet)) {
+           _al_draw_tinted_bitmap_regions(sheet, color, quads, num_quads);
+           num_quads = 0;
+        }
+        sheet = parent;
+
+        q = quads + num_quads * 6;
+        q[0] = g->parent ? g->xofs : 0;
+        q[1] = g->parent ? g->yofs : 0;
+        q[2] = g->w;
+        q[3] = g->h;
+        q[4] = x + advance;
+        q[5] = y + ((float)h - g->h)/2.0f;
+        num_quads++;
+
+        advance += g->w;
     }
+    if (num_quads > 0)
+       _al_draw_tinted_bitmap_regions(sheet, color, quads, num_quads);
     al_hold_bitmap_drawing(held);
     return advance;
 }
@@ -218,8 +332,10 @@ static void color_destroy(ALLEGRO_FONT* f)
 
     cf = (ALLEGRO_FONT_COLOR_DATA*)(f->data);
 
-    if (cf)
+    if (cf) {
         glyphs = cf->glyphs;
+        free_lookup(cf);
+    }
 
     while (cf) {
         ALLEGRO_FONT_COLOR_DATA* next = cf->next;
@@ -262,6 +378,25 @@ static int color_get_font_ranges(ALLEGRO_FONT *font, int ranges_count,
 }
 
 
+static void color_cache_glyphs(ALLEGRO_FONT *font, int ranges_count,
+   const int *ranges)
+{
+   /* All glyphs of a bitmap font are on its bitmaps already. */
+   (void)font;
+   (void)ranges_count;
+   (void)ranges;
+}
+
+
+static int color_get_glyph_advance(const ALLEGRO_FONT *font,
+   int codepoint1, int codepoint2)
+{
+   /* Bitmap fonts have no kerning. */
+   (void)codepoint2;
+   return color_char_length(font, codepoint1);
+}
+
+
 /********
  * vtable declarations
  ********/
@@ -277,6 +412,8 @@ ALLEGRO_FONT_VTABLE _al_font_vtable_color = {
     color_destroy,
     color_get_text_dimensions,
     color_get_font_ranges,
+    color_cache_glyphs,
+    color_get_glyph_advance,
 };
 
 
@@ -9,10 +9,15 @@ typedef struct ALLEGRO_FONT_COLOR_DATA
    ALLEGRO_BITMAP *glyphs;           /* our glyphs */
    ALLEGRO_BITMAP **bitmaps;         /* sub bitmaps pointing to our glyphs */
    struct ALLEGRO_FONT_COLOR_DATA *next;  /* linked list structure */
+   /* Only in the first range: the glyphs of the basic multilingual plane,
+    * in blocks of 256 code points. Blocks without glyphs are NULL.
+    */
+   ALLEGRO_BITMAP ***lookup;
 } ALLEGRO_FONT_COLOR_DATA;
 
 ALLEGRO_FONT *_al_load_bitmap_font(const char *filename,
    int size, int flags);
+void _al_font_color_init_lookup(ALLEGRO_FONT_COLOR_DATA *cf);
 
 
 #endif
@@ -277,6 +277,8 @@ ALLEGRO_FONT *al_grab_font_from_bitmap(ALLEGRO_BITMAP *bmp,
    cf = f->data;
    if (cf && cf->bitmaps[0])
       f->height = al_get_bitmap_height(cf->bitmaps[0]);
+   if (cf)
+      _al_font_color_init_lookup(cf);
 
    if (lock)
       al_unlock_bitmap(bmp);
@@ -25,6 +25,7 @@
 #include "allegro5/allegro.h"
 
 #include "allegro5/allegro_font.h"
+#include "allegro5/internal/aintern_vector.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_system.h"
 
@@ -373,6 +374,54 @@ int al_get_font_ranges(ALLEGRO_FONT *f, int ranges_count, int *ranges)
 }
 
 
+/* Function: al_cache_font_glyph_ranges
+ */
+void al_cache_font_glyph_ranges(ALLEGRO_FONT *f, int ranges_count,
+   const int *ranges)
+{
+   ASSERT(f);
+
+   if (f->vtable->cache_glyphs && ranges_count > 0)
+      f->vtable->cache_glyphs(f, ranges_count, ranges);
+}
+
+
+/* Function: al_cache_font_glyphs
+ */
+void al_cache_font_glyphs(ALLEGRO_FONT *f, char const *text)
+{
+   ALLEGRO_USTR_INFO info;
+   const ALLEGRO_USTR *ustr;
+   _AL_VECTOR ranges;
+   int *range = NULL;
+   int pos = 0;
+   int32_t ch;
+   ASSERT(f);
+   ASSERT(text);
+
+   if (!f->vtable->cache_glyphs)
+      return;
+
+   /* Runs of consecutive code points become a single range. */
+   _al_vector_init(&ranges, 2 * sizeof(int));
+   ustr = al_ref_cstr(&info, text);
+   while ((ch = al_ustr_get_next(ustr, &pos)) >= 0) {
+      if (range && ch == range[1] + 1) {
+         range[1] = ch;
+         continue;
+      }
+      range = _al_vector_alloc_back(&ranges);
+      range[0] = range[1] = ch;
+   }
+
+   if (!_al_vector_is_empty(&ranges)) {
+      f->vtable->cache_glyphs(f, _al_vector_size(&ranges),
+         _al_vector_ref_front(&ranges));
+   }
+   _al_vector_free(&ranges);
+}
+
+
 
 /* This helper function helps splitting an ustr in several delimited parts.
  * It returns an ustr that refers to the next part of the string that
@@ -405,18 +454,12 @@ static const ALLEGRO_USTR *ustr_split_next(const ALLEGRO_USTR *ustr,
 
 
 
-/* This returns the next "soft" line of text from ustr
- * that will fit in max_with using the font font, starting at pos *pos.
- * These are "soft" lines because they are broken up if needed at a space
- * or tab character.
- * This function updates pos if needed, and returns the next "soft" line,
- * or NULL if no more soft lines.
- * The soft line will not include the trailing space where the
- * line was split, but pos will be set to point to after that trailing
- * space so iteration can continue easily.
+/* Like get_next_soft_line, for fonts which can't tell the advance of single
+ * glyphs. Every candidate line is measured from its start with
+ * al_get_ustr_width.
  */
-static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
-   ALLEGRO_USTR_INFO *info, int *pos,
+static const ALLEGRO_USTR *get_next_soft_line_slow(const ALLEGRO_USTR *ustr,
+   ALLEGRO_USTR_INFO *info, int *pos, int *width,
    const ALLEGRO_FONT *font, float max_width)
 {
    const ALLEGRO_USTR *result = NULL;
@@ -442,7 +485,8 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
       result = al_ref_ustr(info, ustr, *pos, end);
 
       /* Check if the line is too long. If it is, return a soft line. */
-      if (al_get_ustr_width(font, result) > max_width) {
+      *width = al_get_ustr_width(font, result);
+      if (*width > max_width) {
          /* Corner case: a single word may not even fit the line.
           * In that case, return the word/line anyway as the "soft line",
           * the user can set a clip rectangle to cut it. */
@@ -456,6 +500,7 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
          else {
             /* Not first word, return old end position without the new word */
             result = al_ref_ustr(info, ustr, *pos, old_end);
+            *width = al_get_ustr_width(font, result);
             /* Set pos to character AFTER end to allow easy iteration. */
             al_ustr_next(ustr, &old_end);
             *pos = old_end;
@@ -470,56 +515,206 @@ static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
 
    /* If we get here the whole ustr will fit.*/
    result = al_ref_ustr(info, ustr, *pos, size);
+   *width = al_get_ustr_width(font, result);
    *pos = size;
    return result;
 }
 
 
-/* Function: al_do_multiline_ustr
+
+/* Returns the next soft line of the hard line ustr which starts at *pos.
+ * The glyph advances are summed up as the words are scanned, so no part of
+ * the line is measured more than twice. The width of the returned line is
+ * stored in *width.
  */
-void al_do_multiline_ustr(const ALLEGRO_FONT *font, float max_width,
-   const ALLEGRO_USTR *ustr,
-   bool (*cb)(int line_num, const ALLEGRO_USTR * line, void *extra),
+static const ALLEGRO_USTR *get_next_soft_line(const ALLEGRO_USTR *ustr,
+   ALLEGRO_USTR_INFO *info, int *pos, int *width,
+   const ALLEGRO_FONT *font, float max_width)
+{
+   const ALLEGRO_USTR *result;
+   int size = al_ustr_size(ustr);
+   int end = *pos;
+   int old_end = -1;
+   int old_width = 0;
+   int line_width;
+   int advance = 0;
+   int32_t last = -1;
+
+   if (!font->vtable->get_glyph_advance) {
+      return get_next_soft_line_slow(ustr, info, pos, width, font,
+         max_width);
+   }
+
+   if (*pos >= size) {
+      return NULL;
+   }
+
+   for (;;) {
+      int next = end;
+      int32_t ch = -1;
+
+      if (end < size)
+         ch = al_ustr_get_next(ustr, &next);
+
+      if (end >= size || ch == ' ' || ch == '\t') {
+         /* [*pos, end) is the line being built. The last glyph of a
+          * line is not kerned against anything.
+          */
+         line_width = advance;
+         if (last >= 0)
+            line_width += font->vtable->get_glyph_advance(font, last, -1);
+
+         /* Check if the line is too long. If it is, return a soft line. */
+         if (line_width > max_width) {
+            /* Corner case: a single word may not even fit the line.
+             * In that case, return the word/line anyway as the "soft line",
+             * the user can set a clip rectangle to cut it. */
+            if (old_end < 0) {
+               result = al_ref_ustr(info, ustr, *pos, end);
+               *width = line_width;
+               /* Set pos to character AFTER end to allow easy iteration. */
+               al_ustr_next(ustr, &end);
+               *pos = end;
+               return result;
+            }
+            else {
+               /* Not first word, return old end position without the new
+                * word.
+                */
+               result = al_ref_ustr(info, ustr, *pos, old_end);
+               *width = old_width;
+               /* Set pos to character AFTER end to allow easy iteration. */
+               al_ustr_next(ustr, &old_end);
+               *pos = old_end;
+               return result;
+            }
+         }
+
+         /* The whole ustr fits, or there is only trailing whitespace. */
+         if (end >= size)
+            break;
+         if (next >= size) {
+            line_width = advance;
+            if (last >= 0)
+               line_width += font->vtable->get_glyph_advance(font, last, ch);
+            line_width += font->vtable->get_glyph_advance(font, ch, -1);
+            break;
+         }
+
+         old_end = end;
+         old_width = line_width;
+      }
+
+      if (ch >= 0) {
+         if (last >= 0)
+            advance += font->vtable->get_glyph_advance(font, last, ch);
+         last = ch;
+      }
+      end = next;
+   }
+
+   /* If we get here the whole ustr will fit.*/
+   result = al_ref_ustr(info, ustr, *pos, size);
+   *width = line_width;
+   *pos = size;
+   return result;
+}
+
+
+/* Splits ustr from byte offset pos into lines, and calls cb with the start
+ * and end offsets and the width of every line.
+ */
+static void do_multiline_layout(const ALLEGRO_FONT *font, float max_width,
+   const ALLEGRO_USTR *ustr, int pos,
+   bool (*cb)(int line_num, const ALLEGRO_USTR *line, int start, int end,
+      int width, void *extra),
    void *extra)
 {
    const char *linebreak  = "\n";
    const ALLEGRO_USTR *hard_line, *soft_line;
    ALLEGRO_USTR_INFO hard_line_info, soft_line_info;
-   int hard_line_pos = 0, soft_line_pos = 0;
+   int hard_line_pos = pos, soft_line_pos = 0;
+   int hard_line_start;
    int line_num = 0;
+   int width = 0;
    bool proceed;
 
    /* For every "hard" line separated by a newline character... */
+   hard_line_start = hard_line_pos;
    hard_line = ustr_split_next(ustr, &hard_line_info, &hard_line_pos,
       linebreak);
    while (hard_line) {
       /* For every "soft" line in the "hard" line... */
       soft_line_pos = 0;
       soft_line =
-      get_next_soft_line(hard_line, &soft_line_info, &soft_line_pos, font,
-         max_width);
+      get_next_soft_line(hard_line, &soft_line_info, &soft_line_pos, &width,
+         font, max_width);
       /* No soft line here because it's an empty hard line. */
       if (!soft_line) {
          /* Call the callback with empty string to indicate an empty line. */
-         proceed = cb(line_num, al_ustr_empty_string(), extra);
+         proceed = cb(line_num, al_ustr_empty_string(), hard_line_start,
+            hard_line_start, 0, extra);
          if (!proceed) return;
          line_num ++;
       }
       while(soft_line) {
+         /* The soft line is a reference into ustr itself. */
+         int line_start = al_cstr(soft_line) - al_cstr(ustr);
          /* Call the callback on the next soft line. */
-         proceed = cb(line_num, soft_line, extra);
+         proceed = cb(line_num, soft_line, line_start,
+            line_start + al_ustr_size(soft_line), width, extra);
          if (!proceed) return;
          line_num++;
 
          soft_line = get_next_soft_line(hard_line, &soft_line_info,
-            &soft_line_pos, font, max_width);
+            &soft_line_pos, &width, font, max_width);
       }
+      hard_line_start = hard_line_pos;
       hard_line = ustr_split_next(ustr, &hard_line_info, &hard_line_pos,
          linebreak);
    }
 }
 
 
+/* Helper struct for al_do_multiline_ustr. */
+typedef struct DO_MULTILINE_USTR_EXTRA {
+   bool (*callback)(int line_num, const ALLEGRO_USTR *line, void *extra);
+   void *extra;
+} DO_MULTILINE_USTR_EXTRA;
+
+
+
+static bool do_multiline_ustr_cb(int line_num, const ALLEGRO_USTR *line,
+   int start, int end, int width, void *extra)
+{
+   DO_MULTILINE_USTR_EXTRA *s = extra;
+   (void)start;
+   (void)end;
+   (void)width;
+
+   return s->callback(line_num, line, s->extra);
+}
+
+
+
+/* Function: al_do_multiline_ustr
+ */
+void al_do_multiline_ustr(const ALLEGRO_FONT *font, float max_width,
+   const ALLEGRO_USTR *ustr,
+   bool (*cb)(int line_num, const ALLEGRO_USTR * line, void *extra),
+   void *extra)
+{
+   DO_MULTILINE_USTR_EXTRA extra2;
+   ASSERT(font);
+   ASSERT(ustr);
+
+   extra2.callback = cb;
+   extra2.extra = extra;
+   do_multiline_layout(font, max_width, ustr, 0, do_multiline_ustr_cb,
+      &extra2);
+}
+
+
 
 /* Helper struct for al_do_multiline_text. */
 typedef struct DO_MULTILINE_TEXT_EXTRA {
@@ -655,8 +850,227 @@ void al_draw_multiline_textf(const ALLEGRO_FONT *font,
 
 
 
+/* A line of an ALLEGRO_TEXT_LAYOUT, as byte offsets into its text. */
+typedef struct TEXT_LAYOUT_LINE {
+   int start;
+   int end;
+   int width;
+} TEXT_LAYOUT_LINE;
+
+struct ALLEGRO_TEXT_LAYOUT {
+   const ALLEGRO_FONT *font;
+   float max_width;
+   ALLEGRO_USTR *text;
+   _AL_VECTOR lines;
+};
+
+
+
+/* Function: al_create_text_layout
+ */
+ALLEGRO_TEXT_LAYOUT *al_create_text_layout(const ALLEGRO_FONT *font,
+   float max_width)
+{
+   ALLEGRO_TEXT_LAYOUT *layout;
+   ASSERT(font);
+
+   layout = al_calloc(1, sizeof *layout);
+   if (!layout)
+      return NULL;
+
+   layout->text = al_ustr_new("");
+   if (!layout->text) {
+      al_free(layout);
+      return NULL;
+   }
+
+   layout->font = font;
+   layout->max_width = max_width;
+   _al_vector_init(&layout->lines, sizeof(TEXT_LAYOUT_LINE));
+   return layout;
+}
+
+
+
+/* Function: al_destroy_text_layout
+ */
+void al_destroy_text_layout(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   if (!layout)
+      return;
 
+   _al_vector_free(&layout->lines);
+   al_ustr_free(layout->text);
+   al_free(layout);
+}
 
 
 
+static bool text_layout_cb(int line_num, const ALLEGRO_USTR *line,
+   int start, int end, int width, void *extra)
+{
+   ALLEGRO_TEXT_LAYOUT *layout = extra;
+   TEXT_LAYOUT_LINE *l;
+   (void)line_num;
+   (void)line;
+
+   l = _al_vector_alloc_back(&layout->lines);
+   if (!l)
+      return false;
+   l->start = start;
+   l->end = end;
+   l->width = width;
+   return true;
+}
+
+
+
+/* Function: al_append_text_layout_ustr
+ */
+void al_append_text_layout_ustr(ALLEGRO_TEXT_LAYOUT *layout,
+   const ALLEGRO_USTR *ustr)
+{
+   int pos = 0;
+   ASSERT(layout);
+   ASSERT(ustr);
+
+   /* A line only depends on where it starts and on the text after that,
+    * so all but the last line stay the same when text is appended. The
+    * last one may get longer, or be split up.
+    */
+   if (!_al_vector_is_empty(&layout->lines)) {
+      TEXT_LAYOUT_LINE *last = _al_vector_ref_back(&layout->lines);
+      pos = last->start;
+      _al_vector_delete_at(&layout->lines,
+         _al_vector_size(&layout->lines) - 1);
+   }
+
+   al_ustr_append(layout->text, ustr);
+   do_multiline_layout(layout->font, layout->max_width, layout->text, pos,
+      text_layout_cb, layout);
+}
+
+
+
+/* Function: al_append_text_layout_text
+ */
+void al_append_text_layout_text(ALLEGRO_TEXT_LAYOUT *layout,
+   const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(text);
+
+   al_append_text_layout_ustr(layout, al_ref_cstr(&info, text));
+}
+
+
+
+/* Function: al_clear_text_layout
+ */
+void al_clear_text_layout(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+
+   al_ustr_truncate(layout->text, 0);
+   _al_vector_free(&layout->lines);
+}
+
+
+
+/* Function: al_get_text_layout_line_count
+ */
+int al_get_text_layout_line_count(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+
+   return _al_vector_size(&layout->lines);
+}
+
+
+
+/* Function: al_get_text_layout_line
+ */
+const ALLEGRO_USTR *al_get_text_layout_line(
+   const ALLEGRO_TEXT_LAYOUT *layout, int line, ALLEGRO_USTR_INFO *info)
+{
+   const TEXT_LAYOUT_LINE *l;
+   ASSERT(layout);
+   ASSERT(info);
+   ASSERT(line >= 0 && line < (int)_al_vector_size(&layout->lines));
+
+   l = _al_vector_ref(&layout->lines, line);
+   return al_ref_ustr(info, layout->text, l->start, l->end);
+}
+
+
+
+/* Function: al_get_text_layout_line_width
+ */
+int al_get_text_layout_line_width(const ALLEGRO_TEXT_LAYOUT *layout,
+   int line)
+{
+   const TEXT_LAYOUT_LINE *l;
+   ASSERT(layout);
+   ASSERT(line >= 0 && line < (int)_al_vector_size(&layout->lines));
+
+   l = _al_vector_ref(&layout->lines, line);
+   return l->width;
+}
+
+
+
+/* Function: al_draw_text_layout
+ */
+void al_draw_text_layout(const ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y, float line_height, int flags,
+   int first_line, int num_lines)
+{
+   const ALLEGRO_FONT *font;
+   ALLEGRO_USTR_INFO info;
+   bool hold;
+   int count;
+   int i;
+   ASSERT(layout);
+
+   font = layout->font;
+   count = _al_vector_size(&layout->lines);
+   if (first_line < 0) {
+      num_lines += first_line;
+      first_line = 0;
+   }
+   if (num_lines > count - first_line)
+      num_lines = count - first_line;
+   if (num_lines <= 0)
+      return;
+
+   if (line_height < 1)
+      line_height = al_get_font_line_height(font);
+
+   hold = al_is_bitmap_drawing_held();
+   al_hold_bitmap_drawing(true);
+
+   for (i = 0; i < num_lines; i++) {
+      const TEXT_LAYOUT_LINE *l = _al_vector_ref(&layout->lines,
+         first_line + i);
+      float lx = x;
+      float ly = y + line_height * i;
+
+      /* The widths are known already, so this is al_draw_ustr without
+       * measuring the lines again.
+       */
+      if (flags & ALLEGRO_ALIGN_CENTRE)
+         lx -= l->width / 2;
+      else if (flags & ALLEGRO_ALIGN_RIGHT)
+         lx -= l->width;
+
+      if (flags & ALLEGRO_ALIGN_INTEGER)
+         align_to_integer_pixel(&lx, &ly);
+
+      font->vtable->render(font, color,
+         al_ref_ustr(&info, layout->text, l->start, l->end), lx, ly);
+   }
+
+   al_hold_bitmap_drawing(hold);
+}
+
 /* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,632 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      A5T (Allegro texture) reader and writer.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+/* The A5T format stores the pixels of a bitmap exactly as they are laid out
+ * in a locked region of the bitmap's own pixel format, so loading it is just
+ * a matter of reading the data into the locked memory.  All values are
+ * little endian.
+ *
+ *    offset  size  contents
+ *    0       4     magic "A5TX"
+ *    4       2     format version (1)
+ *    6       2     header size, data starts at this offset (64)
+ *    8       4     width in pixels
+ *    12      4     height in pixels
+ *    16      4     ALLEGRO_PIXEL_FORMAT of the data (never one of the ANY ones)
+ *    20      4     compression (0 = none, 1 = LZ4)
+ *    24      4     bytes per row of pixel blocks
+ *    28      4     rows of pixel blocks per compressed chunk
+ *    32      32    reserved, zero
+ *
+ * For compressed formats a "pixel" is a whole block, e.g. 4x4 pixels for DXT.
+ * Uncompressed data is just all the block rows without padding.  LZ4 data is
+ * a sequence of chunks, each holding up to the given number of block rows: a
+ * 32-bit size followed by that many bytes of an LZ4 block.  If the top bit of
+ * the size is set, the chunk was stored without compression.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_image.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_image.h"
+#include "allegro5/internal/aintern_pixels.h"
+
+#include <limits.h>
+
+#include "iio.h"
+
+ALLEGRO_DEBUG_CHANNEL("image")
+
+
+#define A5T_VERSION        1
+#define A5T_HEADER_SIZE    64
+#define A5T_NO_COMPRESSION 0
+#define A5T_LZ4            1
+#define A5T_CHUNK_STORED   0x80000000u
+
+/* Aim for chunks of about this many uncompressed bytes. */
+#define A5T_CHUNK_SIZE     (256 * 1024)
+
+#define LZ4_MIN_MATCH      4
+#define LZ4_HASH_BITS      14
+
+
+typedef struct A5T_HEADER {
+   int version;
+   int header_size;
+   int w, h;
+   int format;
+   int compression;
+   int row_size;
+   int chunk_rows;
+} A5T_HEADER;
+
+
+/* A minimal implementation of the LZ4 block format, enough to produce
+ * and consume the chunks of A5T files.  The output of lz4_compress can be
+ * decompressed by the reference implementation and vice versa.
+ */
+
+static uint32_t lz4_read32(const unsigned char *p)
+{
+   uint32_t v;
+   memcpy(&v, p, sizeof v);
+   return v;
+}
+
+
+static size_t lz4_bound(size_t size)
+{
+   return size + size / 255 + 16;
+}
+
+
+static unsigned char *lz4_write_length(unsigned char *op, size_t len)
+{
+   while (len >= 255) {
+      *op++ = 255;
+      len -= 255;
+   }
+   *op++ = len;
+   return op;
+}
+
+
+static unsigned char *lz4_write_sequence(unsigned char *op,
+   const unsigned char *literals, size_t num_literals,
+   size_t offset, size_t match_len)
+{
+   unsigned char *token = op++;
+
+   *token = (num_literals < 15 ? num_literals : 15) << 4;
+   if (num_literals >= 15)
+      op = lz4_write_length(op, num_literals - 15);
+   memcpy(op, literals, num_literals);
+   op += num_literals;
+
+   /* The last sequence consists of literals only. */
+   if (match_len == 0)
+      return op;
+
+   *op++ = offset & 0xff;
+   *op++ = offset >> 8;
+   match_len -= LZ4_MIN_MATCH;
+   *token |= (match_len < 15 ? match_len : 15);
+   if (match_len >= 15)
+      op = lz4_write_length(op, match_len - 15);
+   return op;
+}
+
+
+/* dst must have room for lz4_bound(size) bytes. */
+static size_t lz4_compress(const unsigned char *src, size_t size,
+   unsigned char *dst, uint32_t *table)
+{
+   const unsigned char *ip = src;
+   const unsigned char *anchor = src;
+   const unsigned char *end = src + size;
+   unsigned char *op = dst;
+
+   memset(table, 0, sizeof(uint32_t) << LZ4_HASH_BITS);
+
+   /* The format requires the last 5 bytes to be literals and the last match
+    * to start at least 12 bytes before the end of the block.
+    */
+   if (size > 12) {
+      const unsigned char *match_start_limit = end - 12;
+      const unsigned char *match_end_limit = end - 5;
+
+      while (ip < match_start_limit) {
+         uint32_t seq = lz4_read32(ip);
+         uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+         const unsigned char *ref = src + table[h];
+         table[h] = ip - src;
+
+         if (ref < ip && ip - ref <= 0xffff && lz4_read32(ref) == seq) {
+            size_t len = LZ4_MIN_MATCH;
+            while (ip + len < match_end_limit && ref[len] == ip[len])
+               len++;
+            op = lz4_write_sequence(op, anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+         }
+         else {
+            ip++;
+         }
+      }
+   }
+
+   op = lz4_write_sequence(op, anchor, end - anchor, 0, 0);
+   return op - dst;
+}
+
+
+static bool lz4_read_length(const unsigned char **ip,
+   const unsigned char *end, size_t *len)
+{
+   unsigned b;
+   do {
+      if (*ip >= end)
+         return false;
+      b = *(*ip)++;
+      *len += b;
+   } while (b == 255);
+   return true;
+}
+
+
+/* Returns false unless the input decompresses to exactly dst_size bytes. */
+static bool lz4_decompress(const unsigned char *src, size_t src_size,
+   unsigned char *dst, size_t dst_size)
+{
+   const unsigned char *ip = src;
+   const unsigned char *end = src + src_size;
+   unsigned char *op = dst;
+   unsigned char *op_end = dst + dst_size;
+
+   while (ip < end) {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+      size_t offset;
+      const unsigned char *match;
+
+      if (len == 15 && !lz4_read_length(&ip, end, &len))
+         return false;
+      if (len > (size_t)(end - ip) || len > (size_t)(op_end - op))
+         return false;
+      memcpy(op, ip, len);
+      op += len;
+      ip += len;
+
+      if (ip == end)
+         break;
+
+      if (end - ip < 2)
+         return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - dst))
+         return false;
+
+      len = token & 15;
+      if (len == 15 && !lz4_read_length(&ip, end, &len))
+         return false;
+      len += LZ4_MIN_MATCH;
+      if (len > (size_t)(op_end - op))
+         return false;
+
+      /* Matches may overlap the output, so copy byte by byte. */
+      match = op - offset;
+      while (len--)
+         *op++ = *match++;
+   }
+
+   return op == op_end;
+}
+
+
+/* Number of pixel blocks needed to cover the given number of pixels. */
+static int num_blocks(int pixels, int block)
+{
+   return (pixels + block - 1) / block;
+}
+
+
+static bool read_header(ALLEGRO_FILE *f, A5T_HEADER *header)
+{
+   char magic[4];
+   int64_t row_size;
+
+   if (al_fread(f, magic, 4) != 4 || memcmp(magic, "A5TX", 4) != 0) {
+      ALLEGRO_ERROR("Invalid A5T magic number.\n");
+      return false;
+   }
+
+   header->version = (uint16_t)al_fread16le(f);
+   header->header_size = (uint16_t)al_fread16le(f);
+   header->w = al_fread32le(f);
+   header->h = al_fread32le(f);
+   header->format = al_fread32le(f);
+   header->compression = al_fread32le(f);
+   header->row_size = al_fread32le(f);
+   header->chunk_rows = al_fread32le(f);
+
+   if (al_feof(f) || al_ferror(f)) {
+      ALLEGRO_ERROR("A5T header too short.\n");
+      return false;
+   }
+
+   if (header->version != A5T_VERSION) {
+      ALLEGRO_ERROR("Unsupported A5T version %d.\n", header->version);
+      return false;
+   }
+
+   if (header->w <= 0 || header->h <= 0 ||
+         !_al_pixel_format_is_real(header->format) ||
+         header->header_size < A5T_HEADER_SIZE) {
+      ALLEGRO_ERROR("Invalid A5T header.\n");
+      return false;
+   }
+
+   /* Computed wide, so huge widths can't wrap around to the stored value. */
+   row_size = (int64_t)num_blocks(header->w,
+      al_get_pixel_block_width(header->format)) *
+      al_get_pixel_block_size(header->format);
+   if (row_size > INT_MAX || header->row_size != row_size) {
+      ALLEGRO_ERROR("A5T row size does not match the pixel format.\n");
+      return false;
+   }
+
+   if (header->compression == A5T_LZ4 && (header->chunk_rows <= 0 ||
+         row_size * header->chunk_rows > INT_MAX)) {
+      ALLEGRO_ERROR("Invalid A5T chunk size.\n");
+      return false;
+   }
+   else if (header->compression != A5T_LZ4 &&
+         header->compression != A5T_NO_COMPRESSION) {
+      ALLEGRO_ERROR("Unknown A5T compression %d.\n", header->compression);
+      return false;
+   }
+
+   return al_fseek(f, header->header_size - 32, ALLEGRO_SEEK_CUR);
+}
+
+
+static bool read_raw_rows(ALLEGRO_FILE *f, ALLEGRO_LOCKED_REGION *lr,
+   int row_size, int rows)
+{
+   char *data = lr->data;
+   int y;
+
+   /* Usually the locked region has no padding and the whole bitmap can be
+    * read with a single call.
+    */
+   if (lr->pitch == row_size) {
+      size_t size = (size_t)row_size * rows;
+      return al_fread(f, data, size) == size;
+   }
+
+   for (y = 0; y < rows; y++) {
+      if (al_fread(f, data, row_size) != (size_t)row_size)
+         return false;
+      data += lr->pitch;
+   }
+   return true;
+}
+
+
+static bool read_lz4_rows(ALLEGRO_FILE *f, ALLEGRO_LOCKED_REGION *lr,
+   int row_size, int rows, int chunk_rows)
+{
+   size_t max_chunk = (size_t)row_size * chunk_rows;
+   unsigned char *in = al_malloc(lz4_bound(max_chunk));
+   unsigned char *out = NULL;
+   char *data = lr->data;
+   bool ret = false;
+   int y;
+
+   if (!in)
+      goto done;
+
+   /* Unless the locked region is unpadded, decompress into a temporary
+    * buffer and copy the rows from there.
+    */
+   if (lr->pitch != row_size) {
+      out = al_malloc(max_chunk);
+      if (!out)
+         goto done;
+   }
+
+   for (y = 0; y < rows; y += chunk_rows) {
+      int n = _ALLEGRO_MIN(chunk_rows, rows - y);
+      size_t size = (size_t)row_size * n;
+      uint32_t chunk_size = al_fread32le(f);
+      bool stored = chunk_size & A5T_CHUNK_STORED;
+      unsigned char *dst = out ? out : (unsigned char *)data;
+      int i;
+
+      chunk_size &= ~A5T_CHUNK_STORED;
+      if (al_feof(f) || chunk_size > lz4_bound(max_chunk)) {
+         ALLEGRO_ERROR("Invalid A5T chunk.\n");
+         goto done;
+      }
+
+      if (stored) {
+         if (chunk_size != size || al_fread(f, dst, size) != size)
+            goto done;
+      }
+      else {
+         if (al_fread(f, in, chunk_size) != chunk_size)
+            goto done;
+         if (!lz4_decompress(in, chunk_size, dst, size)) {
+            ALLEGRO_ERROR("Corrupt A5T chunk.\n");
+            goto done;
+         }
+      }
+
+      if (out) {
+         for (i = 0; i < n; i++) {
+            memcpy(data, out + (size_t)i * row_size, row_size);
+            data += lr->pitch;
+         }
+      }
+      else {
+         data += size;
+      }
+   }
+
+   ret = true;
+
+done:
+   al_free(in);
+   al_free(out);
+   return ret;
+}
+
+
+ALLEGRO_BITMAP *_al_load_a5t_f(ALLEGRO_FILE *f, int flags)
+{
+   ALLEGRO_BITMAP *bmp;
+   ALLEGRO_STATE state;
+   ALLEGRO_LOCKED_REGION *lr;
+   A5T_HEADER header;
+   bool compressed;
+   int rows;
+   bool ok;
+
+   /* ALLEGRO_NO_PREMULTIPLIED_ALPHA does not apply, the pixels are stored
+    * exactly as they were in the saved bitmap.
+    * ALLEGRO_KEEP_INDEX does not apply.
+    */
+   (void)flags;
+
+   if (!read_header(f, &header))
+      return NULL;
+
+   compressed = _al_pixel_format_is_compressed(header.format);
+   rows = num_blocks(header.h, al_get_pixel_block_height(header.format));
+
+   al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
+   /* Like DDS, compressed data can only go into a video bitmap. */
+   if (compressed)
+      al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+   al_set_new_bitmap_format(header.format);
+   bmp = al_create_bitmap(header.w, header.h);
+   al_restore_state(&state);
+   if (!bmp) {
+      ALLEGRO_ERROR("Couldn't create bitmap.\n");
+      return NULL;
+   }
+
+   if (compressed) {
+      if (al_get_bitmap_format(bmp) != header.format) {
+         ALLEGRO_ERROR("Created a bad bitmap.\n");
+         al_destroy_bitmap(bmp);
+         return NULL;
+      }
+      lr = al_lock_bitmap_blocked(bmp, ALLEGRO_LOCK_WRITEONLY);
+   }
+   else {
+      /* If the bitmap ended up in a different format, Allegro converts
+       * when unlocking.
+       */
+      lr = al_lock_bitmap(bmp, header.format, ALLEGRO_LOCK_WRITEONLY);
+   }
+
+   if (!lr) {
+      ALLEGRO_ERROR("Could not lock the bitmap.\n");
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   if (header.compression == A5T_LZ4)
+      ok = read_lz4_rows(f, lr, header.row_size, rows, header.chunk_rows);
+   else
+      ok = read_raw_rows(f, lr, header.row_size, rows);
+
+   al_unlock_bitmap(bmp);
+
+   if (!ok) {
+      ALLEGRO_ERROR("A5T file too short or corrupt.\n");
+      al_destroy_bitmap(bmp);
+      return NULL;
+   }
+
+   return bmp;
+}
+
+
+ALLEGRO_BITMAP *_al_load_a5t(const char *filename, int flags)
+{
+   ALLEGRO_FILE *f;
+   ALLEGRO_BITMAP *bmp;
+   ASSERT(filename);
+
+   f = al_fopen(filename, "rb");
+   if (!f)
+      return NULL;
+
+   bmp = _al_load_a5t_f(f, flags);
+
+   al_fclose(f);
+
+   return bmp;
+}
+
+
+static int get_config_compression(void)
+{
+   ALLEGRO_CONFIG *config = al_get_system_config();
+   const char *value;
+
+   if (!config)
+      return A5T_NO_COMPRESSION;
+
+   value = al_get_config_value(config, "image", "a5t_compression");
+   if (value && 0 == _al_stricmp(value, "lz4"))
+      return A5T_LZ4;
+
+   return A5T_NO_COMPRESSION;
+}
+
+
+static bool write_lz4_rows(ALLEGRO_FILE *f, ALLEGRO_LOCKED_REGION *lr,
+   int row_size, int rows, int chunk_rows)
+{
+   size_t max_chunk = (size_t)row_size * chunk_rows;
+   unsigned char *in = al_malloc(max_chunk);
+   unsigned char *out = al_malloc(lz4_bound(max_chunk));
+   uint32_t *table = al_malloc(sizeof(uint32_t) << LZ4_HASH_BITS);
+   const char *data = lr->data;
+   bool ret = false;
+   int y, i;
+
+   if (!in || !out || !table)
+      goto done;
+
+   for (y = 0; y < rows; y += chunk_rows) {
+      int n = _ALLEGRO_MIN(chunk_rows, rows - y);
+      size_t size = (size_t)row_size * n;
+      size_t compressed_size;
+
+      for (i = 0; i < n; i++) {
+         memcpy(in + (size_t)i * row_size, data, row_size);
+         data += lr->pitch;
+      }
+
+      compressed_size = lz4_compress(in, size, out, table);
+      if (compressed_size < size) {
+         al_fwrite32le(f, compressed_size);
+         al_fwrite(f, out, compressed_size);
+      }
+      else {
+         al_fwrite32le(f, size | A5T_CHUNK_STORED);
+         al_fwrite(f, in, size);
+      }
+   }
+
+   ret = !al_ferror(f);
+
+done:
+   al_free(in);
+   al_free(out);
+   al_free(table);
+   return ret;
+}
+
+
+bool _al_save_a5t_f(ALLEGRO_FILE *f, ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_LOCKED_REGION *lr;
+   int format = al_get_bitmap_format(bmp);
+   int compression = get_config_compression();
+   int block_width, block_height, block_size;
+   int row_size, rows, chunk_rows;
+   const char *data;
+   bool ok;
+   int y;
+
+   if (_al_pixel_format_is_compressed(format)) {
+      lr = al_lock_bitmap_blocked(bmp, ALLEGRO_LOCK_READONLY);
+   }
+   else {
+      lr = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY);
+   }
+
+   if (!lr) {
+      ALLEGRO_ERROR("Could not lock the bitmap.\n");
+      return false;
+   }
+
+   format = lr->format;
+   block_width = al_get_pixel_block_width(format);
+   block_height = al_get_pixel_block_height(format);
+   block_size = al_get_pixel_block_size(format);
+   row_size = num_blocks(al_get_bitmap_width(bmp), block_width) * block_size;
+   rows = num_blocks(al_get_bitmap_height(bmp), block_height);
+   chunk_rows = _ALLEGRO_MAX(1, A5T_CHUNK_SIZE / row_size);
+
+   al_fwrite(f, "A5TX", 4);
+   al_fwrite16le(f, A5T_VERSION);
+   al_fwrite16le(f, A5T_HEADER_SIZE);
+   al_fwrite32le(f, al_get_bitmap_width(bmp));
+   al_fwrite32le(f, al_get_bitmap_height(bmp));
+   al_fwrite32le(f, format);
+   al_fwrite32le(f, compression);
+   al_fwrite32le(f, row_size);
+   al_fwrite32le(f, compression == A5T_LZ4 ? chunk_rows : 0);
+   for (y = 32; y < A5T_HEADER_SIZE; y += 4)
+      al_fwrite32le(f, 0);
+
+   if (compression == A5T_LZ4) {
+      ok = write_lz4_rows(f, lr, row_size, rows, chunk_rows);
+   }
+   else {
+      data = lr->data;
+      for (y = 0; y < rows; y++) {
+         al_fwrite(f, data, row_size);
+         data += lr->pitch;
+      }
+      ok = !al_ferror(f);
+   }
+
+   al_unlock_bitmap(bmp);
+
+   return ok;
+}
+
+
+bool _al_save_a5t(const char *filename, ALLEGRO_BITMAP *bmp)
+{
+   ALLEGRO_FILE *f;
+   bool retsave;
+   bool retclose;
+   ASSERT(filename);
+   ASSERT(bmp);
+
+   f = al_fopen(filename, "wb");
+   if (!f) {
+      ALLEGRO_ERROR("Unable to open file %s for writing\n", filename);
+      return false;
+   }
+
+   retsave = _al_save_a5t_f(f, bmp);
+
+   retclose = al_fclose(f);
+
+   return retsave && retclose;
+}
+
+/* vim: set sts=3 sw=3 et: */
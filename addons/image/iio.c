@@ -38,6 +38,11 @@ bool al_init_image_addon(void)
    success |= al_register_bitmap_loader(".dds", _al_load_dds);
    success |= al_register_bitmap_loader_f(".dds", _al_load_dds_f);
 
+   success |= al_register_bitmap_loader(".a5t", _al_load_a5t);
+   success |= al_register_bitmap_saver(".a5t", _al_save_a5t);
+   success |= al_register_bitmap_loader_f(".a5t", _al_load_a5t_f);
+   success |= al_register_bitmap_saver_f(".a5t", _al_save_a5t_f);
+
 /* ALLEGRO_CFG_IIO_HAVE_* is sufficient to know that the library
    should be used. i.e., ALLEGRO_CFG_IIO_HAVE_GDIPLUS and
    ALLEGRO_CFG_IIO_HAVE_PNG will never both be set. */
@@ -158,18 +158,87 @@ struct load_jpg_entry_helper_data {
    unsigned char *row;
 };
 
+static int get_scale_denom(int flags)
+{
+   if (flags & ALLEGRO_LOAD_SCALE_1_8)
+      return 8;
+   if (flags & ALLEGRO_LOAD_SCALE_1_4)
+      return 4;
+   if (flags & ALLEGRO_LOAD_SCALE_1_2)
+      return 2;
+   return 1;
+}
+
+#ifdef JCS_EXTENSIONS
+/* libjpeg-turbo can write pixels in a number of byte orders itself, so if
+ * the bitmap uses one of them we decode straight into the locked memory
+ * without converting anything afterwards.  The extended colour spaces are
+ * specified in memory byte order, Allegro's 32-bit formats are not (except
+ * ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE).
+ */
+static bool get_direct_color_space(int format, J_COLOR_SPACE *space)
+{
+   switch (format) {
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE:
+         *space = JCS_EXT_RGBA;
+         return true;
+#ifdef ALLEGRO_BIG_ENDIAN
+      case ALLEGRO_PIXEL_FORMAT_ARGB_8888:
+         *space = JCS_EXT_ARGB;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888:
+         *space = JCS_EXT_ABGR;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_RGBA_8888:
+         *space = JCS_EXT_RGBA;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_XRGB_8888:
+         *space = JCS_EXT_XRGB;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_XBGR_8888:
+         *space = JCS_EXT_XBGR;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_RGBX_8888:
+         *space = JCS_EXT_RGBX;
+         return true;
+#else
+      case ALLEGRO_PIXEL_FORMAT_ARGB_8888:
+         *space = JCS_EXT_BGRA;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_ABGR_8888:
+         *space = JCS_EXT_RGBA;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_RGBA_8888:
+         *space = JCS_EXT_ABGR;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_XRGB_8888:
+         *space = JCS_EXT_BGRX;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_XBGR_8888:
+         *space = JCS_EXT_RGBX;
+         return true;
+      case ALLEGRO_PIXEL_FORMAT_RGBX_8888:
+         *space = JCS_EXT_XBGR;
+         return true;
+#endif
+      default:
+         return false;
+   }
+}
+#endif
+
 static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
    struct load_jpg_entry_helper_data *data, int flags)
 {
    struct jpeg_decompress_struct cinfo;
    struct my_err_mgr jerr;
    ALLEGRO_LOCKED_REGION *lock;
+   int lock_format;
    int w, h, s;
 
    /* ALLEGRO_NO_PREMULTIPLIED_ALPHA does not apply.
     * ALLEGRO_KEEP_INDEX does not apply.
     */
-   (void)flags;
 
    data->error = false;
 
@@ -190,24 +259,40 @@ static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
    jpeg_create_decompress(&cinfo);
    jpeg_packfile_src(&cinfo, fp, data->buffer);
    jpeg_read_header(&cinfo, true);
-   jpeg_start_decompress(&cinfo);
+
+   /* libjpeg can skip most of the IDCT work when asked for a reduced size
+    * image, which is a lot cheaper than scaling the full image down later.
+    */
+   cinfo.scale_num = 1;
+   cinfo.scale_denom = get_scale_denom(flags);
+   if (flags & ALLEGRO_LOAD_FAST_DECODE) {
+      cinfo.dct_method = JDCT_IFAST;
+      cinfo.do_fancy_upsampling = false;
+   }
+
+   /* We need the output size to create the bitmap, and the bitmap format to
+    * pick the output colour space, all before starting decompression.
+    */
+   jpeg_calc_output_dimensions(&cinfo);
 
    w = cinfo.output_width;
    h = cinfo.output_height;
    s = cinfo.output_components;
 
-   /* Only one and three components make sense in a JPG file. */
+   /* Only one and three components make sense in a JPG file.
+    * Decompression has not been started, so skip jpeg_finish_decompress.
+    */
    if (s != 1 && s != 3) {
       data->error = true;
       ALLEGRO_ERROR("%d components makes no sense\n", s);
-      goto error;
+      goto longjmp_error;
    }
 
    data->bmp = al_create_bitmap(w, h);
    if (!data->bmp) {
       data->error = true;
       ALLEGRO_ERROR("%dx%d bitmap creation failed\n", w, h);
-      goto error;
+      goto longjmp_error;
    }
 
    /* Allegro's pixel format is endian independent, so that in
@@ -220,15 +305,30 @@ static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
     * endian systems we need the opposite format, ALLEGRO_PIXEL_FORMAT_BGR_888.
     */
 #ifdef ALLEGRO_BIG_ENDIAN
-   lock = al_lock_bitmap(data->bmp, ALLEGRO_PIXEL_FORMAT_RGB_888,
-       ALLEGRO_LOCK_WRITEONLY);
+   lock_format = ALLEGRO_PIXEL_FORMAT_RGB_888;
 #else
-   lock = al_lock_bitmap(data->bmp, ALLEGRO_PIXEL_FORMAT_BGR_888,
-       ALLEGRO_LOCK_WRITEONLY);
+   lock_format = ALLEGRO_PIXEL_FORMAT_BGR_888;
+#endif
+
+#ifdef JCS_EXTENSIONS
+   {
+      J_COLOR_SPACE space;
+      int format = al_get_bitmap_format(data->bmp);
+
+      if (get_direct_color_space(format, &space)) {
+         /* This also expands greyscale images. */
+         cinfo.out_color_space = space;
+         lock_format = format;
+      }
+   }
 #endif
 
-   if (s == 3) {
-      /* Colour. */
+   jpeg_start_decompress(&cinfo);
+
+   lock = al_lock_bitmap(data->bmp, lock_format, ALLEGRO_LOCK_WRITEONLY);
+
+   if (cinfo.output_components != 1) {
+      /* Colour, or greyscale already expanded by libjpeg. */
       int y;
 
       for (y = cinfo.output_scanline; y < h; y = cinfo.output_scanline) {
@@ -237,7 +337,7 @@ static void load_jpg_entry_helper(ALLEGRO_FILE *fp,
          jpeg_read_scanlines(&cinfo, (void *)out, 1);
       }
    }
-   else if (s == 1) {
+   else {
       /* Greyscale. */
       unsigned char *in;
       unsigned char *out;
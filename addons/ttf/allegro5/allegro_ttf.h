@@ -11,6 +11,8 @@
 #define ALLEGRO_TTF_NO_KERNING  1
 #define ALLEGRO_TTF_MONOCHROME  2
 #define ALLEGRO_TTF_NO_AUTOHINT 4
+#define ALLEGRO_TTF_SDF         8
+#define ALLEGRO_TTF_SUBPIXEL    16
 
 #if (defined ALLEGRO_MINGW32) || (defined ALLEGRO_MSVC) || (defined ALLEGRO_BCC32)
    #ifndef ALLEGRO_STATICLINK
@@ -41,6 +43,9 @@ ALLEGRO_TTF_FUNC(ALLEGRO_FONT *, al_load_ttf_font_stretch_f, (ALLEGRO_FILE *file
 ALLEGRO_TTF_FUNC(bool, al_init_ttf_addon, (void));
 ALLEGRO_TTF_FUNC(void, al_shutdown_ttf_addon, (void));
 ALLEGRO_TTF_FUNC(uint32_t, al_get_allegro_ttf_version, (void));
+ALLEGRO_TTF_FUNC(char const *, al_get_ttf_sdf_shader_source, (ALLEGRO_SHADER_PLATFORM platform));
+ALLEGRO_TTF_FUNC(bool, al_get_ttf_layout_cache_stats, (ALLEGRO_FONT const *font, int *hits, int *misses));
+ALLEGRO_TTF_FUNC(bool, al_get_ttf_atlas_usage, (ALLEGRO_FONT const *font, int *pages, int *glyphs, int *used_pixels, int *total_pixels));
 
 #ifdef __cplusplus
    }
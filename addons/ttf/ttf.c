@@ -3,6 +3,7 @@
 #include "allegro5/allegro_opengl.h"
 #endif
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_bitmap.h"
 #include "allegro5/internal/aintern_vector.h"
 
 #include "allegro5/allegro_ttf.h"
@@ -12,7 +13,10 @@
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_SIZES_H
 
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 
 ALLEGRO_DEBUG_CHANNEL("font")
@@ -33,6 +37,12 @@ ALLEGRO_DEBUG_CHANNEL("font")
 
 #define RANGE_SIZE   128
 
+/* With ALLEGRO_TTF_SDF, glyphs are rendered SDF_SCALE times larger and the
+ * distance field reaches SDF_SPREAD pixels out from the outline.
+ */
+#define SDF_SCALE    4
+#define SDF_SPREAD   4
+
 
 typedef struct REGION
 {
@@ -46,10 +56,13 @@ typedef struct REGION
 typedef struct ALLEGRO_TTF_GLYPH_DATA
 {
    ALLEGRO_BITMAP *page_bitmap;
+   int page;                        /* index into pages */
    REGION region;
    short offset_x;
    short offset_y;
-   short advance;
+   int advance;                     /* in 1/64 pixels */
+   unsigned char variant;           /* subpixel offset, see position_glyph */
+   bool requested;                  /* queued for the cache thread */
 } ALLEGRO_TTF_GLYPH_DATA;
 
 
@@ -60,29 +73,161 @@ typedef struct ALLEGRO_TTF_GLYPH_RANGE
 } ALLEGRO_TTF_GLYPH_RANGE;
 
 
-typedef struct ALLEGRO_TTF_FONT_DATA
+/* An entry of the character table, see init_char_table. */
+typedef struct TTF_CHAR
+{
+   int ft_index;
+   int advance;                     /* in 1/64 pixels */
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+} TTF_CHAR;
+
+
+/* A glyph rendered by the cache thread, waiting to be copied to a page. */
+typedef struct TTF_PRERENDERED_GLYPH
+{
+   int ft_index;
+   bool ok;
+   short offset_x;
+   short offset_y;
+   int advance;
+   short w;
+   short h;
+   unsigned char *pixels;  /* w * h * 4 bytes, NULL if the glyph is empty */
+} TTF_PRERENDERED_GLYPH;
+
+
+/* Lets FreeType read a face through an ALLEGRO_FILE. */
+typedef struct TTF_STREAM
+{
+   FT_StreamRec stream;
+   ALLEGRO_FILE *file;
+   unsigned long base_offset;
+   unsigned long offset;
+} TTF_STREAM;
+
+
+/* An opened font file.  Fonts loaded from the same file name share one,
+ * each with an FT_Size of its own, so the file is only opened and parsed
+ * once.  The file name is compared as given, so different paths to the
+ * same file open it again.
+ */
+typedef struct TTF_FACE
 {
    FT_Face face;
+   TTF_STREAM stream;
+   ALLEGRO_USTR *filename;   /* NULL if the face is not shared */
+   const ALLEGRO_FILE_INTERFACE *file_interface;
+   ALLEGRO_MUTEX *mutex;     /* held while a font uses the face */
+   int refcount;             /* protected by faces_mutex */
+   struct TTF_FACE *next;
+} TTF_FACE;
+
+
+/* Glyphs are packed into shelves: horizontal strips of a page, filled from
+ * left to right.  Only the bottom-most shelf of a page may still grow
+ * taller.
+ */
+typedef struct TTF_SHELF
+{
+   short x;                /* first free column */
+   short y;
+   short h;
+} TTF_SHELF;
+
+
+typedef struct TTF_PAGE
+{
+   ALLEGRO_BITMAP *bitmap;
+   _AL_VECTOR shelves;     /* of TTF_SHELF, top to bottom */
+   unsigned last_used;
+   float *quads;           /* glyphs waiting to be drawn, 6 floats each */
+   int num_quads;
+   int max_quads;
+} TTF_PAGE;
+
+
+/* A string laid out with a font.  Strings which are drawn or measured
+ * over and over are remembered in a small per-font cache, so doing it again
+ * only needs the glyph positions and no calls into FreeType.
+ */
+typedef struct TTF_LAYOUT_GLYPH
+{
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+   int ft_index;
+   int x;            /* pen position in 1/64 pixels, including kerning */
+} TTF_LAYOUT_GLYPH;
+
+
+typedef struct TTF_LAYOUT
+{
+   struct TTF_LAYOUT *hash_next;
+   struct TTF_LAYOUT *lru_prev;
+   struct TTF_LAYOUT *lru_next;
+   uint32_t hash;
+   ALLEGRO_USTR *text;
+   int num_glyphs;
+   TTF_LAYOUT_GLYPH *glyphs;
+   int advance;      /* in 1/64 pixels */
+   int bbx;          /* as returned by ttf_get_text_dimensions */
+   int bbw;
+} TTF_LAYOUT;
+
+
+typedef struct ALLEGRO_TTF_FONT_DATA
+{
+   TTF_FACE *shared_face;
+   FT_Size size;
    int flags;
    _AL_VECTOR glyph_ranges;  /* sorted array of of ALLEGRO_TTF_GLYPH_RANGE */
 
-   _AL_VECTOR page_bitmaps;  /* of ALLEGRO_BITMAP pointers */
-   int page_pos_x;
-   int page_pos_y;
-   int page_line_height;
+   _AL_VECTOR pages;  /* of TTF_PAGE */
+   int lock_page;            /* page of page_lr */
    REGION lock_rect;
    ALLEGRO_LOCKED_REGION *page_lr;
+   unsigned use_clock;
+   size_t page_memory;
+   ALLEGRO_COLOR batch_color;   /* of the quads waiting to be drawn */
 
-   FT_StreamRec stream;
-   ALLEGRO_FILE *file;
-   unsigned long base_offset;
-   unsigned long offset;
+   /* To open the face again on the cache thread. */
+   int size_w;
+   int size_h;
+
+   ALLEGRO_THREAD *cache_thread;
+   ALLEGRO_MUTEX *cache_mutex;
+   ALLEGRO_COND *cache_cond;
+   _AL_VECTOR cache_requests;   /* of ft_index */
+   unsigned cache_next;         /* first request not yet taken */
+   _AL_VECTOR cache_results;    /* of TTF_PRERENDERED_GLYPH */
 
    int bitmap_format;
    int bitmap_flags;
+   int glyph_padding;        /* around the outline of each glyph */
+
+   /* Code points below char_table_size are looked up in these tables
+    * instead of asking FreeType.
+    */
+   int char_table_size;
+   TTF_CHAR *char_table;
+   short *kerning_table;     /* [prev * char_table_size + ch], or NULL */
+
+   /* Each glyph is rendered at this many horizontal offsets within a
+    * pixel, 1 without ALLEGRO_TTF_SUBPIXEL.
+    */
+   int subpixel_positions;
 
    int min_page_size;
    int max_page_size;
+   int max_pages;            /* 0 if unlimited */
+   size_t max_page_memory;   /* 0 if unlimited */
+
+   TTF_LAYOUT **layout_buckets;
+   int layout_num_buckets;    /* power of two */
+   int layout_capacity;       /* 0 if the cache is disabled */
+   int layout_count;
+   TTF_LAYOUT *layout_lru_head;
+   TTF_LAYOUT *layout_lru_tail;
+   int layout_hits;
+   int layout_misses;
 } ALLEGRO_TTF_FONT_DATA;
 
 
@@ -90,6 +235,11 @@ typedef struct ALLEGRO_TTF_FONT_DATA
 static bool ttf_inited;
 static FT_Library ft;
 static ALLEGRO_FONT_VTABLE vt;
+static TTF_FACE *shared_faces;
+/* Protects shared_faces and the reference counts, and serialises opening
+ * and closing faces in the FreeType library.
+ */
+static ALLEGRO_MUTEX *faces_mutex;
 
 
 static INLINE int align4(int x)
@@ -102,6 +252,34 @@ static INLINE int align4(int x)
 }
 
 
+/* Returns the face of the font, with the size of the font selected.  The
+ * caller must hold the lock of the face.
+ */
+static FT_Face get_face(ALLEGRO_TTF_FONT_DATA const *data)
+{
+   FT_Face face = data->shared_face->face;
+   if (face->size != data->size)
+      FT_Activate_Size(data->size);
+   return face;
+}
+
+
+/* Fonts of the same file may be used by different threads, so every font
+ * method which calls FreeType locks the face first.
+ */
+static FT_Face lock_face(ALLEGRO_TTF_FONT_DATA const *data)
+{
+   al_lock_mutex(data->shared_face->mutex);
+   return get_face(data);
+}
+
+
+static void unlock_face(ALLEGRO_TTF_FONT_DATA const *data)
+{
+   al_unlock_mutex(data->shared_face->mutex);
+}
+
+
 static ALLEGRO_TTF_GLYPH_DATA *get_glyph(ALLEGRO_TTF_FONT_DATA *data,
    int ft_index)
 {
@@ -142,22 +320,25 @@ static ALLEGRO_TTF_GLYPH_DATA *get_glyph(ALLEGRO_TTF_FONT_DATA *data,
 }
 
 
+static TTF_PAGE *get_page(ALLEGRO_TTF_FONT_DATA *data, int i)
+{
+   return _al_vector_ref(&data->pages, i);
+}
+
+
 static void unlock_current_page(ALLEGRO_TTF_FONT_DATA *data)
 {
    if (data->page_lr) {
-      ALLEGRO_BITMAP **back = _al_vector_ref_back(&data->page_bitmaps);
-      ASSERT(al_is_bitmap_locked(*back));
-      al_unlock_bitmap(*back);
+      TTF_PAGE *page = get_page(data, data->lock_page);
+      ASSERT(al_is_bitmap_locked(page->bitmap));
+      al_unlock_bitmap(page->bitmap);
       data->page_lr = NULL;
    }
 }
 
 
-static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
+static int get_page_size(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
 {
-    ALLEGRO_BITMAP **back;
-    ALLEGRO_BITMAP *page;
-    ALLEGRO_STATE state;
     int page_size = 1;
     /* 16 seems to work well. A particular problem are fixed width fonts which
      * take an inordinate amount of space. */
@@ -170,11 +351,15 @@ static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size
     if (page_size > data->max_page_size) {
       page_size = data->max_page_size;
     }
-    if (glyph_size > page_size) {
-      return NULL;
-    }
+    return page_size;
+}
+
 
-    unlock_current_page(data);
+static int push_new_page(ALLEGRO_TTF_FONT_DATA *data, int page_size)
+{
+    TTF_PAGE *page;
+    ALLEGRO_BITMAP *bitmap;
+    ALLEGRO_STATE state;
 
     /* The bitmap will be destroyed when the parent font is destroyed so
      * it is not safe to register a destructor for it.
@@ -183,92 +368,263 @@ static ALLEGRO_BITMAP *push_new_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size
     al_store_state(&state, ALLEGRO_STATE_NEW_BITMAP_PARAMETERS);
     al_set_new_bitmap_format(data->bitmap_format);
     al_set_new_bitmap_flags(data->bitmap_flags);
-    page = al_create_bitmap(page_size, page_size);
+    bitmap = al_create_bitmap(page_size, page_size);
     al_restore_state(&state);
     _al_pop_destructor_owner();
 
-    if (page) {
-       back = _al_vector_alloc_back(&data->page_bitmaps);
-       *back = page;
+    if (!bitmap)
+       return -1;
 
-       data->page_pos_x = 0;
-       data->page_pos_y = 0;
-       data->page_line_height = 0;
-    }
+    page = _al_vector_alloc_back(&data->pages);
+    page->bitmap = bitmap;
+    _al_vector_init(&page->shelves, sizeof(TTF_SHELF));
+    page->last_used = data->use_clock;
+    page->quads = NULL;
+    page->num_quads = 0;
+    page->max_quads = 0;
+    data->page_memory += (size_t)page_size * page_size * 4;
+
+    return _al_vector_size(&data->pages) - 1;
+}
+
+
+/* Draws the glyphs collected by ttf_render, one call per page. */
+static void flush_glyph_quads(ALLEGRO_TTF_FONT_DATA *data)
+{
+   int i;
+
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      TTF_PAGE *page = get_page(data, i);
+      if (page->num_quads > 0) {
+         _al_draw_tinted_bitmap_regions(page->bitmap, data->batch_color,
+            page->quads, page->num_quads);
+         page->num_quads = 0;
+      }
+   }
+}
+
+
+/* Clears the least recently used page which can hold the glyph, so it can
+ * be filled again.  Glyphs which were on it are rendered again by FreeType
+ * the next time they are needed.
+ */
+static int evict_page(ALLEGRO_TTF_FONT_DATA *data, int glyph_size)
+{
+   TTF_PAGE *page = NULL;
+   int lru = -1;
+   int i, j;
+
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      TTF_PAGE *p = get_page(data, i);
+      if (al_get_bitmap_width(p->bitmap) < glyph_size)
+         continue;
+      if (!page || p->last_used - page->last_used > UINT_MAX / 2) {
+         page = p;
+         lru = i;
+      }
+   }
+
+   if (!page)
+      return -1;
+
+   ALLEGRO_DEBUG("Evicting glyph page %d.\n", lru);
+
+   /* Glyphs from this page may still be waiting to be drawn. */
+   flush_glyph_quads(data);
+   if (al_is_bitmap_drawing_held()) {
+      al_hold_bitmap_drawing(false);
+      al_hold_bitmap_drawing(true);
+   }
+
+   if (data->page_lr && data->lock_page == lru)
+      unlock_current_page(data);
+
+   for (i = 0; i < (int)_al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (glyph->page_bitmap == page->bitmap) {
+            glyph->page_bitmap = NULL;
+            glyph->region.x = 0;
+            glyph->region.y = 0;
+         }
+      }
+   }
+
+   _al_vector_free(&page->shelves);
+   return lru;
+}
+
+
+/* Finds a place for a w4 x h4 area, preferring to continue in the shelf
+ * which is locked, then the shelf which fits the height best.  Returns
+ * false if a new page is needed.
+ */
+static bool find_shelf(ALLEGRO_TTF_FONT_DATA *data, int w4, int h4,
+   int *page_out, int *shelf_out)
+{
+   int best_waste = INT_MAX;
+   int i, j;
+
+   *page_out = -1;
+
+   if (data->page_lr) {
+      TTF_PAGE *page = get_page(data, data->lock_page);
+      for (j = 0; j < (int)_al_vector_size(&page->shelves); j++) {
+         TTF_SHELF *shelf = _al_vector_ref(&page->shelves, j);
+         if (shelf->y == data->lock_rect.y && shelf->h >= h4 &&
+               shelf->x + w4 <= al_get_bitmap_width(page->bitmap)) {
+            *page_out = data->lock_page;
+            *shelf_out = j;
+            return true;
+         }
+      }
+   }
 
-    return page;
+   for (i = 0; i < (int)_al_vector_size(&data->pages); i++) {
+      TTF_PAGE *page = get_page(data, i);
+      int page_w = al_get_bitmap_width(page->bitmap);
+      int page_h = al_get_bitmap_height(page->bitmap);
+      int n = _al_vector_size(&page->shelves);
+      int waste;
+
+      for (j = 0; j < n; j++) {
+         TTF_SHELF *shelf = _al_vector_ref(&page->shelves, j);
+         if (shelf->x + w4 > page_w)
+            continue;
+         if (shelf->h >= h4)
+            waste = shelf->h - h4;
+         else if (j == n - 1 && shelf->y + h4 <= page_h)
+            waste = h4 - shelf->h;
+         else
+            continue;
+         if (waste < best_waste) {
+            best_waste = waste;
+            *page_out = i;
+            *shelf_out = j;
+         }
+      }
+
+      /* Starting a new shelf wastes nothing yet, but uses up rows. */
+      if (*page_out == -1 || best_waste > h4) {
+         int y = 0;
+         if (n > 0) {
+            TTF_SHELF *last = _al_vector_ref(&page->shelves, n - 1);
+            y = align4(last->y + last->h);
+         }
+         if (w4 <= page_w && y + h4 <= page_h) {
+            best_waste = h4;
+            *page_out = i;
+            *shelf_out = n;
+         }
+      }
+   }
+
+   return *page_out != -1;
 }
 
 
 static unsigned char *alloc_glyph_region(ALLEGRO_TTF_FONT_DATA *data,
-   int ft_index, int w, int h, bool new, ALLEGRO_TTF_GLYPH_DATA *glyph,
+   int ft_index, int w, int h, ALLEGRO_TTF_GLYPH_DATA *glyph,
    bool lock_more)
 {
-   ALLEGRO_BITMAP *page;
-   bool relock;
+   TTF_PAGE *page;
+   TTF_SHELF *shelf;
+   int page_i, shelf_i;
    int w4 = align4(w);
    int h4 = align4(h);
    int glyph_size = w4 > h4 ? w4 : h4;
 
-   if (_al_vector_is_empty(&data->page_bitmaps) || new) {
-      page = push_new_page(data, glyph_size);
-      relock = true;
-      if (!page)
+   if (!find_shelf(data, w4, h4, &page_i, &shelf_i)) {
+      int page_size = get_page_size(data, glyph_size);
+      int num_pages = _al_vector_size(&data->pages);
+      size_t page_memory = (size_t)page_size * page_size * 4;
+      bool over_budget;
+
+      if (glyph_size > page_size) {
          return NULL;
-   }
-   else {
-      ALLEGRO_BITMAP **back = _al_vector_ref_back(&data->page_bitmaps);
-      page = *back;
-      relock = !data->page_lr;
-   }
+      }
 
-   ALLEGRO_DEBUG("Glyph %d: %dx%d (%dx%d)%s\n",
-      ft_index, w, h, w4, h4, new ? " new" : "");
+      over_budget = num_pages > 0 &&
+         ((data->max_pages > 0 && num_pages >= data->max_pages) ||
+         (data->max_page_memory > 0 &&
+            data->page_memory + page_memory > data->max_page_memory));
 
-   if (data->page_pos_x + w4 > al_get_bitmap_width(page)) {
-      data->page_pos_y += data->page_line_height;
-      data->page_pos_y = align4(data->page_pos_y);
-      data->page_pos_x = 0;
-      data->page_line_height = 0;
-      relock = true;
+      page_i = over_budget ? evict_page(data, glyph_size) : -1;
+      if (page_i < 0) {
+         if (over_budget) {
+            ALLEGRO_WARN("No glyph page to reuse, exceeding the budget.\n");
+         }
+         unlock_current_page(data);
+         page_i = push_new_page(data, page_size);
+         if (page_i < 0)
+            return NULL;
+      }
+      shelf_i = 0;
    }
 
-   if (data->page_pos_y + h4 > al_get_bitmap_height(page)) {
-      return alloc_glyph_region(data, ft_index, w, h, true, glyph, lock_more);
+   page = get_page(data, page_i);
+   if (shelf_i == (int)_al_vector_size(&page->shelves)) {
+      int y = 0;
+      /* Growing the vector may move the shelves, so read the last one
+       * first.
+       */
+      if (shelf_i > 0) {
+         TTF_SHELF *last = _al_vector_ref(&page->shelves, shelf_i - 1);
+         y = align4(last->y + last->h);
+      }
+      shelf = _al_vector_alloc_back(&page->shelves);
+      shelf->x = 0;
+      shelf->y = y;
+      shelf->h = h4;
+   }
+   else {
+      shelf = _al_vector_ref(&page->shelves, shelf_i);
+      if (h4 > shelf->h)
+         shelf->h = h4;
    }
 
-   glyph->page_bitmap = page;
-   glyph->region.x = data->page_pos_x;
-   glyph->region.y = data->page_pos_y;
+   ALLEGRO_DEBUG("Glyph %d: %dx%d (%dx%d) page %d shelf %d\n",
+      ft_index, w, h, w4, h4, page_i, shelf_i);
+
+   glyph->page_bitmap = page->bitmap;
+   glyph->page = page_i;
+   glyph->region.x = shelf->x;
+   glyph->region.y = shelf->y;
    glyph->region.w = w;
    glyph->region.h = h;
+   page->last_used = data->use_clock;
 
-   data->page_pos_x = align4(data->page_pos_x + w4);
-   if (h > data->page_line_height) {
-      data->page_line_height = h4;
-      relock = true;
-   }
+   shelf->x = align4(shelf->x + w4);
 
-   if (relock) {
+   /* The glyph can be written through the current lock only if it is
+    * entirely inside of it.
+    */
+   if (!data->page_lr || data->lock_page != page_i ||
+         glyph->region.x < data->lock_rect.x ||
+         glyph->region.y < data->lock_rect.y ||
+         glyph->region.x + w4 > data->lock_rect.x + data->lock_rect.w ||
+         glyph->region.y + h4 > data->lock_rect.y + data->lock_rect.h) {
       char *ptr;
       int i;
       unlock_current_page(data);
 
+      data->lock_page = page_i;
       data->lock_rect.x = glyph->region.x;
       data->lock_rect.y = glyph->region.y;
-      /* Do we lock up to the right edge in anticipation of caching more
-       * glyphs, or just enough for the current glyph?
+      /* Do we lock up to the right edge of the shelf in anticipation of
+       * caching more glyphs, or just enough for the current glyph?
        */
       if (lock_more) {
-         data->lock_rect.w = al_get_bitmap_width(page) - data->lock_rect.x;
-         data->lock_rect.h = data->page_line_height;
+         data->lock_rect.w = al_get_bitmap_width(page->bitmap) - data->lock_rect.x;
+         data->lock_rect.h = shelf->h;
       }
       else {
          data->lock_rect.w = w4;
          data->lock_rect.h = h4;
       }
 
-      data->page_lr = al_lock_bitmap_region(page,
+      data->page_lr = al_lock_bitmap_region(page->bitmap,
          data->lock_rect.x, data->lock_rect.y,
          data->lock_rect.w, data->lock_rect.h,
          ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
@@ -296,19 +652,18 @@ static unsigned char *alloc_glyph_region(ALLEGRO_TTF_FONT_DATA *data,
 }
 
 
-static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_mono(int flags, FT_Bitmap const *bitmap,
+   unsigned char *glyph_data, int pitch)
 {
-   int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
       int bit = 0;
 
-      if (font_data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+      if (flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -321,7 +676,7 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char set = ((*ptr >> (7-bit)) & 1) ? 255 : 0;
             *dptr++ = set;
             *dptr++ = set;
@@ -337,18 +692,17 @@ static void copy_glyph_mono(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
-static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
-   unsigned char *glyph_data)
+static void copy_glyph_color(int flags, FT_Bitmap const *bitmap,
+   unsigned char *glyph_data, int pitch)
 {
-   int pitch = font_data->page_lr->pitch;
    int x, y;
 
-   for (y = 0; y < (int)face->glyph->bitmap.rows; y++) {
-      unsigned char const *ptr = face->glyph->bitmap.buffer + face->glyph->bitmap.pitch * y;
+   for (y = 0; y < (int)bitmap->rows; y++) {
+      unsigned char const *ptr = bitmap->buffer + bitmap->pitch * y;
       unsigned char *dptr = glyph_data + pitch * y;
 
-      if (font_data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+      if (flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = 255;
             *dptr++ = 255;
@@ -358,7 +712,7 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
          }
       }
       else {
-         for (x = 0; x < (int)face->glyph->bitmap.width; x++) {
+         for (x = 0; x < (int)bitmap->width; x++) {
             unsigned char c = *ptr;
             *dptr++ = c;
             *dptr++ = c;
@@ -371,39 +725,271 @@ static void copy_glyph_color(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
 }
 
 
+typedef struct SDF_POINT
+{
+   short dx;
+   short dy;
+} SDF_POINT;
+
+
+static INLINE int sdf_dist2(SDF_POINT p)
+{
+   return p.dx * p.dx + p.dy * p.dy;
+}
+
+
+static INLINE void sdf_compare(SDF_POINT *grid, int pitch, SDF_POINT *p,
+   int x, int y, int ox, int oy)
+{
+   SDF_POINT other = grid[(y + oy) * pitch + x + ox];
+   other.dx += ox;
+   other.dy += oy;
+   if (sdf_dist2(other) < sdf_dist2(*p))
+      *p = other;
+}
+
+
+/* 8-point sequential signed Euclidean distance transform: afterwards each
+ * point holds the offset to the nearest point which was (0, 0) before.
+ */
+static void sdf_transform(SDF_POINT *grid, int w, int h)
+{
+   int x, y;
+
+   for (y = 0; y < h; y++) {
+      for (x = 0; x < w; x++) {
+         SDF_POINT p = grid[y * w + x];
+         if (x > 0)
+            sdf_compare(grid, w, &p, x, y, -1, 0);
+         if (y > 0) {
+            sdf_compare(grid, w, &p, x, y, 0, -1);
+            if (x > 0)
+               sdf_compare(grid, w, &p, x, y, -1, -1);
+            if (x < w - 1)
+               sdf_compare(grid, w, &p, x, y, 1, -1);
+         }
+         grid[y * w + x] = p;
+      }
+      for (x = w - 2; x >= 0; x--) {
+         SDF_POINT p = grid[y * w + x];
+         sdf_compare(grid, w, &p, x, y, 1, 0);
+         grid[y * w + x] = p;
+      }
+   }
+
+   for (y = h - 1; y >= 0; y--) {
+      for (x = w - 1; x >= 0; x--) {
+         SDF_POINT p = grid[y * w + x];
+         if (x < w - 1)
+            sdf_compare(grid, w, &p, x, y, 1, 0);
+         if (y < h - 1) {
+            sdf_compare(grid, w, &p, x, y, 0, 1);
+            if (x > 0)
+               sdf_compare(grid, w, &p, x, y, -1, 1);
+            if (x < w - 1)
+               sdf_compare(grid, w, &p, x, y, 1, 1);
+         }
+         grid[y * w + x] = p;
+      }
+      for (x = 1; x < w; x++) {
+         SDF_POINT p = grid[y * w + x];
+         sdf_compare(grid, w, &p, x, y, -1, 0);
+         grid[y * w + x] = p;
+      }
+   }
+}
+
+
+/* Renders the glyph loaded into the face again, SDF_SCALE times larger,
+ * and turns it into a distance field SDF_SPREAD pixels larger than the
+ * glyph on each side.  The value 128 lies on the outline.  The caller
+ * frees bitmap->buffer.
+ */
+static bool render_sdf(FT_Face face, int ft_index, FT_Bitmap *bitmap)
+{
+   const int S = SDF_SCALE;
+   const int R = SDF_SPREAD;
+   int left = face->glyph->bitmap_left - R;
+   int top = face->glyph->bitmap_top + R;
+   int w = face->glyph->bitmap.width + 2 * R;
+   int h = face->glyph->bitmap.rows + 2 * R;
+   int hw = w * S;
+   int hh = h * S;
+   SDF_POINT *inside, *outside;
+   unsigned char *buffer;
+   FT_Matrix matrix;
+   FT_Bitmap const *hi;
+   int ox, oy;
+   int x, y, i, j;
+
+   matrix.xx = S << 16;
+   matrix.xy = 0;
+   matrix.yx = 0;
+   matrix.yy = S << 16;
+   FT_Set_Transform(face, &matrix, NULL);
+   if (FT_Load_Glyph(face, ft_index,
+         FT_LOAD_RENDER | FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING)) {
+      FT_Set_Transform(face, NULL, NULL);
+      return false;
+   }
+   FT_Set_Transform(face, NULL, NULL);
+
+   inside = al_malloc(hw * hh * sizeof *inside);
+   outside = al_malloc(hw * hh * sizeof *outside);
+   buffer = al_malloc(w * h);
+   if (!inside || !outside || !buffer) {
+      al_free(inside);
+      al_free(outside);
+      al_free(buffer);
+      return false;
+   }
+
+   /* inside gets the offsets to the nearest point inside the glyph,
+    * outside those to the nearest point outside of it.
+    */
+   for (i = 0; i < hw * hh; i++) {
+      inside[i].dx = inside[i].dy = SHRT_MAX / 4;
+      outside[i].dx = outside[i].dy = 0;
+   }
+   hi = &face->glyph->bitmap;
+   ox = face->glyph->bitmap_left - left * S;
+   oy = top * S - face->glyph->bitmap_top;
+   for (y = 0; y < (int)hi->rows; y++) {
+      unsigned char const *ptr = hi->buffer + hi->pitch * y;
+      if (y + oy < 0 || y + oy >= hh)
+         continue;
+      for (x = 0; x < (int)hi->width; x++) {
+         if (x + ox < 0 || x + ox >= hw || ptr[x] < 128)
+            continue;
+         i = (y + oy) * hw + x + ox;
+         inside[i].dx = inside[i].dy = 0;
+         outside[i].dx = outside[i].dy = SHRT_MAX / 4;
+      }
+   }
+
+   sdf_transform(inside, hw, hh);
+   sdf_transform(outside, hw, hh);
+
+   /* Each output pixel is the average distance over its S x S block. */
+   for (y = 0; y < h; y++) {
+      for (x = 0; x < w; x++) {
+         float sum = 0;
+         float v;
+         for (j = y * S; j < (y + 1) * S; j++) {
+            for (i = x * S; i < (x + 1) * S; i++) {
+               int k = j * hw + i;
+               if (outside[k].dx || outside[k].dy)
+                  sum += sqrtf(sdf_dist2(outside[k])) - 0.5f;
+               else
+                  sum -= sqrtf(sdf_dist2(inside[k])) - 0.5f;
+            }
+         }
+         v = 0.5f + sum / (S * S) / (2.0f * R * S);
+         if (v < 0)
+            v = 0;
+         if (v > 1)
+            v = 1;
+         buffer[y * w + x] = v * 255 + 0.5f;
+      }
+   }
+
+   al_free(inside);
+   al_free(outside);
+
+   memset(bitmap, 0, sizeof *bitmap);
+   bitmap->width = w;
+   bitmap->rows = h;
+   bitmap->pitch = w;
+   bitmap->buffer = buffer;
+   bitmap->num_grays = 256;
+   bitmap->pixel_mode = FT_PIXEL_MODE_GRAY;
+   return true;
+}
+
+
+static bool use_subpixel(int flags)
+{
+    return (flags & ALLEGRO_TTF_SUBPIXEL) && !(flags & ALLEGRO_TTF_SDF);
+}
+
+
+static INLINE int pen_to_pixels(int x)
+{
+    return (x + 32) >> 6;
+}
+
+
+static FT_Int32 get_load_flags(int flags)
+{
+    FT_Int32 ft_load_flags;
+
+    // FIXME: make this a config setting? FT_LOAD_FORCE_AUTOHINT
+
+    // FIXME: Investigate why some fonts don't work without the
+    // NO_BITMAP flags. Supposedly using that flag makes small sizes
+    // look bad so ideally we would not used it.
+    ft_load_flags = FT_LOAD_RENDER | FT_LOAD_NO_BITMAP;
+    if (flags & ALLEGRO_TTF_MONOCHROME)
+       ft_load_flags |= FT_LOAD_TARGET_MONO;
+    if (flags & ALLEGRO_TTF_NO_AUTOHINT)
+       ft_load_flags |= FT_LOAD_NO_AUTOHINT;
+    /* Glyphs which are placed at fractions of a pixel are only hinted
+     * vertically.
+     */
+    else if (use_subpixel(flags))
+       ft_load_flags |= FT_LOAD_TARGET_LIGHT;
+    /* Hinting for one size makes no sense if the glyphs are scaled. */
+    if (flags & ALLEGRO_TTF_SDF)
+       ft_load_flags = FT_LOAD_RENDER | FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING;
+
+    return ft_load_flags;
+}
+
+
+/* Returns the advance of a loaded glyph in 1/64 pixels. Without subpixel
+ * positioning it is a whole number of pixels, as the glyphs are.
+ */
+static int get_slot_advance(int flags, FT_GlyphSlot slot)
+{
+    if (use_subpixel(flags))
+       return slot->linearHoriAdvance >> 10;
+    return slot->advance.x & ~63;
+}
+
+
 /* NOTE: this function may disable the bitmap hold drawing state
  * and leave the current page bitmap locked.
  */
 static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
    int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, bool lock_more)
 {
-    FT_Int32 ft_load_flags;
     FT_Error e;
+    FT_Bitmap sdf;
     int w, h;
     unsigned char *glyph_data;
 
     if (glyph->page_bitmap || glyph->region.x < 0)
         return;
 
-    // FIXME: make this a config setting? FT_LOAD_FORCE_AUTOHINT
-
-    // FIXME: Investigate why some fonts don't work without the
-    // NO_BITMAP flags. Supposedly using that flag makes small sizes
-    // look bad so ideally we would not used it.
-    ft_load_flags = FT_LOAD_RENDER | FT_LOAD_NO_BITMAP;
-    if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
-       ft_load_flags |= FT_LOAD_TARGET_MONO;
-    if (font_data->flags & ALLEGRO_TTF_NO_AUTOHINT)
-       ft_load_flags |= FT_LOAD_NO_AUTOHINT;
+    /* Subpixel variants are rendered shifted to the right. */
+    if (glyph->variant > 0) {
+       FT_Vector delta;
+       delta.x = glyph->variant * 64 / font_data->subpixel_positions;
+       delta.y = 0;
+       FT_Set_Transform(face, NULL, &delta);
+    }
 
-    e = FT_Load_Glyph(face, ft_index, ft_load_flags);
+    e = FT_Load_Glyph(face, ft_index, get_load_flags(font_data->flags));
     if (e) {
        ALLEGRO_WARN("Failed loading glyph %d from.\n", ft_index);
     }
 
+    if (glyph->variant > 0)
+       FT_Set_Transform(face, NULL, NULL);
+
     glyph->offset_x = face->glyph->bitmap_left;
     glyph->offset_y = (face->size->metrics.ascender >> 6) - face->glyph->bitmap_top;
-    glyph->advance = face->glyph->advance.x >> 6;
+    glyph->advance = get_slot_advance(font_data->flags, face->glyph);
 
     w = face->glyph->bitmap.width;
     h = face->glyph->bitmap.rows;
@@ -416,20 +1002,41 @@ static void cache_glyph(ALLEGRO_TTF_FONT_DATA *font_data, FT_Face face,
        return;
     }
 
+    if (font_data->flags & ALLEGRO_TTF_SDF) {
+       if (!render_sdf(face, ft_index, &sdf)) {
+          ALLEGRO_WARN("Failed rendering distance field of glyph %d.\n",
+             ft_index);
+          return;
+       }
+       glyph->offset_x -= SDF_SPREAD;
+       glyph->offset_y -= SDF_SPREAD;
+       w = sdf.width;
+       h = sdf.rows;
+    }
+
     /* Each glyph has a 1-pixel border all around. Note: The border is kept
      * even against the outer bitmap edge, to ensure consistent rendering.
      */
     glyph_data = alloc_glyph_region(font_data, ft_index,
-       w + 2, h + 2, false, glyph, lock_more);
+       w + 2, h + 2, glyph, lock_more);
 
     if (glyph_data == NULL) {
+       if (font_data->flags & ALLEGRO_TTF_SDF)
+          al_free(sdf.buffer);
        return;
     }
 
-    if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
-       copy_glyph_mono(font_data, face, glyph_data);
+    if (font_data->flags & ALLEGRO_TTF_SDF) {
+       copy_glyph_color(font_data->flags, &sdf, glyph_data,
+          font_data->page_lr->pitch);
+       al_free(sdf.buffer);
+    }
+    else if (font_data->flags & ALLEGRO_TTF_MONOCHROME)
+       copy_glyph_mono(font_data->flags, &face->glyph->bitmap, glyph_data,
+          font_data->page_lr->pitch);
     else
-       copy_glyph_color(font_data, face, glyph_data);
+       copy_glyph_color(font_data->flags, &face->glyph->bitmap, glyph_data,
+          font_data->page_lr->pitch);
 
     if (!lock_more) {
        unlock_current_page(font_data);
@@ -441,72 +1048,545 @@ static int get_kerning(ALLEGRO_TTF_FONT_DATA const *data, FT_Face face,
    int prev_ft_index, int ft_index)
 {
    /* Do kerning? */
-   if (!(data->flags & ALLEGRO_TTF_NO_KERNING) && prev_ft_index != -1) {
+   if (!(data->flags & ALLEGRO_TTF_NO_KERNING) && prev_ft_index != -1 &&
+         FT_HAS_KERNING(face)) {
       FT_Vector delta;
+      if (use_subpixel(data->flags)) {
+         FT_Get_Kerning(face, prev_ft_index, ft_index,
+            FT_KERNING_UNFITTED, &delta);
+         return delta.x;
+      }
       FT_Get_Kerning(face, prev_ft_index, ft_index,
          FT_KERNING_DEFAULT, &delta);
-      return delta.x >> 6;
+      return delta.x & ~63;
    }
 
    return 0;
 }
 
 
-static int render_glyph(ALLEGRO_FONT const *f,
-   ALLEGRO_COLOR color, int prev_ft_index, int ft_index,
-   float xpos, float ypos)
-{
-   ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
-   ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
-   int advance = 0;
+/* Kerning table entries which have not been looked up yet. */
+#define KERNING_UNKNOWN SHRT_MIN
 
-   /* We don't try to cache all glyphs in a pre-pass before drawing them.
-    * While that would indeed save us making separate texture uploads, it
-    * implies two passes over a string even in the common case when all glyphs
-    * are already cached.  This turns out to have an measureable impact on
-    * performance.
-    */
-   cache_glyph(data, face, ft_index, glyph, false);
 
-   advance += get_kerning(data, face, prev_ft_index, ft_index);
+/* Fills in the glyph indices and advances of the code points [0, size)
+ * when the font is loaded, so that measuring text made of them needs no
+ * calls into FreeType. Glyphs are loaded without rendering them. The
+ * kerning of pairs of them is only looked up once it is needed.
+ */
+static void init_char_table(ALLEGRO_TTF_FONT_DATA *data, int size)
+{
+   FT_Face face = get_face(data);
+   FT_Int32 load_flags = get_load_flags(data->flags) & ~FT_LOAD_RENDER;
+   int i;
 
-   if (glyph->page_bitmap) {
-      /* Each glyph has a 1-pixel border all around. */
-      al_draw_tinted_bitmap_region(glyph->page_bitmap, color,
-         glyph->region.x + 1, glyph->region.y + 1,
-         glyph->region.w - 2, glyph->region.h - 2,
-         xpos + glyph->offset_x + advance,
-         ypos + glyph->offset_y, 0);
-   }
-   else if (glyph->region.x > 0) {
-      ALLEGRO_ERROR("Glyph %d not on any page.\n", ft_index);
+   data->char_table = al_calloc(size, sizeof(TTF_CHAR));
+   if (!data->char_table)
+      return;
+
+   for (i = 0; i < size; i++) {
+      TTF_CHAR *c = &data->char_table[i];
+      c->ft_index = FT_Get_Char_Index(face, i);
+      c->glyph = get_glyph(data, c->ft_index);
+      if (FT_Load_Glyph(face, c->ft_index, load_flags) == 0)
+         c->advance = get_slot_advance(data->flags, face->glyph);
    }
 
-   advance += glyph->advance;
+   /* Without a table get_kerning asks FreeType every time. */
+   if (FT_HAS_KERNING(face) && !(data->flags & ALLEGRO_TTF_NO_KERNING)) {
+      data->kerning_table = al_malloc(size * size * sizeof(short));
+      if (data->kerning_table) {
+         for (i = 0; i < size * size; i++)
+            data->kerning_table[i] = KERNING_UNKNOWN;
+      }
+   }
 
-   return advance;
+   data->char_table_size = size;
 }
 
 
-static int ttf_font_height(ALLEGRO_FONT const *f)
+static INLINE bool in_char_table(ALLEGRO_TTF_FONT_DATA const *data,
+   int32_t ch)
 {
-   ASSERT(f);
-   return f->height;
+   return ch >= 0 && ch < data->char_table_size;
 }
 
 
-static int ttf_font_ascent(ALLEGRO_FONT const *f)
+static int get_char_index(ALLEGRO_TTF_FONT_DATA *data, int32_t ch)
 {
-    ALLEGRO_TTF_FONT_DATA *data;
-    FT_Face face;
-
-    ASSERT(f);
+   if (in_char_table(data, ch))
+      return data->char_table[ch].ft_index;
+   return FT_Get_Char_Index(get_face(data), ch);
+}
 
-    data = f->data;
-    face = data->face;
 
-    return face->size->metrics.ascender >> 6;
+static ALLEGRO_TTF_GLYPH_DATA *get_char_glyph(ALLEGRO_TTF_FONT_DATA *data,
+   int32_t ch, int ft_index)
+{
+   if (in_char_table(data, ch))
+      return data->char_table[ch].glyph;
+   return get_glyph(data, ft_index);
+}
+
+
+/* Like get_kerning, with the code points as well as the glyph indices.
+ * A prev_ch of -1 means there is no previous glyph.
+ */
+static int get_char_kerning(ALLEGRO_TTF_FONT_DATA *data, int32_t prev_ch,
+   int prev_ft_index, int32_t ch, int ft_index)
+{
+   if (data->kerning_table && in_char_table(data, prev_ch) &&
+         in_char_table(data, ch)) {
+      short *k = &data->kerning_table[prev_ch * data->char_table_size + ch];
+      if (*k == KERNING_UNKNOWN) {
+         int kerning = get_kerning(data, get_face(data), prev_ft_index,
+            ft_index);
+         /* In 1/64 pixels, so only kerning of over 500 pixels is clipped. */
+         if (kerning <= KERNING_UNKNOWN)
+            kerning = KERNING_UNKNOWN + 1;
+         else if (kerning > SHRT_MAX)
+            kerning = SHRT_MAX;
+         *k = kerning;
+      }
+      return *k;
+   }
+   return get_kerning(data, get_face(data), prev_ft_index, ft_index);
+}
+
+
+static float sample_sdf(ALLEGRO_LOCKED_REGION const *lr, int w, int h,
+   float u, float v)
+{
+   int x = floorf(u);
+   int y = floorf(v);
+   float fx = u - x;
+   float fy = v - y;
+   float a[4];
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      int sx = x + (i & 1);
+      int sy = y + (i >> 1);
+      if (sx < 0 || sy < 0 || sx >= w || sy >= h)
+         a[i] = 0;
+      else
+         a[i] = ((unsigned char *)lr->data)[sy * lr->pitch + sx * 4 + 3];
+   }
+
+   return ((a[0] * (1 - fx) + a[1] * fx) * (1 - fy) +
+      (a[2] * (1 - fx) + a[3] * fx) * fy) / 255.0f;
+}
+
+
+/* Draws a distance field glyph to a memory bitmap, where no shader can
+ * turn the field into sharp edges.
+ */
+static void draw_glyph_sdf(ALLEGRO_TTF_FONT_DATA *data,
+   ALLEGRO_TTF_GLYPH_DATA const *glyph, ALLEGRO_COLOR color,
+   float gx, float gy)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+   ALLEGRO_TRANSFORM inv;
+   ALLEGRO_LOCKED_REGION *src;
+   float xs[4], ys[4];
+   float min_x, min_y, max_x, max_y;
+   float scale, ramp;
+   int cx, cy, cw, ch;
+   int x0, y0, x1, y1;
+   int x, y, i;
+   bool lock_target;
+
+   al_copy_transform(&inv, t);
+   if (!al_check_inverse(&inv, 1e-7)) {
+      return;
+   }
+   al_invert_transform(&inv);
+
+   /* Transform the corners of the glyph to find the area it covers. */
+   for (i = 0; i < 4; i++) {
+      xs[i] = gx + ((i & 1) ? glyph->region.w - 2 : 0);
+      ys[i] = gy + ((i >> 1) ? glyph->region.h - 2 : 0);
+      al_transform_coordinates(t, &xs[i], &ys[i]);
+   }
+   min_x = max_x = xs[0];
+   min_y = max_y = ys[0];
+   for (i = 1; i < 4; i++) {
+      min_x = _ALLEGRO_MIN(min_x, xs[i]);
+      max_x = _ALLEGRO_MAX(max_x, xs[i]);
+      min_y = _ALLEGRO_MIN(min_y, ys[i]);
+      max_y = _ALLEGRO_MAX(max_y, ys[i]);
+   }
+
+   al_get_clipping_rectangle(&cx, &cy, &cw, &ch);
+   x0 = _ALLEGRO_MAX(cx, (int)floorf(min_x));
+   y0 = _ALLEGRO_MAX(cy, (int)floorf(min_y));
+   x1 = _ALLEGRO_MIN(cx + cw, (int)ceilf(max_x));
+   y1 = _ALLEGRO_MIN(cy + ch, (int)ceilf(max_y));
+   if (x0 >= x1 || y0 >= y1)
+      return;
+
+   /* An edge is smoothed over one target pixel, which is this much of the
+    * field's range.
+    */
+   scale = sqrtf(fabsf(t->m[0][0] * t->m[1][1] - t->m[0][1] * t->m[1][0]));
+   ramp = 1.0f / (scale * 2 * SDF_SPREAD);
+
+   src = al_lock_bitmap_region(glyph->page_bitmap,
+      glyph->region.x, glyph->region.y, glyph->region.w, glyph->region.h,
+      ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+   if (!src)
+      return;
+
+   lock_target = !al_is_bitmap_locked(target);
+   if (lock_target && !al_lock_bitmap_region(target, x0, y0, x1 - x0, y1 - y0,
+         ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READWRITE)) {
+      al_unlock_bitmap(glyph->page_bitmap);
+      return;
+   }
+
+   for (y = y0; y < y1; y++) {
+      for (x = x0; x < x1; x++) {
+         float u = x + 0.5f;
+         float v = y + 0.5f;
+         float d, a;
+         ALLEGRO_COLOR c;
+
+         al_transform_coordinates(&inv, &u, &v);
+         /* The region includes the 1-pixel border. */
+         d = sample_sdf(src, glyph->region.w, glyph->region.h,
+            u - gx + 0.5f, v - gy + 0.5f);
+         a = (d - 0.5f) / ramp + 0.5f;
+         if (a <= 0)
+            continue;
+         if (a > 1)
+            a = 1;
+
+         c = color;
+         c.a *= a;
+         if (!(data->flags & ALLEGRO_NO_PREMULTIPLIED_ALPHA)) {
+            c.r *= a;
+            c.g *= a;
+            c.b *= a;
+         }
+         al_put_blended_pixel(x, y, c);
+      }
+   }
+
+   if (lock_target)
+      al_unlock_bitmap(target);
+   al_unlock_bitmap(glyph->page_bitmap);
+}
+
+
+/* Queues the glyph to be drawn by flush_glyph_quads. */
+static void add_glyph_quad(ALLEGRO_TTF_FONT_DATA *data,
+   ALLEGRO_TTF_GLYPH_DATA const *glyph, ALLEGRO_COLOR color,
+   float xpos, float ypos)
+{
+   TTF_PAGE *page = get_page(data, glyph->page);
+   float *q;
+
+   if (page->num_quads == page->max_quads) {
+      int max_quads = page->max_quads ? page->max_quads * 2 : 64;
+      float *quads = al_realloc(page->quads, max_quads * 6 * sizeof(float));
+      if (!quads) {
+         /* Each glyph has a 1-pixel border all around. */
+         al_draw_tinted_bitmap_region(glyph->page_bitmap, color,
+            glyph->region.x + 1, glyph->region.y + 1,
+            glyph->region.w - 2, glyph->region.h - 2,
+            xpos + glyph->offset_x,
+            ypos + glyph->offset_y, 0);
+         return;
+      }
+      page->quads = quads;
+      page->max_quads = max_quads;
+   }
+
+   /* Each glyph has a 1-pixel border all around. */
+   q = page->quads + page->num_quads * 6;
+   q[0] = glyph->region.x + 1;
+   q[1] = glyph->region.y + 1;
+   q[2] = glyph->region.w - 2;
+   q[3] = glyph->region.h - 2;
+   q[4] = xpos + glyph->offset_x;
+   q[5] = ypos + glyph->offset_y;
+   page->num_quads++;
+}
+
+
+static void draw_glyph(ALLEGRO_TTF_FONT_DATA *data,
+   ALLEGRO_TTF_GLYPH_DATA const *glyph, int ft_index,
+   ALLEGRO_COLOR color, float xpos, float ypos)
+{
+   if (glyph->page_bitmap) {
+      get_page(data, glyph->page)->last_used = data->use_clock;
+      if ((data->flags & ALLEGRO_TTF_SDF) &&
+            (al_get_bitmap_flags(al_get_target_bitmap()) & ALLEGRO_MEMORY_BITMAP)) {
+         draw_glyph_sdf(data, glyph, color,
+            xpos + glyph->offset_x, ypos + glyph->offset_y);
+         return;
+      }
+      add_glyph_quad(data, glyph, color, xpos, ypos);
+   }
+   else if (glyph->region.x > 0) {
+      ALLEGRO_ERROR("Glyph %d not on any page.\n", ft_index);
+   }
+}
+
+
+/* Returns the glyph to draw with its pen at *xpos.  With subpixel
+ * positioning that is the variant rendered closest to the fraction of
+ * *xpos, which is then rounded down to the pixel to draw it at.
+ */
+static ALLEGRO_TTF_GLYPH_DATA *position_glyph(ALLEGRO_TTF_FONT_DATA *data,
+   int ft_index, ALLEGRO_TTF_GLYPH_DATA *glyph, float *xpos)
+{
+   int n = data->subpixel_positions;
+   float x;
+   int variant;
+
+   if (n <= 1)
+      return glyph;
+
+   x = floorf(*xpos);
+   variant = (int)((*xpos - x) * n + 0.5f);
+   if (variant == n) {
+      x += 1;
+      variant = 0;
+   }
+   *xpos = x;
+
+   if (variant == 0)
+      return glyph;
+
+   /* The variants are stored after the glyphs of the face. */
+   glyph = get_glyph(data,
+      ft_index + variant * data->shared_face->face->num_glyphs);
+   glyph->variant = variant;
+   return glyph;
+}
+
+
+/* Draws a glyph with its pen at pen, in 1/64 pixels from xpos, and returns
+ * the pen position after it.
+ */
+static int render_glyph(ALLEGRO_FONT const *f,
+   ALLEGRO_COLOR color, int32_t prev_ch, int prev_ft_index,
+   int32_t ch, int ft_index, float xpos, int pen, float ypos)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   FT_Face face = get_face(data);
+   ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, ft_index);
+
+   /* We don't try to cache all glyphs in a pre-pass before drawing them.
+    * While that would indeed save us making separate texture uploads, it
+    * implies two passes over a string even in the common case when all glyphs
+    * are already cached.  This turns out to have an measureable impact on
+    * performance.
+    */
+   pen += get_char_kerning(data, prev_ch, prev_ft_index, ch, ft_index);
+
+   xpos += pen / 64.0f;
+   glyph = position_glyph(data, ft_index, glyph, &xpos);
+   cache_glyph(data, face, ft_index, glyph, false);
+   draw_glyph(data, glyph, ft_index, color, xpos, ypos);
+
+   return pen + glyph->advance;
+}
+
+
+static uint32_t hash_ustr(const ALLEGRO_USTR *text)
+{
+   const unsigned char *p = (const unsigned char *)al_cstr(text);
+   size_t n = al_ustr_size(text);
+   uint32_t hash = 2166136261u;
+
+   while (n-- > 0) {
+      hash ^= *p++;
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+static void free_layout(TTF_LAYOUT *layout)
+{
+   al_ustr_free(layout->text);
+   al_free(layout->glyphs);
+   al_free(layout);
+}
+
+
+static void unlink_layout(ALLEGRO_TTF_FONT_DATA *data, TTF_LAYOUT *layout)
+{
+   if (layout->lru_prev)
+      layout->lru_prev->lru_next = layout->lru_next;
+   else
+      data->layout_lru_head = layout->lru_next;
+   if (layout->lru_next)
+      layout->lru_next->lru_prev = layout->lru_prev;
+   else
+      data->layout_lru_tail = layout->lru_prev;
+   layout->lru_prev = layout->lru_next = NULL;
+}
+
+
+static void push_layout_front(ALLEGRO_TTF_FONT_DATA *data, TTF_LAYOUT *layout)
+{
+   layout->lru_next = data->layout_lru_head;
+   if (data->layout_lru_head)
+      data->layout_lru_head->lru_prev = layout;
+   else
+      data->layout_lru_tail = layout;
+   data->layout_lru_head = layout;
+}
+
+
+static void evict_layout(ALLEGRO_TTF_FONT_DATA *data, TTF_LAYOUT *layout)
+{
+   TTF_LAYOUT **link;
+
+   link = &data->layout_buckets[layout->hash & (data->layout_num_buckets - 1)];
+   while (*link != layout)
+      link = &(*link)->hash_next;
+   *link = layout->hash_next;
+
+   unlink_layout(data, layout);
+   free_layout(layout);
+   data->layout_count--;
+}
+
+
+/* Caches all glyphs of the text, like ttf_text_length does, and records
+ * where each one goes.
+ */
+static TTF_LAYOUT *build_layout(ALLEGRO_TTF_FONT_DATA *data,
+   const ALLEGRO_USTR *text, uint32_t hash)
+{
+   FT_Face face = get_face(data);
+   TTF_LAYOUT *layout;
+   int max_glyphs = al_ustr_length(text);
+   int end = al_ustr_size(text);
+   int pos = 0;
+   int prev_ft_index = -1;
+   int32_t prev_ch = -1;
+   int x = 0;
+   int dim_x = 0;
+   int32_t ch;
+
+   layout = al_calloc(1, sizeof *layout);
+   if (!layout)
+      return NULL;
+   layout->hash = hash;
+   layout->text = al_ustr_dup(text);
+   if (max_glyphs > 0)
+      layout->glyphs = al_malloc(max_glyphs * sizeof(TTF_LAYOUT_GLYPH));
+   if (!layout->text || (max_glyphs > 0 && !layout->glyphs)) {
+      free_layout(layout);
+      return NULL;
+   }
+
+   while ((ch = al_ustr_get_next(text, &pos)) >= 0 &&
+         layout->num_glyphs < max_glyphs) {
+      int ft_index = get_char_index(data, ch);
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, ft_index);
+      TTF_LAYOUT_GLYPH *lg;
+
+      cache_glyph(data, face, ft_index, glyph, true);
+
+      if (pos == end) {
+         dim_x = pen_to_pixels(x) + glyph->offset_x + glyph->region.w -
+            data->glyph_padding;
+      }
+      if (layout->num_glyphs == 0) {
+         layout->bbx = glyph->offset_x + data->glyph_padding;
+      }
+
+      x += get_char_kerning(data, prev_ch, prev_ft_index, ch, ft_index);
+
+      lg = &layout->glyphs[layout->num_glyphs++];
+      lg->glyph = glyph;
+      lg->ft_index = ft_index;
+      lg->x = x;
+
+      x += glyph->advance;
+      prev_ft_index = ft_index;
+      prev_ch = ch;
+   }
+
+   unlock_current_page(data);
+
+   layout->advance = x;
+   layout->bbw = dim_x - layout->bbx;
+   return layout;
+}
+
+
+/* Returns the cached layout of the text, creating it if necessary.
+ * Returns NULL if the cache is disabled.
+ */
+static TTF_LAYOUT *get_layout(ALLEGRO_TTF_FONT_DATA *data,
+   const ALLEGRO_USTR *text)
+{
+   TTF_LAYOUT **bucket;
+   TTF_LAYOUT *layout;
+   uint32_t hash;
+
+   if (data->layout_capacity <= 0)
+      return NULL;
+
+   hash = hash_ustr(text);
+   bucket = &data->layout_buckets[hash & (data->layout_num_buckets - 1)];
+
+   for (layout = *bucket; layout; layout = layout->hash_next) {
+      if (layout->hash == hash && al_ustr_equal(layout->text, text)) {
+         data->layout_hits++;
+         unlink_layout(data, layout);
+         push_layout_front(data, layout);
+         return layout;
+      }
+   }
+
+   data->layout_misses++;
+   layout = build_layout(data, text, hash);
+   if (!layout)
+      return NULL;
+
+   if (data->layout_count >= data->layout_capacity)
+      evict_layout(data, data->layout_lru_tail);
+
+   layout->hash_next = *bucket;
+   *bucket = layout;
+   push_layout_front(data, layout);
+   data->layout_count++;
+
+   return layout;
+}
+
+
+static int ttf_font_height(ALLEGRO_FONT const *f)
+{
+   ASSERT(f);
+   return f->height;
+}
+
+
+static int ttf_font_ascent(ALLEGRO_FONT const *f)
+{
+    ALLEGRO_TTF_FONT_DATA *data;
+    FT_Face face;
+    int ascent;
+
+    ASSERT(f);
+
+    data = f->data;
+    face = lock_face(data);
+    ascent = face->size->metrics.ascender >> 6;
+    unlock_face(data);
+
+    return ascent;
 }
 
 
@@ -514,13 +1594,16 @@ static int ttf_font_descent(ALLEGRO_FONT const *f)
 {
     ALLEGRO_TTF_FONT_DATA *data;
     FT_Face face;
+    int descent;
 
     ASSERT(f);
 
     data = f->data;
-    face = data->face;
+    face = lock_face(data);
+    descent = (-face->size->metrics.descender) >> 6;
+    unlock_face(data);
 
-    return (-face->size->metrics.descender) >> 6;
+    return descent;
 }
 
 
@@ -548,57 +1631,252 @@ static int ttf_char_length(ALLEGRO_FONT const *f, int ch)
 }
 
 
+/* Copies the glyphs rendered by the cache thread so far to the pages.
+ * Must be called from the thread the font is used on.
+ */
+static void upload_prerendered_glyphs(ALLEGRO_TTF_FONT_DATA *data)
+{
+   _AL_VECTOR results;
+   unsigned i;
+   int y;
+
+   if (!data->cache_thread)
+      return;
+
+   al_lock_mutex(data->cache_mutex);
+   results = data->cache_results;
+   _al_vector_init(&data->cache_results, sizeof(TTF_PRERENDERED_GLYPH));
+   al_unlock_mutex(data->cache_mutex);
+
+   for (i = 0; i < _al_vector_size(&results); i++) {
+      TTF_PRERENDERED_GLYPH *pre = _al_vector_ref(&results, i);
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, pre->ft_index);
+      unsigned char *glyph_data;
+
+      glyph->requested = false;
+
+      /* Skip glyphs which were needed before the cache thread got to them. */
+      if (pre->ok && !glyph->page_bitmap && glyph->region.x >= 0) {
+         glyph->offset_x = pre->offset_x;
+         glyph->offset_y = pre->offset_y;
+         glyph->advance = pre->advance;
+
+         if (!pre->pixels) {
+            glyph->region.x = -1;
+            glyph->region.y = -1;
+         }
+         else {
+            /* Consecutive glyphs go through the same lock as far as
+             * possible, so a page is updated in few uploads.
+             */
+            glyph_data = alloc_glyph_region(data, pre->ft_index,
+               pre->w + 2, pre->h + 2, glyph, true);
+            if (glyph_data) {
+               for (y = 0; y < pre->h; y++) {
+                  memcpy(glyph_data + y * data->page_lr->pitch,
+                     pre->pixels + y * pre->w * 4, pre->w * 4);
+               }
+            }
+         }
+      }
+
+      al_free(pre->pixels);
+   }
+
+   unlock_current_page(data);
+   _al_vector_free(&results);
+}
+
+
+static void stop_cache_thread(ALLEGRO_TTF_FONT_DATA *data)
+{
+   unsigned i;
+
+   if (!data->cache_thread)
+      return;
+
+   al_lock_mutex(data->cache_mutex);
+   al_set_thread_should_stop(data->cache_thread);
+   al_broadcast_cond(data->cache_cond);
+   al_unlock_mutex(data->cache_mutex);
+   al_join_thread(data->cache_thread, NULL);
+   al_destroy_thread(data->cache_thread);
+   data->cache_thread = NULL;
+
+   for (i = 0; i < _al_vector_size(&data->cache_results); i++) {
+      TTF_PRERENDERED_GLYPH *pre = _al_vector_ref(&data->cache_results, i);
+      al_free(pre->pixels);
+   }
+   _al_vector_free(&data->cache_results);
+   _al_vector_free(&data->cache_requests);
+   al_destroy_cond(data->cache_cond);
+   al_destroy_mutex(data->cache_mutex);
+}
+
+
 static int ttf_render(ALLEGRO_FONT const *f, ALLEGRO_COLOR color,
    const ALLEGRO_USTR *text, float x, float y)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
+   FT_Face face = lock_face(data);
+   TTF_LAYOUT *layout;
    int pos = 0;
-   int advance = 0;
+   int pen = 0;
    int prev_ft_index = -1;
+   int32_t prev_ch = -1;
    int32_t ch;
    bool hold;
 
+   upload_prerendered_glyphs(data);
+
+   data->use_clock++;
+   data->batch_color = color;
+   layout = get_layout(data, text);
+
    hold = al_is_bitmap_drawing_held();
    al_hold_bitmap_drawing(true);
 
+   if (layout) {
+      int i;
+      for (i = 0; i < layout->num_glyphs; i++) {
+         TTF_LAYOUT_GLYPH *lg = &layout->glyphs[i];
+         float xpos = x + lg->x / 64.0f;
+         ALLEGRO_TTF_GLYPH_DATA *glyph = position_glyph(data, lg->ft_index,
+            lg->glyph, &xpos);
+         /* The glyph may have to be cached again if rendering it failed. */
+         cache_glyph(data, face, lg->ft_index, glyph, false);
+         draw_glyph(data, glyph, lg->ft_index, color, xpos, y);
+      }
+      flush_glyph_quads(data);
+      al_hold_bitmap_drawing(hold);
+      unlock_face(data);
+      return pen_to_pixels(layout->advance);
+   }
+
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      advance += render_glyph(f, color, prev_ft_index, ft_index,
-         x + advance, y);
+      int ft_index = get_char_index(data, ch);
+      pen = render_glyph(f, color, prev_ch, prev_ft_index, ch, ft_index,
+         x, pen, y);
       prev_ft_index = ft_index;
+      prev_ch = ch;
    }
 
+   flush_glyph_quads(data);
    al_hold_bitmap_drawing(hold);
+   unlock_face(data);
+
+   return pen_to_pixels(pen);
+}
+
 
-   return advance;
+/* Measures text using only the character table. Returns false if some
+ * character is not in the table.
+ */
+static bool char_table_text_length(ALLEGRO_TTF_FONT_DATA *data,
+   const ALLEGRO_USTR *text, int *length)
+{
+   int pos = 0;
+   int32_t prev_ch = -1;
+   int prev_ft_index = -1;
+   int x = 0;
+   int32_t ch;
+
+   while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
+      TTF_CHAR *c;
+      if (!in_char_table(data, ch))
+         return false;
+      c = &data->char_table[ch];
+      x += get_char_kerning(data, prev_ch, prev_ft_index, ch, c->ft_index);
+      x += c->advance;
+      prev_ft_index = c->ft_index;
+      prev_ch = ch;
+   }
+
+   *length = pen_to_pixels(x);
+   return true;
 }
 
 
 static int ttf_text_length(ALLEGRO_FONT const *f, const ALLEGRO_USTR *text)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
+   FT_Face face = lock_face(data);
+   TTF_LAYOUT *layout;
    int pos = 0;
    int prev_ft_index = -1;
+   int32_t prev_ch = -1;
    int x = 0;
    int32_t ch;
 
+   /* Text which is only measured needn't be laid out or cached. */
+   if (data->char_table_size > 0 && char_table_text_length(data, text, &x)) {
+      unlock_face(data);
+      return x;
+   }
+
+   upload_prerendered_glyphs(data);
+
+   layout = get_layout(data, text);
+   if (layout) {
+      unlock_face(data);
+      return pen_to_pixels(layout->advance);
+   }
+
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
+      int ft_index = get_char_index(data, ch);
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, ft_index);
 
       cache_glyph(data, face, ft_index, glyph, true);
 
-      x += get_kerning(data, face, prev_ft_index, ft_index);
+      x += get_char_kerning(data, prev_ch, prev_ft_index, ch, ft_index);
       x += glyph->advance;
 
       prev_ft_index = ft_index;
+      prev_ch = ch;
    }
 
    unlock_current_page(data);
+   unlock_face(data);
 
-   return x;
+   return pen_to_pixels(x);
+}
+
+
+static int ttf_get_glyph_advance(ALLEGRO_FONT const *f, int codepoint1,
+   int codepoint2)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   FT_Face face = lock_face(data);
+   ALLEGRO_TTF_GLYPH_DATA *glyph;
+   int ft_index;
+   int advance;
+
+   if (in_char_table(data, codepoint1)) {
+      advance = data->char_table[codepoint1].advance;
+      if (codepoint2 >= 0) {
+         advance += get_char_kerning(data, codepoint1,
+            data->char_table[codepoint1].ft_index, codepoint2,
+            get_char_index(data, codepoint2));
+      }
+      unlock_face(data);
+      return pen_to_pixels(advance);
+   }
+
+   upload_prerendered_glyphs(data);
+
+   ft_index = FT_Get_Char_Index(face, codepoint1);
+   glyph = get_glyph(data, ft_index);
+   cache_glyph(data, face, ft_index, glyph, false);
+   advance = glyph->advance;
+
+   /* A negative codepoint2 means the glyph is the last one. */
+   if (codepoint2 >= 0) {
+      advance += get_char_kerning(data, codepoint1, ft_index, codepoint2,
+         get_char_index(data, codepoint2));
+   }
+   unlock_face(data);
+
+   return pen_to_pixels(advance);
 }
 
 
@@ -607,37 +1885,54 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
    int *bbx, int *bby, int *bbw, int *bbh)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   FT_Face face = data->face;
+   FT_Face face = lock_face(data);
+   TTF_LAYOUT *layout;
    int end;
    int pos = 0;
    int prev_ft_index = -1;
+   int32_t prev_ch = -1;
    bool first = true;
    int x = 0;
    int32_t ch;
 
+   upload_prerendered_glyphs(data);
+
+   layout = get_layout(data, text);
+   if (layout) {
+      *bbx = layout->bbx;
+      *bby = 0; // FIXME
+      *bbw = layout->bbw;
+      *bbh = f->height; // FIXME, we want the bounding box!
+      unlock_face(data);
+      return;
+   }
+
    end = al_ustr_size(text);
    *bbx = 0;
 
    while ((ch = al_ustr_get_next(text, &pos)) >= 0) {
-      int ft_index = FT_Get_Char_Index(face, ch);
-      ALLEGRO_TTF_GLYPH_DATA *glyph = get_glyph(data, ft_index);
+      int ft_index = get_char_index(data, ch);
+      ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, ft_index);
 
       cache_glyph(data, face, ft_index, glyph, true);
 
       if (pos == end) {
-         x += glyph->offset_x + glyph->region.w;
+         /* The pen position is in 1/64 pixels, the glyph box in pixels. */
+         x = pen_to_pixels(x) + glyph->offset_x + glyph->region.w -
+            data->glyph_padding;
       }
       else {
-         x += get_kerning(data, face, prev_ft_index, ft_index);
+         x += get_char_kerning(data, prev_ch, prev_ft_index, ch, ft_index);
          x += glyph->advance;
       }
 
       if (first) {
-         *bbx = glyph->offset_x;
+         *bbx = glyph->offset_x + data->glyph_padding;
          first = false;
       }
 
       prev_ft_index = ft_index;
+      prev_ch = ch;
    }
 
    *bby = 0; // FIXME
@@ -645,6 +1940,7 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
    *bbh = f->height; // FIXME, we want the bounding box!
 
    unlock_current_page(data);
+   unlock_face(data);
 }
 
 
@@ -653,16 +1949,16 @@ static void ttf_get_text_dimensions(ALLEGRO_FONT const *f,
 static void debug_cache(ALLEGRO_FONT *f)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
-   _AL_VECTOR *v = &data->page_bitmaps;
+   _AL_VECTOR *v = &data->pages;
    static int j = 0;
    int i;
 
    al_init_image_addon();
 
    for (i = 0; i < (int)_al_vector_size(v); i++) {
-      ALLEGRO_BITMAP **bmp = _al_vector_ref(v, i);
+      TTF_PAGE *page = _al_vector_ref(v, i);
       ALLEGRO_USTR *u = al_ustr_newf("font%d_%d.png", j, i);
-      al_save_bitmap(al_cstr(u), *bmp);
+      al_save_bitmap(al_cstr(u), page->bitmap);
       al_ustr_free(u);
    }
    j++;
@@ -670,28 +1966,66 @@ static void debug_cache(ALLEGRO_FONT *f)
 #endif
 
 
+static void release_face(TTF_FACE *shared)
+{
+    TTF_FACE **p;
+
+    al_lock_mutex(faces_mutex);
+    if (--shared->refcount > 0) {
+       al_unlock_mutex(faces_mutex);
+       return;
+    }
+
+    for (p = &shared_faces; *p; p = &(*p)->next) {
+       if (*p == shared) {
+          *p = shared->next;
+          break;
+       }
+    }
+
+    FT_Done_Face(shared->face);
+    al_unlock_mutex(faces_mutex);
+
+    al_destroy_mutex(shared->mutex);
+    al_ustr_free(shared->filename);
+    al_free(shared);
+}
+
+
 static void ttf_destroy(ALLEGRO_FONT *f)
 {
    ALLEGRO_TTF_FONT_DATA *data = f->data;
    int i;
 
+   stop_cache_thread(data);
    unlock_current_page(data);
 
 #ifdef DEBUG_CACHE
    debug_cache(f);
 #endif
 
-   FT_Done_Face(data->face);
+   al_lock_mutex(data->shared_face->mutex);
+   FT_Done_Size(data->size);
+   al_unlock_mutex(data->shared_face->mutex);
+   release_face(data->shared_face);
    for (i = _al_vector_size(&data->glyph_ranges) - 1; i >= 0; i--) {
       ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
       al_free(range->glyphs);
    }
    _al_vector_free(&data->glyph_ranges);
-   for (i = _al_vector_size(&data->page_bitmaps) - 1; i >= 0; i--) {
-      ALLEGRO_BITMAP **bmp = _al_vector_ref(&data->page_bitmaps, i);
-      al_destroy_bitmap(*bmp);
+   for (i = _al_vector_size(&data->pages) - 1; i >= 0; i--) {
+      TTF_PAGE *page = get_page(data, i);
+      al_destroy_bitmap(page->bitmap);
+      _al_vector_free(&page->shelves);
+      al_free(page->quads);
    }
-   _al_vector_free(&data->page_bitmaps);
+   _al_vector_free(&data->pages);
+   while (data->layout_lru_head) {
+      evict_layout(data, data->layout_lru_head);
+   }
+   al_free(data->layout_buckets);
+   al_free(data->char_table);
+   al_free(data->kerning_table);
    al_free(data);
    al_free(f);
 }
@@ -700,53 +2034,368 @@ static void ttf_destroy(ALLEGRO_FONT *f)
 static unsigned long ftread(FT_Stream stream, unsigned long offset,
     unsigned char *buffer, unsigned long count)
 {
-    ALLEGRO_TTF_FONT_DATA *data = stream->pathname.pointer;
+    TTF_STREAM *s = stream->pathname.pointer;
     unsigned long bytes;
 
     if (count == 0)
        return 0;
 
-    if (offset != data->offset)
-       al_fseek(data->file, data->base_offset + offset, ALLEGRO_SEEK_SET);
-    bytes = al_fread(data->file, buffer, count);
-    data->offset = offset + bytes;
+    if (offset != s->offset)
+       al_fseek(s->file, s->base_offset + offset, ALLEGRO_SEEK_SET);
+    bytes = al_fread(s->file, buffer, count);
+    s->offset = offset + bytes;
     return bytes;
 }
 
 
 static void ftclose(FT_Stream  stream)
 {
-    ALLEGRO_TTF_FONT_DATA *data = stream->pathname.pointer;
-    al_fclose(data->file);
-    data->file = NULL;
+    TTF_STREAM *s = stream->pathname.pointer;
+    al_fclose(s->file);
+    s->file = NULL;
 }
 
 
-/* Function: al_load_ttf_font_f
- */
-ALLEGRO_FONT *al_load_ttf_font_f(ALLEGRO_FILE *file,
+static void init_stream(TTF_STREAM *s, ALLEGRO_FILE *file)
+{
+    memset(s, 0, sizeof *s);
+    s->stream.read = ftread;
+    s->stream.close = ftclose;
+    s->stream.pathname.pointer = s;
+    s->base_offset = al_ftell(file);
+    s->stream.size = al_fsize(file);
+    s->file = file;
+}
+
+
+static void set_face_size(FT_Face face, int w, int h)
+{
+    if (h > 0) {
+       FT_Set_Pixel_Sizes(face, w, h);
+    }
+    else {
+       /* Set the "real dimension" of the font to be the passed size,
+        * in pixels.
+        */
+       FT_Size_RequestRec req;
+       ASSERT(w <= 0);
+       ASSERT(h <= 0);
+       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
+       req.width = (-w) << 6;
+       req.height = (-h) << 6;
+       req.horiResolution = 0;
+       req.vertResolution = 0;
+       FT_Request_Size(face, &req);
+    }
+}
+
+
+static void prerender_glyph(int flags, FT_Face face,
+   TTF_PRERENDERED_GLYPH *pre)
+{
+   FT_Bitmap const *bitmap;
+   FT_Bitmap sdf;
+
+   pre->ok = false;
+   pre->pixels = NULL;
+
+   if (!face || FT_Load_Glyph(face, pre->ft_index, get_load_flags(flags)))
+      return;
+
+   bitmap = &face->glyph->bitmap;
+   pre->offset_x = face->glyph->bitmap_left;
+   pre->offset_y = (face->size->metrics.ascender >> 6) - face->glyph->bitmap_top;
+   pre->advance = get_slot_advance(flags, face->glyph);
+   pre->w = bitmap->width;
+   pre->h = bitmap->rows;
+
+   if (pre->w == 0 || pre->h == 0) {
+      pre->ok = true;
+      return;
+   }
+
+   if (flags & ALLEGRO_TTF_SDF) {
+      if (!render_sdf(face, pre->ft_index, &sdf))
+         return;
+      bitmap = &sdf;
+      pre->offset_x -= SDF_SPREAD;
+      pre->offset_y -= SDF_SPREAD;
+      pre->w = sdf.width;
+      pre->h = sdf.rows;
+   }
+
+   pre->pixels = al_malloc(pre->w * pre->h * 4);
+   if (pre->pixels) {
+      pre->ok = true;
+      if ((flags & ALLEGRO_TTF_MONOCHROME) && !(flags & ALLEGRO_TTF_SDF))
+         copy_glyph_mono(flags, bitmap, pre->pixels, pre->w * 4);
+      else
+         copy_glyph_color(flags, bitmap, pre->pixels, pre->w * 4);
+   }
+
+   if (flags & ALLEGRO_TTF_SDF)
+      al_free(sdf.buffer);
+}
+
+
+static void *cache_thread_proc(ALLEGRO_THREAD *thread, void *arg)
+{
+   ALLEGRO_TTF_FONT_DATA *data = arg;
+   FT_Library library;
+   FT_Face face = NULL;
+   TTF_STREAM stream;
+   ALLEGRO_FILE *file;
+
+   /* FreeType objects may not be used by two threads at once, so this
+    * thread opens the font a second time in its own library.
+    */
+   if (FT_Init_FreeType(&library) == 0) {
+      file = al_fopen_interface(data->shared_face->file_interface,
+         al_cstr(data->shared_face->filename), "rb");
+      if (file) {
+         FT_Open_Args args;
+         init_stream(&stream, file);
+         memset(&args, 0, sizeof args);
+         args.flags = FT_OPEN_STREAM;
+         args.stream = &stream.stream;
+         /* FreeType closes the file even if this fails. */
+         if (FT_Open_Face(library, &args, 0, &face) == 0)
+            set_face_size(face, data->size_w, data->size_h);
+         else
+            face = NULL;
+      }
+   }
+   else {
+      library = NULL;
+   }
+
+   if (!face) {
+      ALLEGRO_WARN("Cache thread could not open %s.\n",
+         al_cstr(data->shared_face->filename));
+   }
+
+   al_lock_mutex(data->cache_mutex);
+   while (!al_get_thread_should_stop(thread)) {
+      TTF_PRERENDERED_GLYPH pre;
+
+      if (data->cache_next == _al_vector_size(&data->cache_requests)) {
+         _al_vector_free(&data->cache_requests);
+         data->cache_next = 0;
+         al_wait_cond(data->cache_cond, data->cache_mutex);
+         continue;
+      }
+
+      pre.ft_index = *(int *)_al_vector_ref(&data->cache_requests,
+         data->cache_next++);
+      al_unlock_mutex(data->cache_mutex);
+
+      /* Failed glyphs are still reported, so they are no longer marked as
+       * requested and get rendered on demand instead.
+       */
+      prerender_glyph(data->flags, face, &pre);
+
+      al_lock_mutex(data->cache_mutex);
+      *(TTF_PRERENDERED_GLYPH *)_al_vector_alloc_back(&data->cache_results) = pre;
+   }
+   al_unlock_mutex(data->cache_mutex);
+
+   if (face)
+      FT_Done_Face(face);
+   if (library)
+      FT_Done_FreeType(library);
+
+   return NULL;
+}
+
+
+static bool start_cache_thread(ALLEGRO_TTF_FONT_DATA *data)
+{
+   if (data->cache_thread)
+      return true;
+   if (!data->shared_face->filename)
+      return false;
+
+   data->cache_mutex = al_create_mutex();
+   data->cache_cond = al_create_cond();
+   if (data->cache_mutex && data->cache_cond) {
+      _al_vector_init(&data->cache_requests, sizeof(int));
+      _al_vector_init(&data->cache_results, sizeof(TTF_PRERENDERED_GLYPH));
+      data->cache_next = 0;
+      data->cache_thread = al_create_thread(cache_thread_proc, data);
+   }
+
+   if (!data->cache_thread) {
+      if (data->cache_cond)
+         al_destroy_cond(data->cache_cond);
+      if (data->cache_mutex)
+         al_destroy_mutex(data->cache_mutex);
+      data->cache_cond = NULL;
+      data->cache_mutex = NULL;
+      return false;
+   }
+
+   al_start_thread(data->cache_thread);
+   return true;
+}
+
+
+static void ttf_cache_glyphs(ALLEGRO_FONT *f, int ranges_count,
+   const int *ranges)
+{
+   ALLEGRO_TTF_FONT_DATA *data = f->data;
+   FT_Face face = lock_face(data);
+   bool threaded;
+   int i, ch;
+
+   /* Fonts not loaded from a file name can't be opened a second time, so
+    * their glyphs are rendered right away.
+    */
+   threaded = start_cache_thread(data);
+   if (threaded)
+      al_lock_mutex(data->cache_mutex);
+
+   for (i = 0; i < ranges_count; i++) {
+      for (ch = ranges[i * 2]; ch <= ranges[i * 2 + 1]; ch++) {
+         int ft_index = get_char_index(data, ch);
+         ALLEGRO_TTF_GLYPH_DATA *glyph = get_char_glyph(data, ch, ft_index);
+
+         if (glyph->page_bitmap || glyph->region.x < 0 || glyph->requested)
+            continue;
+
+         if (threaded) {
+            *(int *)_al_vector_alloc_back(&data->cache_requests) = ft_index;
+            glyph->requested = true;
+         }
+         else {
+            cache_glyph(data, face, ft_index, glyph, true);
+         }
+      }
+   }
+
+   if (threaded) {
+      al_broadcast_cond(data->cache_cond);
+      al_unlock_mutex(data->cache_mutex);
+   }
+   else {
+      unlock_current_page(data);
+   }
+   unlock_face(data);
+}
+
+
+/* Function: al_load_ttf_font_f
+ */
+ALLEGRO_FONT *al_load_ttf_font_f(ALLEGRO_FILE *file,
     char const *filename, int size, int flags)
 {
     return al_load_ttf_font_stretch_f(file, filename, 0, size, flags);
 }
 
 
-/* Function: al_load_ttf_font_stretch_f
+/* Opens a face which reads from file.  The file is closed when the face is
+ * released, or right away if it can't be opened.  The caller must hold
+ * faces_mutex.
  */
-ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
-    char const *filename, int w, int h, int flags)
+static TTF_FACE *open_face(ALLEGRO_FILE *file, char const *filename)
 {
-    FT_Face face;
-    ALLEGRO_TTF_FONT_DATA *data;
-    ALLEGRO_FONT *f;
+    TTF_FACE *shared;
     ALLEGRO_PATH *path;
     FT_Open_Args args;
     int result;
+
+    shared = al_calloc(1, sizeof *shared);
+    if (shared)
+       shared->mutex = al_create_mutex();
+    if (!shared || !shared->mutex) {
+       al_free(shared);
+       al_fclose(file);
+       return NULL;
+    }
+    init_stream(&shared->stream, file);
+
+    memset(&args, 0, sizeof args);
+    args.flags = FT_OPEN_STREAM;
+    args.stream = &shared->stream.stream;
+
+    if ((result = FT_Open_Face(ft, &args, 0, &shared->face)) != 0) {
+        ALLEGRO_ERROR("Reading %s failed. Freetype error code %d\n", filename,
+	   result);
+        // Note: Freetype already closed the file for us.
+        al_destroy_mutex(shared->mutex);
+        al_free(shared);
+        return NULL;
+    }
+
+    // FIXME: The below doesn't use Allegro's streaming.
+    /* Small hack for Type1 fonts which store kerning information in
+     * a separate file - and we try to guess the name of that file.
+     */
+    path = al_create_path(filename);
+    if (!strcmp(al_get_path_extension(path), ".pfa")) {
+        const char *helper;
+        ALLEGRO_DEBUG("Type1 font assumed for %s.\n", filename);
+
+        al_set_path_extension(path, ".afm");
+        helper = al_path_cstr(path, '/');
+        FT_Attach_File(shared->face, helper);
+        ALLEGRO_DEBUG("Guessed afm file %s.\n", helper);
+
+        al_set_path_extension(path, ".tfm");
+        helper = al_path_cstr(path, '/');
+        FT_Attach_File(shared->face, helper);
+        ALLEGRO_DEBUG("Guessed tfm file %s.\n", helper);
+    }
+    al_destroy_path(path);
+
+    shared->refcount = 1;
+    return shared;
+}
+
+
+/* Returns the shared face opened from filename with the given file
+ * interface, or NULL.  The caller must hold faces_mutex.
+ */
+static TTF_FACE *find_shared_face(char const *filename,
+    const ALLEGRO_FILE_INTERFACE *file_interface)
+{
+    TTF_FACE *shared;
+
+    for (shared = shared_faces; shared; shared = shared->next) {
+       if (shared->file_interface == file_interface &&
+             !strcmp(al_cstr(shared->filename), filename)) {
+          return shared;
+       }
+    }
+
+    return NULL;
+}
+
+
+/* Creates a font with a new size of the face.  The caller keeps its
+ * reference to the face if this fails.
+ */
+static ALLEGRO_FONT *create_font(TTF_FACE *shared, char const *filename,
+    int w, int h, int flags)
+{
+    FT_Face face = shared->face;
+    ALLEGRO_TTF_FONT_DATA *data;
+    ALLEGRO_FONT *f;
     ALLEGRO_CONFIG* system_cfg = al_get_system_config();
     const char* min_page_size_str =
       system_cfg ? al_get_config_value(system_cfg, "ttf", "min_page_size") : NULL;
     const char* max_page_size_str =
       system_cfg ? al_get_config_value(system_cfg, "ttf", "max_page_size") : NULL;
+    const char* max_pages_str =
+      system_cfg ? al_get_config_value(system_cfg, "ttf", "max_pages") : NULL;
+    const char* max_page_memory_str =
+      system_cfg ? al_get_config_value(system_cfg, "ttf", "max_page_memory") : NULL;
+    const char* layout_cache_size_str =
+      system_cfg ? al_get_config_value(system_cfg, "ttf", "layout_cache_size") : NULL;
+    const char* char_table_size_str =
+      system_cfg ? al_get_config_value(system_cfg, "ttf", "char_table_size") : NULL;
+    const char* subpixel_positions_str =
+      system_cfg ? al_get_config_value(system_cfg, "ttf", "subpixel_positions") : NULL;
+    int char_table_size = 256;
 
     if ((h > 0 && w < 0) || (h < 0 && w > 0)) {
        ALLEGRO_ERROR("Height/width have opposite signs (w = %d, h = %d).\n", w, h);
@@ -754,12 +2403,8 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
     }
 
     data = al_calloc(1, sizeof *data);
-    data->stream.read = ftread;
-    data->stream.close = ftclose;
-    data->stream.pathname.pointer = data;
-    data->base_offset = al_ftell(file);
-    data->stream.size = al_fsize(file);
-    data->file = file;
+    data->size_w = w;
+    data->size_h = h;
     data->bitmap_format = al_get_new_bitmap_format();
     data->bitmap_flags = al_get_new_bitmap_flags();
     data->min_page_size = 256;
@@ -779,56 +2424,63 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
       }
     }
 
-    memset(&args, 0, sizeof args);
-    args.flags = FT_OPEN_STREAM;
-    args.stream = &data->stream;
-
-    if ((result = FT_Open_Face(ft, &args, 0, &face)) != 0) {
-        ALLEGRO_ERROR("Reading %s failed. Freetype error code %d\n", filename,
-	   result);
-        // Note: Freetype already closed the file for us.
-        al_free(data);
-        return NULL;
+    if (max_pages_str) {
+      int max_pages = atoi(max_pages_str);
+      if (max_pages > 0) {
+         data->max_pages = max_pages;
+      }
     }
 
-    // FIXME: The below doesn't use Allegro's streaming.
-    /* Small hack for Type1 fonts which store kerning information in
-     * a separate file - and we try to guess the name of that file.
-     */
-    path = al_create_path(filename);
-    if (!strcmp(al_get_path_extension(path), ".pfa")) {
-        const char *helper;
-        ALLEGRO_DEBUG("Type1 font assumed for %s.\n", filename);
-
-        al_set_path_extension(path, ".afm");
-        helper = al_path_cstr(path, '/');
-        FT_Attach_File(face, helper);
-        ALLEGRO_DEBUG("Guessed afm file %s.\n", helper);
+    if (max_page_memory_str) {
+      long max_page_memory = atol(max_page_memory_str);
+      if (max_page_memory > 0) {
+         data->max_page_memory = max_page_memory;
+      }
+    }
 
-        al_set_path_extension(path, ".tfm");
-        helper = al_path_cstr(path, '/');
-        FT_Attach_File(face, helper);
-        ALLEGRO_DEBUG("Guessed tfm file %s.\n", helper);
+    data->layout_capacity = 256;
+    if (layout_cache_size_str) {
+      int layout_cache_size = atoi(layout_cache_size_str);
+      if (layout_cache_size >= 0) {
+         data->layout_capacity = layout_cache_size;
+      }
+    }
+    if (char_table_size_str) {
+      char_table_size = atoi(char_table_size_str);
+      if (char_table_size < 0) {
+         char_table_size = 0;
+      }
+      /* The kerning table grows with the square of the size. */
+      if (char_table_size > 1024) {
+         char_table_size = 1024;
+      }
     }
-    al_destroy_path(path);
 
-    if (h > 0) {
-       FT_Set_Pixel_Sizes(face, w, h);
+    if (data->layout_capacity > 0) {
+      data->layout_num_buckets = 1;
+      while (data->layout_num_buckets < data->layout_capacity) {
+         data->layout_num_buckets *= 2;
+      }
+      data->layout_buckets = al_calloc(data->layout_num_buckets,
+         sizeof(TTF_LAYOUT *));
+      if (!data->layout_buckets) {
+         data->layout_capacity = 0;
+      }
     }
-    else {
-       /* Set the "real dimension" of the font to be the passed size,
-        * in pixels.
-        */
-       FT_Size_RequestRec req;
-       ASSERT(w <= 0);
-       ASSERT(h <= 0);
-       req.type = FT_SIZE_REQUEST_TYPE_REAL_DIM;
-       req.width = (-w) << 6;
-       req.height = (-h) << 6;
-       req.horiResolution = 0;
-       req.vertResolution = 0;
-       FT_Request_Size(face, &req);
+
+    /* Other fonts of the face may be in use by other threads. */
+    al_lock_mutex(shared->mutex);
+    if (FT_New_Size(face, &data->size) != 0) {
+        al_unlock_mutex(shared->mutex);
+        ALLEGRO_ERROR("Creating a size of %s failed.\n", filename);
+        al_free(data->layout_buckets);
+        al_free(data);
+        return NULL;
     }
+    FT_Activate_Size(data->size);
+    data->shared_face = shared;
+
+    set_face_size(face, w, h);
 
     ALLEGRO_DEBUG("Font %s loaded with pixel size %d x %d.\n", filename,
         w, h);
@@ -837,16 +2489,34 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
         face->size->metrics.descender / 64.0,
         face->size->metrics.height / 64.0);
 
-    data->face = face;
     data->flags = flags;
+    if (flags & ALLEGRO_TTF_SDF) {
+       data->glyph_padding = SDF_SPREAD;
+    }
+
+    data->subpixel_positions = 1;
+    if (use_subpixel(flags)) {
+       data->subpixel_positions = 4;
+       if (subpixel_positions_str) {
+          int subpixel_positions = atoi(subpixel_positions_str);
+          if (subpixel_positions >= 2 && subpixel_positions <= 4) {
+             data->subpixel_positions = subpixel_positions;
+          }
+       }
+    }
 
     _al_vector_init(&data->glyph_ranges, sizeof(ALLEGRO_TTF_GLYPH_RANGE));
-    _al_vector_init(&data->page_bitmaps, sizeof(ALLEGRO_BITMAP*));
+    _al_vector_init(&data->pages, sizeof(TTF_PAGE));
+
+    if (char_table_size > 0) {
+       init_char_table(data, char_table_size);
+    }
 
     f = al_malloc(sizeof *f);
     f->height = face->size->metrics.height >> 6;
     f->vtable = &vt;
     f->data = data;
+    al_unlock_mutex(shared->mutex);
 
     _al_register_destructor(_al_dtor_list, f,
        (void (*)(void *))al_destroy_font);
@@ -855,6 +2525,30 @@ ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
 }
 
 
+/* Function: al_load_ttf_font_stretch_f
+ */
+ALLEGRO_FONT *al_load_ttf_font_stretch_f(ALLEGRO_FILE *file,
+    char const *filename, int w, int h, int flags)
+{
+    TTF_FACE *shared;
+    ALLEGRO_FONT *f;
+
+    /* The file may not be at the same position when it is passed again,
+     * so these faces are not shared.
+     */
+    al_lock_mutex(faces_mutex);
+    shared = open_face(file, filename);
+    al_unlock_mutex(faces_mutex);
+    if (!shared)
+       return NULL;
+
+    f = create_font(shared, filename, w, h, flags);
+    if (!f)
+       release_face(shared);
+    return f;
+}
+
+
 /* Function: al_load_ttf_font
  */
 ALLEGRO_FONT *al_load_ttf_font(char const *filename, int size, int flags)
@@ -868,19 +2562,44 @@ ALLEGRO_FONT *al_load_ttf_font(char const *filename, int size, int flags)
 ALLEGRO_FONT *al_load_ttf_font_stretch(char const *filename, int w, int h,
    int flags)
 {
+   const ALLEGRO_FILE_INTERFACE *file_interface = al_get_new_file_interface();
+   TTF_FACE *shared;
    ALLEGRO_FILE *f;
    ALLEGRO_FONT *font;
    ASSERT(filename);
 
-   f = al_fopen(filename, "rb");
-   if (!f)
-      return NULL;
+   /* Sizes of the same file share one face. */
+   al_lock_mutex(faces_mutex);
+   shared = find_shared_face(filename, file_interface);
+   if (shared) {
+      shared->refcount++;
+   }
+   else {
+      f = al_fopen(filename, "rb");
+      if (!f) {
+         al_unlock_mutex(faces_mutex);
+         return NULL;
+      }
 
-   /* The file handle is owned by the function and the file is usually only
-    * closed when the font is destroyed, in case Freetype has to load data
-    * at a later time.
-    */
-   font = al_load_ttf_font_stretch_f(f, filename, w, h, flags);
+      /* The file handle is owned by the face and the file is usually only
+       * closed when the last font using it is destroyed, in case Freetype
+       * has to load data at a later time.
+       */
+      shared = open_face(f, filename);
+      if (!shared) {
+         al_unlock_mutex(faces_mutex);
+         return NULL;
+      }
+      shared->filename = al_ustr_new(filename);
+      shared->file_interface = file_interface;
+      shared->next = shared_faces;
+      shared_faces = shared;
+   }
+   al_unlock_mutex(faces_mutex);
+
+   font = create_font(shared, filename, w, h, flags);
+   if (!font)
+      release_face(shared);
 
    return font;
 }
@@ -890,15 +2609,16 @@ static int ttf_get_font_ranges(ALLEGRO_FONT *font, int ranges_count,
    int *ranges)
 {
    ALLEGRO_TTF_FONT_DATA *data = font->data;
+   FT_Face face = lock_face(data);
    FT_UInt g;
-   FT_ULong unicode = FT_Get_First_Char(data->face, &g);
+   FT_ULong unicode = FT_Get_First_Char(face, &g);
    int i = 0;
    if (i < ranges_count) {
       ranges[i * 2 + 0] = unicode;
       ranges[i * 2 + 1] = unicode;
    }
    while (g) {
-      FT_ULong unicode2 = FT_Get_Next_Char(data->face, unicode, &g);
+      FT_ULong unicode2 = FT_Get_Next_Char(face, unicode, &g);
       if (unicode + 1 != unicode2) {
          if (i < ranges_count) {
             ranges[i * 2 + 1] = unicode;
@@ -913,10 +2633,150 @@ static int ttf_get_font_ranges(ALLEGRO_FONT *font, int ranges_count,
       }
       unicode = unicode2;
    }
+   unlock_face(data);
    return i;
 }
 
 
+/* Function: al_get_ttf_layout_cache_stats
+ */
+bool al_get_ttf_layout_cache_stats(ALLEGRO_FONT const *font, int *hits,
+   int *misses)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   ASSERT(font);
+
+   if (font->vtable != &vt)
+      return false;
+
+   data = font->data;
+   if (hits)
+      *hits = data->layout_hits;
+   if (misses)
+      *misses = data->layout_misses;
+   return true;
+}
+
+
+/* Function: al_get_ttf_atlas_usage
+ */
+bool al_get_ttf_atlas_usage(ALLEGRO_FONT const *font, int *pages,
+   int *glyphs, int *used_pixels, int *total_pixels)
+{
+   ALLEGRO_TTF_FONT_DATA *data;
+   int num_glyphs = 0;
+   int used = 0;
+   int total = 0;
+   unsigned i;
+   int j;
+   ASSERT(font);
+
+   if (font->vtable != &vt)
+      return false;
+
+   data = font->data;
+
+   for (i = 0; i < _al_vector_size(&data->glyph_ranges); i++) {
+      ALLEGRO_TTF_GLYPH_RANGE *range = _al_vector_ref(&data->glyph_ranges, i);
+      for (j = 0; j < RANGE_SIZE; j++) {
+         ALLEGRO_TTF_GLYPH_DATA *glyph = &range->glyphs[j];
+         if (glyph->page_bitmap) {
+            num_glyphs++;
+            used += glyph->region.w * glyph->region.h;
+         }
+      }
+   }
+
+   for (i = 0; i < _al_vector_size(&data->pages); i++) {
+      TTF_PAGE *page = get_page(data, i);
+      total += al_get_bitmap_width(page->bitmap) *
+         al_get_bitmap_height(page->bitmap);
+   }
+
+   if (pages)
+      *pages = _al_vector_size(&data->pages);
+   if (glyphs)
+      *glyphs = num_glyphs;
+   if (used_pixels)
+      *used_pixels = used;
+   if (total_pixels)
+      *total_pixels = total;
+   return true;
+}
+
+
+static const char *sdf_glsl_pixel_source =
+   "#ifdef GL_ES\n"
+   "#extension GL_OES_standard_derivatives : enable\n"
+   "precision mediump float;\n"
+   "#endif\n"
+   "uniform sampler2D " ALLEGRO_SHADER_VAR_TEX ";\n"
+   "uniform bool " ALLEGRO_SHADER_VAR_USE_TEX ";\n"
+   "varying vec4 varying_color;\n"
+   "varying vec2 varying_texcoord;\n"
+   "void main()\n"
+   "{\n"
+   "  if (" ALLEGRO_SHADER_VAR_USE_TEX ") {\n"
+   "    float d = texture2D(" ALLEGRO_SHADER_VAR_TEX ", varying_texcoord).a;\n"
+   "    float w = 0.7 * fwidth(d);\n"
+   "    gl_FragColor = varying_color * smoothstep(0.5 - w, 0.5 + w, d);\n"
+   "  }\n"
+   "  else\n"
+   "    gl_FragColor = varying_color;\n"
+   "}\n";
+
+/* Shader model 2 has no derivatives, so the width of the edge is a
+ * parameter.
+ */
+static const char *sdf_hlsl_pixel_source =
+   "bool " ALLEGRO_SHADER_VAR_USE_TEX ";\n"
+   "texture " ALLEGRO_SHADER_VAR_TEX ";\n"
+   "float sdf_smoothing = 0.0625;\n"
+   "sampler2D s = sampler_state {\n"
+   "   texture = <" ALLEGRO_SHADER_VAR_TEX ">;\n"
+   "};\n"
+   "\n"
+   "float4 ps_main(VS_OUTPUT Input) : COLOR0\n"
+   "{\n"
+   "   if (" ALLEGRO_SHADER_VAR_USE_TEX ") {\n"
+   "      float d = tex2D(s, Input.TexCoord).a;\n"
+   "      return Input.Color * smoothstep(0.5 - sdf_smoothing,\n"
+   "         0.5 + sdf_smoothing, d);\n"
+   "   }\n"
+   "   else {\n"
+   "      return Input.Color;\n"
+   "   }\n"
+   "}\n";
+
+
+/* Function: al_get_ttf_sdf_shader_source
+ */
+char const *al_get_ttf_sdf_shader_source(ALLEGRO_SHADER_PLATFORM platform)
+{
+   if (platform == ALLEGRO_SHADER_AUTO) {
+      ALLEGRO_DISPLAY *display = al_get_current_display();
+      ASSERT(display);
+      if (al_get_display_flags(display) & ALLEGRO_OPENGL) {
+         platform = ALLEGRO_SHADER_GLSL;
+      }
+      else {
+         platform = ALLEGRO_SHADER_HLSL;
+      }
+   }
+
+   switch (platform) {
+      case ALLEGRO_SHADER_GLSL:
+         return sdf_glsl_pixel_source;
+      case ALLEGRO_SHADER_HLSL:
+         return sdf_hlsl_pixel_source;
+      case ALLEGRO_SHADER_AUTO:
+         break;
+   }
+
+   return NULL;
+}
+
+
 /* Function: al_init_ttf_addon
  */
 bool al_init_ttf_addon(void)
@@ -927,6 +2787,7 @@ bool al_init_ttf_addon(void)
    }
 
    FT_Init_FreeType(&ft);
+   faces_mutex = al_create_mutex();
    vt.font_height = ttf_font_height;
    vt.font_ascent = ttf_font_ascent;
    vt.font_descent = ttf_font_descent;
@@ -937,6 +2798,8 @@ bool al_init_ttf_addon(void)
    vt.destroy = ttf_destroy;
    vt.get_text_dimensions = ttf_get_text_dimensions;
    vt.get_font_ranges = ttf_get_font_ranges;
+   vt.cache_glyphs = ttf_cache_glyphs;
+   vt.get_glyph_advance = ttf_get_glyph_advance;
 
    al_register_font_loader(".ttf", al_load_ttf_font);
 
@@ -961,6 +2824,8 @@ void al_shutdown_ttf_addon(void)
    al_register_font_loader(".ttf", NULL);
 
    FT_Done_FreeType(ft);
+   al_destroy_mutex(faces_mutex);
+   faces_mutex = NULL;
 
    ttf_inited = false;
 }
@@ -25,6 +25,7 @@ set(ALLEGRO_SRC_FILES
     src/fullscreen_mode.c
     src/haptic.c
     src/inline.c
+    src/jobs.c
     src/joynu.c
     src/keybdnu.c
     src/libc.c
@@ -38,6 +39,7 @@ set(ALLEGRO_SRC_FILES
     src/path.c
     src/pixels.c
     src/shader.c
+    src/stepclock.c
     src/system.c
     src/threads.c
     src/timernu.c
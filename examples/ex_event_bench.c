@@ -0,0 +1,256 @@
+/*
+ *    Benchmark for taking events out of an event queue.
+ *
+ *    Fills a queue with user events and drains it again, once with one
+ *    call to al_get_next_event per event and once with al_get_next_events,
+ *    and reports the time per event.  The next two tests do the same while
+ *    another thread is emitting the events, using al_wait_for_event and
+ *    al_wait_for_events.  The next two have several threads emitting events
+ *    into the same queue, created with and without
+ *    ALLEGRO_EVENT_QUEUE_LOCK_FREE.  The last two time emitting and taking
+ *    out reference counted events, with a destructor and with data copied
+ *    by al_emit_user_event_with_data.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+
+#include "common.c"
+
+#define BENCH_EVENT_TYPE   ALLEGRO_GET_EVENT_TYPE('b', 'e', 'n', 'c')
+
+/* Number of events in the queue at once. */
+#define QUEUE_EVENTS 4096
+/* How many events al_get_next_events and al_wait_for_events take at most. */
+#define BATCH 64
+/* Number of threads emitting events in the last two tests. */
+#define PRODUCERS 4
+/* How many seconds the timing should approximately take. */
+#define TEST_TIME 2.0
+
+enum Mode {
+   ALL,
+   SINGLE,
+   BATCHED,
+   THREADED_SINGLE,
+   THREADED_BATCHED,
+   PRODUCERS_LOCKED,
+   PRODUCERS_LOCK_FREE,
+   REFCOUNTED,
+   WITH_DATA
+};
+
+static char const *names[] = {
+   "", "al_get_next_event", "al_get_next_events",
+   "al_wait_for_event with producer thread",
+   "al_wait_for_events with producer thread",
+   "4 producer threads",
+   "4 producer threads, lock-free queue",
+   "al_emit_user_event with destructor",
+   "al_emit_user_event_with_data"
+};
+
+/* Each thread emits events from its own source, so the threads only
+ * compete for the queue.
+ */
+static ALLEGRO_EVENT_SOURCE sources[PRODUCERS];
+static ALLEGRO_EVENT_QUEUE *queue;
+
+typedef struct PRODUCER
+{
+   ALLEGRO_THREAD *thread;
+   ALLEGRO_EVENT_SOURCE *source;
+   int n;
+} PRODUCER;
+
+static void event_dtor(ALLEGRO_USER_EVENT *event)
+{
+   (void)event;
+}
+
+static void emit_events(ALLEGRO_EVENT_SOURCE *source, int n, enum Mode mode)
+{
+   ALLEGRO_EVENT event;
+   char data[32] = "payload";
+   int i;
+
+   event.user.type = BENCH_EVENT_TYPE;
+   for (i = 0; i < n; i++) {
+      event.user.data1 = i;
+      if (mode == REFCOUNTED)
+         al_emit_user_event(source, &event, event_dtor);
+      else if (mode == WITH_DATA)
+         al_emit_user_event_with_data(source, &event, data, sizeof data);
+      else
+         al_emit_user_event(source, &event, NULL);
+   }
+}
+
+static void *producer(ALLEGRO_THREAD *thread, void *arg)
+{
+   PRODUCER *p = arg;
+   (void)thread;
+
+   emit_events(p->source, p->n, PRODUCERS_LOCKED);
+   return NULL;
+}
+
+/* Takes n events out of the queue and returns their sum, so the loop
+ * cannot be optimized away.
+ */
+static intptr_t drain(enum Mode mode, int n)
+{
+   ALLEGRO_EVENT events[BATCH];
+   intptr_t sum = 0;
+   int got = 0;
+   int i, k;
+
+   while (got < n) {
+      switch (mode) {
+         case SINGLE:
+         case REFCOUNTED:
+         case WITH_DATA:
+            k = al_get_next_event(queue, events) ? 1 : 0;
+            break;
+         case BATCHED:
+            k = al_get_next_events(queue, events, BATCH);
+            break;
+         case THREADED_SINGLE:
+            al_wait_for_event(queue, events);
+            k = 1;
+            break;
+         case THREADED_BATCHED:
+         case PRODUCERS_LOCKED:
+         case PRODUCERS_LOCK_FREE:
+            k = al_wait_for_events(queue, events, BATCH);
+            break;
+         default:
+            k = 0;
+            break;
+      }
+      if (k == 0)
+         abort_example("Queue ran empty.\n");
+      for (i = 0; i < k; i++) {
+         sum += events[i].user.data1;
+         al_unref_user_event(&events[i].user);
+      }
+      got += k;
+   }
+
+   return sum;
+}
+
+/* Returns the time in seconds it took to take n events out of the queue.
+ * Without a producer thread, filling the queue is not timed, except for
+ * reference counted events.
+ */
+static double run(enum Mode mode, int n)
+{
+   PRODUCER producers[PRODUCERS];
+   int num_producers = 0;
+   double t0, t1;
+   int i;
+
+   if (mode == THREADED_SINGLE || mode == THREADED_BATCHED)
+      num_producers = 1;
+   else if (mode == PRODUCERS_LOCKED || mode == PRODUCERS_LOCK_FREE)
+      num_producers = PRODUCERS;
+
+   if (mode == REFCOUNTED || mode == WITH_DATA) {
+      t0 = al_get_time();
+      emit_events(&sources[0], n, mode);
+      drain(mode, n);
+      t1 = al_get_time();
+      return t1 - t0;
+   }
+
+   if (num_producers == 0) {
+      emit_events(&sources[0], n, mode);
+      t0 = al_get_time();
+      drain(mode, n);
+      t1 = al_get_time();
+      return t1 - t0;
+   }
+
+   for (i = 0; i < num_producers; i++) {
+      producers[i].source = &sources[i];
+      producers[i].n = n / num_producers;
+      producers[i].thread = al_create_thread(producer, &producers[i]);
+   }
+   t0 = al_get_time();
+   for (i = 0; i < num_producers; i++)
+      al_start_thread(producers[i].thread);
+   drain(mode, n);
+   t1 = al_get_time();
+   for (i = 0; i < num_producers; i++)
+      al_destroy_thread(producers[i].thread);
+
+   return t1 - t0;
+}
+
+static void do_test(enum Mode mode)
+{
+   double t = 0;
+   int repeat = 0;
+   int i;
+
+   queue = al_create_event_queue_flags(mode == PRODUCERS_LOCK_FREE ?
+      ALLEGRO_EVENT_QUEUE_LOCK_FREE : 0);
+   for (i = 0; i < PRODUCERS; i++)
+      al_register_event_source(queue, &sources[i]);
+
+   log_printf("Benchmark: %s\n", names[mode]);
+
+   /* Warm up, which also lets the queue grow to its final size. */
+   run(mode, QUEUE_EVENTS);
+
+   while (t < TEST_TIME) {
+      t += run(mode, QUEUE_EVENTS);
+      repeat++;
+   }
+
+   log_printf("Time = %g s, %d events\n", t, repeat * QUEUE_EVENTS);
+   log_printf("%s: %g ns per event\n", names[mode],
+      t * 1e9 / ((double)repeat * QUEUE_EVENTS));
+
+   al_destroy_event_queue(queue);
+}
+
+int main(int argc, char **argv)
+{
+   enum Mode mode = ALL;
+   int i;
+
+   if (argc > 1) {
+      mode = strtol(argv[1], NULL, 10);
+      if (mode < ALL || mode > WITH_DATA)
+         mode = ALL;
+   }
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro\n");
+   }
+
+   open_log();
+
+   for (i = 0; i < PRODUCERS; i++)
+      al_init_user_event_source(&sources[i]);
+
+   if (mode == ALL) {
+      for (mode = SINGLE; mode <= WITH_DATA; mode++) {
+         do_test(mode);
+      }
+   }
+   else {
+      do_test(mode);
+   }
+
+   for (i = 0; i < PRODUCERS; i++)
+      al_destroy_user_event_source(&sources[i]);
+
+   close_log(true);
+
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,273 @@
+/*
+ *    Benchmark for mutexes and condition variables.
+ *
+ *    Times locking and unlocking a mutex in one thread, a recursive mutex
+ *    in one thread, and a mutex shared by several threads.  The last two
+ *    tests pass a token back and forth between two threads with a
+ *    condition variable, and wake several threads at once with
+ *    al_broadcast_cond.  Build the library with and without WANT_FUTEX to
+ *    compare the futex backend with the pthread one on Linux.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+
+#include "common.c"
+
+/* Number of threads in the contended and broadcast tests. */
+#define THREADS 4
+/* How many seconds the timing should approximately take. */
+#define TEST_TIME 2.0
+/* Lock operations per run, split between the threads. */
+#define LOCKS (1 << 20)
+/* Round trips per run in the condition variable tests. */
+#define ROUNDS 4096
+
+enum Mode {
+   ALL,
+   UNCONTENDED,
+   RECURSIVE,
+   CONTENDED,
+   PING_PONG,
+   BROADCAST
+};
+
+static char const *names[] = {
+   "", "Uncontended mutex", "Uncontended recursive mutex",
+   "4 threads on one mutex", "Condition variable ping-pong",
+   "Broadcast to 4 threads"
+};
+
+static ALLEGRO_MUTEX *mutex;
+static ALLEGRO_COND *cond;
+static ALLEGRO_COND *done_cond;
+static volatile int counter;
+/* The current round, and how many threads have seen it. */
+static volatile int current_round;
+static volatile int seen;
+
+static void *idle(ALLEGRO_THREAD *thread, void *arg)
+{
+   (void)thread;
+   (void)arg;
+   return NULL;
+}
+
+static void *locker(ALLEGRO_THREAD *thread, void *arg)
+{
+   int n = *(int *)arg;
+   int i;
+   (void)thread;
+
+   for (i = 0; i < n; i++) {
+      al_lock_mutex(mutex);
+      counter++;
+      al_unlock_mutex(mutex);
+   }
+   return NULL;
+}
+
+/* Waits for odd rounds and starts the next even one. */
+static void *ponger(ALLEGRO_THREAD *thread, void *arg)
+{
+   (void)thread;
+   (void)arg;
+
+   al_lock_mutex(mutex);
+   while (current_round < 2 * ROUNDS) {
+      while (current_round % 2 == 0)
+         al_wait_cond(cond, mutex);
+      current_round++;
+      al_signal_cond(cond);
+   }
+   al_unlock_mutex(mutex);
+   return NULL;
+}
+
+/* Waits for each round and reports back. */
+static void *listener(ALLEGRO_THREAD *thread, void *arg)
+{
+   int last = 0;
+   (void)thread;
+   (void)arg;
+
+   al_lock_mutex(mutex);
+   while (last < ROUNDS) {
+      while (current_round == last)
+         al_wait_cond(cond, mutex);
+      last = current_round;
+      if (++seen == THREADS)
+         al_signal_cond(done_cond);
+   }
+   al_unlock_mutex(mutex);
+   return NULL;
+}
+
+static void run_threads(void *(*proc)(ALLEGRO_THREAD *, void *), void *arg,
+   int num_threads, ALLEGRO_THREAD **threads)
+{
+   int i;
+
+   for (i = 0; i < num_threads; i++) {
+      threads[i] = al_create_thread(proc, arg);
+      al_start_thread(threads[i]);
+   }
+}
+
+static void join_threads(int num_threads, ALLEGRO_THREAD **threads)
+{
+   int i;
+
+   for (i = 0; i < num_threads; i++)
+      al_destroy_thread(threads[i]);
+}
+
+/* Returns the time in seconds one run took and sets *ops to the number of
+ * operations it did.
+ */
+static double run(enum Mode mode, int *ops)
+{
+   ALLEGRO_THREAD *threads[THREADS];
+   int per_thread = LOCKS / THREADS;
+   double t0, t1;
+   int i;
+
+   counter = 0;
+   current_round = 0;
+   t0 = al_get_time();
+
+   switch (mode) {
+      case UNCONTENDED:
+      case RECURSIVE:
+         for (i = 0; i < LOCKS; i++) {
+            al_lock_mutex(mutex);
+            counter++;
+            al_unlock_mutex(mutex);
+         }
+         *ops = LOCKS;
+         break;
+
+      case CONTENDED:
+         run_threads(locker, &per_thread, THREADS, threads);
+         join_threads(THREADS, threads);
+         if (counter != LOCKS)
+            abort_example("Lost %d increments.\n", LOCKS - counter);
+         *ops = LOCKS;
+         break;
+
+      case PING_PONG:
+         run_threads(ponger, NULL, 1, threads);
+         al_lock_mutex(mutex);
+         while (current_round < 2 * ROUNDS) {
+            current_round++;
+            al_signal_cond(cond);
+            while (current_round % 2 == 1)
+               al_wait_cond(cond, mutex);
+         }
+         al_unlock_mutex(mutex);
+         join_threads(1, threads);
+         *ops = ROUNDS;
+         break;
+
+      case BROADCAST:
+         run_threads(listener, NULL, THREADS, threads);
+         al_lock_mutex(mutex);
+         while (current_round < ROUNDS) {
+            seen = 0;
+            current_round++;
+            al_broadcast_cond(cond);
+            while (seen < THREADS)
+               al_wait_cond(done_cond, mutex);
+         }
+         al_unlock_mutex(mutex);
+         join_threads(THREADS, threads);
+         *ops = ROUNDS;
+         break;
+
+      default:
+         *ops = 0;
+         break;
+   }
+
+   t1 = al_get_time();
+   return t1 - t0;
+}
+
+static void do_test(enum Mode mode)
+{
+   double t = 0;
+   int ops;
+   double total = 0;
+
+   if (mode == RECURSIVE)
+      mutex = al_create_mutex_recursive();
+   else
+      mutex = al_create_mutex();
+   cond = al_create_cond();
+   done_cond = al_create_cond();
+
+   log_printf("Benchmark: %s\n", names[mode]);
+
+   /* Warm up. */
+   run(mode, &ops);
+
+   while (t < TEST_TIME) {
+      t += run(mode, &ops);
+      total += ops;
+   }
+
+   log_printf("Time = %g s, %g operations\n", t, total);
+   log_printf("%s: %g ns per %s\n", names[mode], t * 1e9 / total,
+      (mode == PING_PONG || mode == BROADCAST) ? "round" : "lock");
+
+   al_destroy_cond(done_cond);
+   al_destroy_cond(cond);
+   al_destroy_mutex(mutex);
+}
+
+int main(int argc, char **argv)
+{
+   enum Mode mode = ALL;
+   ALLEGRO_THREAD *thread;
+
+   if (argc > 1) {
+      mode = strtol(argv[1], NULL, 10);
+      if (mode < ALL || mode > BROADCAST)
+         mode = ALL;
+   }
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro\n");
+   }
+
+   open_log();
+
+   /* Some C libraries take shortcuts while a program has only ever had one
+    * thread.  Allegro programs normally have several, so start one first.
+    */
+   thread = al_create_thread(idle, NULL);
+   al_start_thread(thread);
+   al_join_thread(thread, NULL);
+   al_destroy_thread(thread);
+
+#ifdef ALLEGRO_CFG_FUTEX
+   log_printf("Using futex mutexes and condition variables.\n");
+#else
+   log_printf("Using the platform's mutexes and condition variables.\n");
+#endif
+
+   if (mode == ALL) {
+      for (mode = UNCONTENDED; mode <= BROADCAST; mode++) {
+         do_test(mode);
+      }
+   }
+   else {
+      do_test(mode);
+   }
+
+   close_log(true);
+
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,67 @@
+/*
+ *    Example program for the Allegro library.
+ *
+ *    Runs a simulation in fixed steps with ALLEGRO_STEP_CLOCK.  Every tenth
+ *    frame takes much longer than the others, to show how the clock limits
+ *    how many steps have to be caught up with.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+
+#include "common.c"
+
+#define STEPS_PER_SEC   60
+#define MAX_STEPS       4
+#define FRAMES          40
+
+int main(int argc, char **argv)
+{
+   ALLEGRO_STEP_CLOCK *clock;
+   double position = 0, last_position = 0;
+   double alpha;
+   int steps;
+   int frame;
+   int i;
+
+   (void)argc;
+   (void)argv;
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro.\n");
+   }
+
+   open_log();
+
+   clock = al_create_step_clock(1.0 / STEPS_PER_SEC);
+   al_set_step_clock_max_steps(clock, MAX_STEPS);
+   al_start_step_clock(clock);
+
+   for (frame = 0; frame < FRAMES; frame++) {
+      /* Pretend that drawing a frame takes 10 ms, or 200 ms every tenth
+       * frame.
+       */
+      al_rest(frame % 10 == 9 ? 0.2 : 0.01);
+
+      steps = al_update_step_clock(clock, &alpha);
+      for (i = 0; i < steps; i++) {
+         last_position = position;
+         position += 1.0;
+      }
+
+      log_printf("frame %2d: %d steps, drawn at %.2f\n", frame, steps,
+         last_position + (position - last_position) * alpha);
+   }
+
+   log_printf("%d steps in total, %d dropped.\n",
+      (int)al_get_step_clock_count(clock),
+      (int)al_get_step_clock_dropped(clock));
+
+   al_destroy_step_clock(clock);
+
+   close_log(true);
+
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,96 @@
+/*
+ * Plays several files one after another through a single stream, using
+ * al_queue_audio_stream so there are no gaps between them.  All files must
+ * have the same frequency and number of channels.
+ *
+ * usage: ./ex_stream_queue file.[wav,ogg...] ...
+ */
+
+#include <stdio.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/allegro_acodec.h"
+
+#include "common.c"
+
+int main(int argc, char **argv)
+{
+   int i;
+   ALLEGRO_AUDIO_STREAM *stream;
+   ALLEGRO_EVENT_QUEUE *queue;
+   ALLEGRO_EVENT event;
+   bool playing = true;
+
+   if (!al_init()) {
+       abort_example("Could not init Allegro.\n");
+   }
+
+   open_log();
+
+   if (argc < 2) {
+      log_printf("This example needs to be run from the command line.\n");
+      log_printf("Usage: %s {audio_files}\n", argv[0]);
+      goto done;
+   }
+
+   al_init_acodec_addon();
+
+   if (!al_install_audio()) {
+      abort_example("Could not init sound!\n");
+   }
+
+   if (!al_reserve_samples(0)) {
+      abort_example("Could not set up voice and mixer.\n");
+   }
+
+   stream = al_load_audio_stream(argv[1], 4, 2048);
+   if (!stream) {
+      abort_example("Could not create an ALLEGRO_AUDIO_STREAM from '%s'!\n",
+         argv[1]);
+   }
+
+   for (i = 2; i < argc; i++) {
+      ALLEGRO_AUDIO_STREAM *next = al_load_audio_stream(argv[i], 4, 2048);
+      if (!next) {
+         log_printf("Could not create an ALLEGRO_AUDIO_STREAM from '%s'!\n",
+            argv[i]);
+         continue;
+      }
+      if (!al_queue_audio_stream(stream, next)) {
+         log_printf("Could not queue '%s', it has a different format.\n",
+            argv[i]);
+         al_destroy_audio_stream(next);
+      }
+   }
+   log_printf("%u files queued after '%s'.\n",
+      al_get_audio_stream_queue_length(stream), argv[1]);
+
+   queue = al_create_event_queue();
+   al_register_event_source(queue, al_get_audio_stream_event_source(stream));
+
+   if (!al_attach_audio_stream_to_mixer(stream, al_get_default_mixer())) {
+      abort_example("al_attach_audio_stream_to_mixer failed.\n");
+   }
+
+   log_printf("Playing...\n");
+   do {
+      al_wait_for_event(queue, &event);
+      if (event.type == ALLEGRO_EVENT_AUDIO_STREAM_QUEUED_STARTED) {
+         log_printf("Queued file %d started.\n", (int)event.user.data1);
+      }
+      if (event.type == ALLEGRO_EVENT_AUDIO_STREAM_FINISHED)
+         playing = false;
+   } while (playing);
+   log_printf("Done\n");
+
+   al_destroy_event_queue(queue);
+   al_destroy_audio_stream(stream);
+
+   al_uninstall_audio();
+done:
+   close_log(true);
+
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,210 @@
+/*
+ *    Benchmark for text drawing.
+ *
+ *    Draws screens full of text with a TTF font and a bitmap font, to the
+ *    display and to a memory bitmap, and reports how many glyphs per second
+ *    were drawn. The last two tests use a bitmap font whose glyphs are
+ *    spread over many Unicode ranges.
+ */
+
+#include <stdio.h>
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_image.h>
+#include <allegro5/allegro_ttf.h>
+#include <time.h>
+
+#include "common.c"
+
+/* See ex_blend_bench. */
+#define WARMUP 20
+#define TEST_TIME 3.0
+
+#define LINES 30
+
+/* Single glyph ranges, RANGE_STEP code points apart. */
+#define RANGES 64
+#define RANGE_STEP 0x80
+
+enum Mode {
+   ALL,
+   TTF_DISPLAY,
+   BITMAP_DISPLAY,
+   TTF_MEMORY,
+   BITMAP_MEMORY,
+   RANGES_DISPLAY,
+   RANGES_MEMORY
+};
+
+static char const *names[] = {
+   "", "TTF font to display", "Bitmap font to display",
+   "TTF font to memory bitmap", "Bitmap font to memory bitmap",
+   "Font with 64 ranges to display", "Font with 64 ranges to memory bitmap"
+};
+
+static char const *latin_text =
+   "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789";
+static ALLEGRO_USTR *text;
+
+ALLEGRO_DISPLAY *display;
+
+static int step(ALLEGRO_FONT *font)
+{
+   int i;
+
+   for (i = 0; i < LINES; i++) {
+      al_draw_ustr(font, al_map_rgb(255, 255 - i * 8, i * 8), 0,
+         i * al_get_font_line_height(font), 0, text);
+   }
+
+   return LINES * al_ustr_length(text);
+}
+
+static ALLEGRO_FONT *load_ranges_font(void)
+{
+   ALLEGRO_BITMAP *bitmap;
+   ALLEGRO_FONT *font;
+   int ranges[RANGES * 2];
+   int i;
+
+   bitmap = al_load_bitmap("data/bmpfont.tga");
+   if (!bitmap) {
+      abort_example("Error loading data/bmpfont.tga\n");
+   }
+
+   for (i = 0; i < RANGES; i++) {
+      ranges[i * 2] = ranges[i * 2 + 1] = 0x100 + i * RANGE_STEP;
+   }
+   font = al_grab_font_from_bitmap(bitmap, RANGES, ranges);
+   al_destroy_bitmap(bitmap);
+   return font;
+}
+
+/* CPU time, as in ex_blend_bench. */
+static double current_clock(void)
+{
+   clock_t c = clock();
+   return (double)c / CLOCKS_PER_SEC;
+}
+
+static void do_test(enum Mode mode)
+{
+   ALLEGRO_FONT *font;
+   ALLEGRO_BITMAP *memory = NULL;
+   int glyphs = 0;
+   int repeat;
+   double t0, t1;
+   int i;
+
+   /* The glyphs should be in the same kind of bitmap as the target. */
+   if (mode == TTF_MEMORY || mode == BITMAP_MEMORY || mode == RANGES_MEMORY) {
+      al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+      memory = al_create_bitmap(640, 480);
+      al_set_target_bitmap(memory);
+   }
+   else {
+      al_set_new_bitmap_flags(ALLEGRO_VIDEO_BITMAP);
+      al_set_target_backbuffer(display);
+   }
+
+   text = al_ustr_new(latin_text);
+   if (mode == TTF_DISPLAY || mode == TTF_MEMORY) {
+      font = al_load_font("data/DejaVuSans.ttf", 14, 0);
+      if (!font) {
+         abort_example("Error loading data/DejaVuSans.ttf\n");
+      }
+   }
+   else if (mode == RANGES_DISPLAY || mode == RANGES_MEMORY) {
+      font = load_ranges_font();
+      if (!font) {
+         abort_example("Error creating a font with %d ranges\n", RANGES);
+      }
+      /* Use the glyphs of all ranges, starting with the last. */
+      al_ustr_truncate(text, 0);
+      for (i = 0; i < 54; i++) {
+         al_ustr_append_chr(text, 0x100 + (RANGES - 1 - i % RANGES) *
+            RANGE_STEP);
+      }
+   }
+   else {
+      font = al_load_font("data/bmpfont.tga", 0, 0);
+      if (!font) {
+         abort_example("Error loading data/bmpfont.tga\n");
+      }
+   }
+
+   log_printf("Benchmark: %s\n", names[mode]);
+
+   /* Do warmup run and estimate required runs for real test. */
+   t0 = current_clock();
+   for (i = 0; i < WARMUP; i++) {
+      al_clear_to_color(al_map_rgb(0, 0, 0));
+      step(font);
+   }
+   t1 = current_clock();
+   repeat = TEST_TIME * WARMUP / (t1 - t0 > 0.001 ? t1 - t0 : 0.001);
+
+   /* Do the real test. */
+   t0 = current_clock();
+   for (i = 0; i < repeat; i++) {
+      al_clear_to_color(al_map_rgb(0, 0, 0));
+      glyphs += step(font);
+   }
+   t1 = current_clock();
+
+   if (memory) {
+      al_set_target_backbuffer(display);
+      al_draw_bitmap(memory, 0, 0, 0);
+      al_destroy_bitmap(memory);
+   }
+   al_flip_display();
+   al_destroy_font(font);
+   al_ustr_free(text);
+
+   log_printf("Time = %g s, %d screens\n", t1 - t0, repeat);
+   log_printf("%s: %g glyphs per second\n", names[mode], glyphs / (t1 - t0));
+}
+
+int main(int argc, char **argv)
+{
+   enum Mode mode = ALL;
+
+   if (argc > 1) {
+      mode = strtol(argv[1], NULL, 10);
+      if (mode < ALL || mode > RANGES_MEMORY)
+         mode = ALL;
+   }
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro\n");
+   }
+
+   open_log();
+
+   al_init_image_addon();
+   al_init_font_addon();
+   al_init_ttf_addon();
+   init_platform_specific();
+
+   display = al_create_display(640, 480);
+   if (!display) {
+      abort_example("Error creating display\n");
+   }
+
+   if (mode == ALL) {
+      for (mode = TTF_DISPLAY; mode <= RANGES_MEMORY; mode++) {
+         do_test(mode);
+      }
+   }
+   else {
+      do_test(mode);
+   }
+
+   al_destroy_display(display);
+
+   close_log(true);
+
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
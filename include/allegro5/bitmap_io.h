@@ -14,7 +14,11 @@
 enum {
    ALLEGRO_KEEP_BITMAP_FORMAT       = 0x0002,   /* was a bitmap flag in 5.0 */
    ALLEGRO_NO_PREMULTIPLIED_ALPHA   = 0x0200,   /* was a bitmap flag in 5.0 */
-   ALLEGRO_KEEP_INDEX               = 0x0800
+   ALLEGRO_KEEP_INDEX               = 0x0800,
+   ALLEGRO_LOAD_FAST_DECODE         = 0x2000,
+   ALLEGRO_LOAD_SCALE_1_2           = 0x4000,
+   ALLEGRO_LOAD_SCALE_1_4           = 0x8000,
+   ALLEGRO_LOAD_SCALE_1_8           = 0x10000
 };
 
 typedef ALLEGRO_BITMAP *(*ALLEGRO_IIO_LOADER_FUNCTION)(const char *filename, int flags);
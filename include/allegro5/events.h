@@ -187,6 +187,9 @@ typedef struct ALLEGRO_TOUCH_EVENT
  */
 typedef struct ALLEGRO_USER_EVENT ALLEGRO_USER_EVENT;
 
+/* Maximum size of the data passed to al_emit_user_event_with_data. */
+#define ALLEGRO_USER_EVENT_DATA_SIZE   64
+
 struct ALLEGRO_USER_EVENT
 {
    _AL_EVENT_HEADER(struct ALLEGRO_EVENT_SOURCE)
@@ -232,6 +235,11 @@ AL_FUNC(void, al_destroy_user_event_source, (ALLEGRO_EVENT_SOURCE *));
  */
 AL_FUNC(bool, al_emit_user_event, (ALLEGRO_EVENT_SOURCE *, ALLEGRO_EVENT *,
                                    void (*dtor)(ALLEGRO_USER_EVENT *)));
+AL_FUNC(bool, al_emit_user_event_with_data, (ALLEGRO_EVENT_SOURCE *,
+                                   ALLEGRO_EVENT *, const void *data,
+                                   size_t size));
+AL_FUNC(const void *, al_get_user_event_data, (const ALLEGRO_USER_EVENT *,
+                                   size_t *size));
 AL_FUNC(void, al_unref_user_event, (ALLEGRO_USER_EVENT *));
 AL_FUNC(void, al_set_event_source_data, (ALLEGRO_EVENT_SOURCE*, intptr_t data));
 AL_FUNC(intptr_t, al_get_event_source_data, (const ALLEGRO_EVENT_SOURCE*));
@@ -244,13 +252,50 @@ AL_FUNC(intptr_t, al_get_event_source_data, (const ALLEGRO_EVENT_SOURCE*));
  */
 typedef struct ALLEGRO_EVENT_QUEUE ALLEGRO_EVENT_QUEUE;
 
+/*
+ * Event queue flags
+ */
+enum {
+   ALLEGRO_EVENT_QUEUE_LOCK_FREE              = 0x0001,
+   ALLEGRO_EVENT_QUEUE_COALESCE_MOUSE_AXES    = 0x0002,
+   ALLEGRO_EVENT_QUEUE_COALESCE_JOYSTICK_AXES = 0x0004,
+   ALLEGRO_EVENT_QUEUE_COALESCE_TOUCH_MOVES   = 0x0008,
+   ALLEGRO_EVENT_QUEUE_STATISTICS             = 0x0010
+};
+
+/* Number of buckets in ALLEGRO_EVENT_QUEUE_STATS.latency_histogram. */
+#define ALLEGRO_EVENT_QUEUE_LATENCY_BUCKETS  24
+
+/* Type: ALLEGRO_EVENT_QUEUE_STATS
+ */
+typedef struct ALLEGRO_EVENT_QUEUE_STATS ALLEGRO_EVENT_QUEUE_STATS;
+
+struct ALLEGRO_EVENT_QUEUE_STATS
+{
+   int depth;
+   int max_depth;
+   int expansions;
+   int64_t events_pushed;
+   int64_t events_taken;
+   double total_latency;
+   double max_latency;
+   int64_t latency_histogram[ALLEGRO_EVENT_QUEUE_LATENCY_BUCKETS];
+};
+
 AL_FUNC(ALLEGRO_EVENT_QUEUE*, al_create_event_queue, (void));
+AL_FUNC(ALLEGRO_EVENT_QUEUE*, al_create_event_queue_flags, (int flags));
 AL_FUNC(void, al_destroy_event_queue, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(void, al_register_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*));
 AL_FUNC(void, al_unregister_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*));
 AL_FUNC(void, al_pause_event_queue, (ALLEGRO_EVENT_QUEUE*, bool));
 AL_FUNC(bool, al_is_event_queue_paused, (const ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(bool, al_is_event_queue_empty, (ALLEGRO_EVENT_QUEUE*));
+AL_FUNC(int, al_get_event_queue_coalesced_count, (ALLEGRO_EVENT_QUEUE*, int flags));
+AL_FUNC(bool, al_get_event_queue_stats, (ALLEGRO_EVENT_QUEUE*,
+                                         ALLEGRO_EVENT_QUEUE_STATS *stats));
+AL_FUNC(int64_t, al_get_event_queue_source_count, (ALLEGRO_EVENT_QUEUE*,
+                                         ALLEGRO_EVENT_SOURCE *source));
+AL_FUNC(void, al_reset_event_queue_stats, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(bool, al_get_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
 AL_FUNC(bool, al_peek_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
 AL_FUNC(bool, al_drop_next_event, (ALLEGRO_EVENT_QUEUE*));
@@ -263,6 +308,15 @@ AL_FUNC(bool, al_wait_for_event_timed, (ALLEGRO_EVENT_QUEUE*,
 AL_FUNC(bool, al_wait_for_event_until, (ALLEGRO_EVENT_QUEUE *queue,
                                         ALLEGRO_EVENT *ret_event,
                                         ALLEGRO_TIMEOUT *timeout));
+AL_FUNC(int, al_get_next_events, (ALLEGRO_EVENT_QUEUE*,
+                                  ALLEGRO_EVENT *ret_events,
+                                  int max_events));
+AL_FUNC(int, al_wait_for_events, (ALLEGRO_EVENT_QUEUE*,
+                                  ALLEGRO_EVENT *ret_events,
+                                  int max_events));
+AL_FUNC(int, al_wait_for_events_timed, (ALLEGRO_EVENT_QUEUE*,
+                                        ALLEGRO_EVENT *ret_events,
+                                        int max_events, float secs));
 
 #ifdef __cplusplus
    }
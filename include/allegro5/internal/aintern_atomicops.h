@@ -19,6 +19,54 @@
       return __sync_sub_and_fetch(ptr, 1);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return __sync_bool_compare_and_swap(ptr, old_value, new_value);
+   })
+
+   AL_INLINE(void,
+      _al_memory_barrier, (void),
+   {
+      __sync_synchronize();
+   })
+
+   #if defined(__ATOMIC_ACQUIRE)
+
+   /* gcc 4.7 and above can do without a full barrier here. */
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+   })
+
+   #else
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      __sync_synchronize();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __sync_synchronize();
+      *ptr = value;
+   })
+
+   #endif
+
 #elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
    /* gcc, x86 or x86-64 */
@@ -49,11 +97,55 @@
       return old - 1;
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      _AL_ATOMIC prev;
+      __asm__ __volatile__ (
+         "lock; cmpxchgl %2, %1"
+         : "=a" (prev), "+m" (*ptr)
+         : "r" (new_value), "0" (old_value)
+         : "memory"
+      );
+      return prev == old_value;
+   })
+
+   /* A locked instruction is a full barrier, and unlike mfence it works
+    * on CPUs without SSE2.
+    */
+   AL_INLINE(void,
+      _al_memory_barrier, (void),
+   {
+      int dummy = 0;
+      __asm__ __volatile__ ("lock; orl $0, %0" : "+m" (dummy) : : "memory");
+   })
+
+   /* x86 does not reorder loads with loads or stores with stores, so these
+    * only need to stop the compiler from doing it.
+    */
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __asm__ __volatile__ ("" : : : "memory");
+      *ptr = value;
+   })
+
 #elif defined(_MSC_VER) && _M_IX86 >= 400
 
    /* MSVC, x86 */
    /* MinGW supports these too, but we already have asm code above. */
 
+   #include <windows.h>
+
    typedef LONG _AL_ATOMIC;
 
    AL_INLINE(_AL_ATOMIC,
@@ -68,6 +160,34 @@
       return InterlockedDecrement(ptr);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return InterlockedCompareExchange(ptr, new_value, old_value) == old_value;
+   })
+
+   AL_INLINE(void,
+      _al_memory_barrier, (void),
+   {
+      MemoryBarrier();
+   })
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      _al_memory_barrier();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      _al_memory_barrier();
+      *ptr = value;
+   })
+
 #elif defined(ALLEGRO_HAVE_OSATOMIC_H)
 
    /* OS X, GCC < 4.1
@@ -93,6 +213,35 @@
       return OSAtomicDecrement32Barrier((_AL_ATOMIC *)ptr);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return OSAtomicCompareAndSwap32Barrier(old_value, new_value,
+         (_AL_ATOMIC *)ptr);
+   })
+
+   AL_INLINE(void,
+      _al_memory_barrier, (void),
+   {
+      OSMemoryBarrier();
+   })
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      _al_memory_barrier();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      _al_memory_barrier();
+      *ptr = value;
+   })
+
 
 #else
 
@@ -113,6 +262,33 @@
       return --(*ptr);
    })
 
+   AL_INLINE(bool,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      if (*ptr != old_value)
+         return false;
+      *ptr = new_value;
+      return true;
+   })
+
+   AL_INLINE(void,
+      _al_memory_barrier, (void),
+   {
+   })
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_load_acquire, (volatile _AL_ATOMIC *ptr),
+   {
+      return *ptr;
+   })
+
+   AL_INLINE(void,
+      _al_store_release, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      *ptr = value;
+   })
+
 #endif
 
 #endif
@@ -135,6 +135,8 @@ ALLEGRO_BITMAP *_al_create_bitmap_params(ALLEGRO_DISPLAY *current_display,
    int w, int h, int format, int flags);
 
 AL_FUNC(ALLEGRO_DISPLAY*, _al_get_bitmap_display, (ALLEGRO_BITMAP *bitmap));
+AL_FUNC(void, _al_draw_tinted_bitmap_regions, (ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, const float *regions, int count));
 
 extern void (*_al_convert_funcs[ALLEGRO_NUM_PIXEL_FORMATS]
    [ALLEGRO_NUM_PIXEL_FORMATS])(const void *, int, void *, int,
@@ -1,6 +1,7 @@
 #ifndef __al_included_allegro5_aintern_events_h
 #define __al_included_allegro5_aintern_events_h
 
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_vector.h"
 
@@ -21,7 +22,16 @@ struct ALLEGRO_EVENT_SOURCE_REAL
 typedef struct ALLEGRO_USER_EVENT_DESCRIPTOR
 {
    void (*dtor)(ALLEGRO_USER_EVENT *event);
-   int refcount;
+   volatile _AL_ATOMIC refcount;
+   int pool_index;         /* -1 if allocated with al_malloc */
+   int next_free;          /* pool index of the next free descriptor */
+   size_t data_size;
+   union {
+      char bytes[ALLEGRO_USER_EVENT_DATA_SIZE];
+      double align_double;
+      int64_t align_int64;
+      void *align_pointer;
+   } data;
 } ALLEGRO_USER_EVENT_DESCRIPTOR;
 
 
@@ -38,6 +48,9 @@ void _al_event_source_emit_event(ALLEGRO_EVENT_SOURCE *, ALLEGRO_EVENT*);
 
 void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE*, const ALLEGRO_EVENT*);
 
+ALLEGRO_USER_EVENT_DESCRIPTOR *_al_create_user_event_descriptor(
+   void (*dtor)(ALLEGRO_USER_EVENT *));
+
 
 #ifdef __cplusplus
    }
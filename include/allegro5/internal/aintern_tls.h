@@ -9,6 +9,7 @@
 void _al_tls_init_once(void);
 
 int *_al_tls_get_dtor_owner_count(void);
+int *_al_tls_get_job_worker(void);
 
 
 #ifdef __cplusplus
@@ -6,6 +6,9 @@
 
 #include <pthread.h>
 #include "allegro5/internal/aintern_thread.h"
+#ifdef ALLEGRO_CFG_FUTEX
+   #include "allegro5/internal/aintern_atomicops.h"
+#endif
 
 #ifdef __cplusplus
    extern "C" {
@@ -23,6 +26,38 @@ struct _AL_THREAD
    void *arg;
 };
 
+#ifdef ALLEGRO_CFG_FUTEX
+
+/* The mutex state is 0 when unlocked, 1 when locked and 2 when locked
+ * and other threads may be sleeping on it.  A recursive mutex also
+ * remembers its owner, which is only ever compared against the calling
+ * thread.
+ */
+struct _AL_MUTEX
+{
+   bool inited;
+   bool recursive;
+   volatile _AL_ATOMIC state;
+   pthread_t owner;
+   int count;
+};
+
+#define _AL_MUTEX_UNINITED	       { false, false, 0, 0, 0 }
+#define _AL_MARK_MUTEX_UNINITED(M)     do { M.inited = false; } while (0)
+
+/* seq changes with every signal and broadcast, waiters sleep on it.
+ * mutex is the mutex last used with the condition variable, waiters
+ * woken by a broadcast are moved over to it.
+ */
+struct _AL_COND
+{
+   volatile _AL_ATOMIC seq;
+   volatile _AL_ATOMIC waiters;
+   struct _AL_MUTEX *mutex;
+};
+
+#else
+
 struct _AL_MUTEX
 {
    bool inited;
@@ -38,6 +73,8 @@ struct _AL_COND
    pthread_cond_t cond;
 };
 
+#endif
+
 typedef struct ALLEGRO_TIMEOUT_UNIX ALLEGRO_TIMEOUT_UNIX;
 struct ALLEGRO_TIMEOUT_UNIX
 {
@@ -57,6 +94,66 @@ AL_INLINE(bool, _al_get_thread_should_stop, (struct _AL_THREAD *t),
 
 AL_FUNC(void, _al_mutex_init, (struct _AL_MUTEX*));
 AL_FUNC(void, _al_mutex_destroy, (struct _AL_MUTEX*));
+
+#ifdef ALLEGRO_CFG_FUTEX
+
+AL_FUNC(void, _al_mutex_lock_contended, (struct _AL_MUTEX *m));
+AL_FUNC(void, _al_mutex_wake, (struct _AL_MUTEX *m));
+AL_FUNC(void, _al_mutex_lock_recursive, (struct _AL_MUTEX *m));
+AL_FUNC(void, _al_mutex_unlock_recursive, (struct _AL_MUTEX *m));
+
+AL_INLINE(void, _al_mutex_lock, (struct _AL_MUTEX *m),
+{
+   if (m->inited) {
+      if (m->recursive)
+         _al_mutex_lock_recursive(m);
+      else if (!_al_compare_and_swap(&m->state, 0, 1))
+         _al_mutex_lock_contended(m);
+   }
+})
+AL_INLINE(void, _al_mutex_unlock, (struct _AL_MUTEX *m),
+{
+   if (m->inited) {
+      if (m->recursive)
+         _al_mutex_unlock_recursive(m);
+      else if (_al_sub1_and_fetch(&m->state) != 0)
+         _al_mutex_wake(m);
+   }
+})
+
+AL_FUNC(void, _al_cond_wait, (struct _AL_COND *cond, struct _AL_MUTEX *mutex));
+AL_FUNC(void, _al_cond_wake, (struct _AL_COND *cond, bool all));
+
+AL_INLINE(void, _al_cond_init, (struct _AL_COND *cond),
+{
+   cond->seq = 0;
+   cond->waiters = 0;
+   cond->mutex = NULL;
+})
+
+AL_INLINE(void, _al_cond_destroy, (struct _AL_COND *cond),
+{
+   /* Nothing to free. */
+   (void)cond;
+})
+
+/* A waiter increments waiters before it releases the mutex, so with
+ * nobody waiting there is nothing to do.
+ */
+AL_INLINE(void, _al_cond_broadcast, (struct _AL_COND *cond),
+{
+   if (_al_load_acquire(&cond->waiters) > 0)
+      _al_cond_wake(cond, true);
+})
+
+AL_INLINE(void, _al_cond_signal, (struct _AL_COND *cond),
+{
+   if (_al_load_acquire(&cond->waiters) > 0)
+      _al_cond_wake(cond, false);
+})
+
+#else
+
 AL_INLINE(void, _al_mutex_lock, (struct _AL_MUTEX *m),
 {
    if (m->inited)
@@ -93,6 +190,8 @@ AL_INLINE(void, _al_cond_signal, (struct _AL_COND *cond),
    pthread_cond_signal(&cond->cond);
 })
 
+#endif
+
 
 #ifdef __cplusplus
    }
@@ -10,6 +10,7 @@
 #cmakedefine ALLEGRO_CFG_NO_FPU
 #cmakedefine ALLEGRO_CFG_DLL_TLS
 #cmakedefine ALLEGRO_CFG_PTHREADS_TLS
+#cmakedefine ALLEGRO_CFG_FUTEX
 #cmakedefine ALLEGRO_CFG_RELEASE_LOGGING
 
 #cmakedefine ALLEGRO_CFG_D3D
@@ -48,6 +49,9 @@
 #cmakedefine ALLEGRO_HAVE_SYS_TYPES_H
 #cmakedefine ALLEGRO_HAVE_OSATOMIC_H
 #cmakedefine ALLEGRO_HAVE_SYS_INOTIFY_H
+#cmakedefine ALLEGRO_HAVE_SYS_EPOLL_H
+#cmakedefine ALLEGRO_HAVE_SYS_EVENTFD_H
+#cmakedefine ALLEGRO_HAVE_LINUX_FUTEX_H
 #cmakedefine ALLEGRO_HAVE_SAL_H
 
 /* Define to 1 if the corresponding functions are available. */
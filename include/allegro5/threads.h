@@ -34,6 +34,10 @@ typedef struct ALLEGRO_MUTEX ALLEGRO_MUTEX;
  */
 typedef struct ALLEGRO_COND ALLEGRO_COND;
 
+/* Type: ALLEGRO_JOB_COUNTER
+ */
+typedef struct ALLEGRO_JOB_COUNTER ALLEGRO_JOB_COUNTER;
+
 
 AL_FUNC(ALLEGRO_THREAD *, al_create_thread,
    (void *(*proc)(ALLEGRO_THREAD *thread, void *arg), void *arg));
@@ -58,6 +62,18 @@ AL_FUNC(int, al_wait_cond_until, (ALLEGRO_COND *cond, ALLEGRO_MUTEX *mutex,
 AL_FUNC(void, al_broadcast_cond, (ALLEGRO_COND *cond));
 AL_FUNC(void, al_signal_cond, (ALLEGRO_COND *cond));
 
+AL_FUNC(ALLEGRO_JOB_COUNTER *, al_create_job_counter, (void));
+AL_FUNC(void, al_destroy_job_counter, (ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(int, al_get_job_counter_value, (ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(void, al_run_job, (void (*proc)(void *arg), void *arg,
+                    ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(void, al_run_job_after, (ALLEGRO_JOB_COUNTER *after,
+                    void (*proc)(void *arg), void *arg,
+                    ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(void, al_wait_for_job_counter, (ALLEGRO_JOB_COUNTER *counter));
+AL_FUNC(void, al_parallel_for, (int begin, int end, int grain,
+                    void (*proc)(int begin, int end, void *arg), void *arg));
+
 #ifdef __cplusplus
    }
 #endif
@@ -55,9 +55,28 @@ AL_FUNC(void, al_set_timer_speed, (ALLEGRO_TIMER *timer, double speed_secs));
 AL_FUNC(int64_t, al_get_timer_count, (const ALLEGRO_TIMER *timer));
 AL_FUNC(void, al_set_timer_count, (ALLEGRO_TIMER *timer, int64_t count));
 AL_FUNC(void, al_add_timer_count, (ALLEGRO_TIMER *timer, int64_t diff));
+AL_FUNC(void, al_get_timer_jitter, (ALLEGRO_TIMER *timer, double *mean, double *deviation, double *max));
 AL_FUNC(ALLEGRO_EVENT_SOURCE *, al_get_timer_event_source, (ALLEGRO_TIMER *timer));
 
 
+/* Type: ALLEGRO_STEP_CLOCK
+ */
+typedef struct ALLEGRO_STEP_CLOCK ALLEGRO_STEP_CLOCK;
+
+
+AL_FUNC(ALLEGRO_STEP_CLOCK*, al_create_step_clock, (double step_secs));
+AL_FUNC(void, al_destroy_step_clock, (ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(void, al_start_step_clock, (ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(void, al_stop_step_clock, (ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(bool, al_get_step_clock_started, (const ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(double, al_get_step_clock_speed, (const ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(void, al_set_step_clock_max_steps, (ALLEGRO_STEP_CLOCK *clock, int max_steps));
+AL_FUNC(int, al_get_step_clock_max_steps, (const ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(int64_t, al_get_step_clock_count, (const ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(int64_t, al_get_step_clock_dropped, (const ALLEGRO_STEP_CLOCK *clock));
+AL_FUNC(int, al_update_step_clock, (ALLEGRO_STEP_CLOCK *clock, double *alpha));
+
+
 #ifdef __cplusplus
    }
 #endif
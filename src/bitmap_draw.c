@@ -132,6 +132,100 @@ void al_draw_tinted_bitmap_region(ALLEGRO_BITMAP *bitmap,
 }
 
 
+/* Internal function: _al_draw_tinted_bitmap_regions
+ *  Draws many regions of the same bitmap with the same tint.  The regions
+ *  are given as six floats each: sx, sy, sw, sh, dx, dy.  The result is the
+ *  same as calling al_draw_tinted_bitmap_region for each one, but choosing
+ *  how to draw and setting up the transformation happens only once.  The
+ *  regions must lie within the bitmap.  Used by the font addons.
+ */
+void _al_draw_tinted_bitmap_regions(ALLEGRO_BITMAP *bitmap,
+   ALLEGRO_COLOR tint, const float *regions, int count)
+{
+   ALLEGRO_BITMAP *dest = al_get_target_bitmap();
+   ALLEGRO_DISPLAY *display = _al_get_bitmap_display(dest);
+   ALLEGRO_BITMAP *parent = bitmap;
+   ALLEGRO_TRANSFORM backup;
+   ALLEGRO_TRANSFORM *t = &dest->transform;
+   float xofs = 0, yofs = 0;
+   enum { MEMORY, MEMORY_SOURCE, ACCELERATED } how;
+   bool held;
+   int i;
+   ASSERT(bitmap);
+
+   if (count <= 0)
+      return;
+
+   if (bitmap->parent) {
+      parent = bitmap->parent;
+      xofs = bitmap->xofs;
+      yofs = bitmap->yofs;
+   }
+   ASSERT(parent != dest && parent != dest->parent);
+
+   /* The same decisions as in _bitmap_drawer. */
+   if (al_get_bitmap_flags(dest) & ALLEGRO_MEMORY_BITMAP ||
+       _al_pixel_format_is_compressed(al_get_bitmap_format(dest))) {
+      how = MEMORY;
+   }
+   else if ((al_get_bitmap_flags(parent) & ALLEGRO_MEMORY_BITMAP) ||
+       (!al_is_compatible_bitmap(parent))) {
+      if (display && display->vt->draw_memory_bitmap_region)
+         how = MEMORY_SOURCE;
+      else
+         how = MEMORY;
+   }
+   else {
+      how = ACCELERATED;
+   }
+
+   /* While drawing is held, the drivers apply the transformation to each
+    * quad themselves, so it can be changed without calling into them.
+    */
+   held = al_is_bitmap_drawing_held();
+   if (how == ACCELERATED && !held)
+      al_hold_bitmap_drawing(true);
+
+   al_copy_transform(&backup, t);
+
+   for (i = 0; i < count; i++) {
+      const float *r = regions + i * 6;
+      float dx = r[4];
+      float dy = r[5];
+      ASSERT(r[0] >= 0 && r[1] >= 0);
+      ASSERT(r[0] + r[2] <= bitmap->w && r[1] + r[3] <= bitmap->h);
+
+      /* Same as composing a translation by (dx, dy) with the backup. */
+      t->m[3][0] = backup.m[3][0] + dx * backup.m[0][0] + dy * backup.m[1][0];
+      t->m[3][1] = backup.m[3][1] + dx * backup.m[0][1] + dy * backup.m[1][1];
+      t->m[3][2] = backup.m[3][2] + dx * backup.m[0][2] + dy * backup.m[1][2];
+      t->m[3][3] = backup.m[3][3] + dx * backup.m[0][3] + dy * backup.m[1][3];
+
+      switch (how) {
+         case MEMORY:
+            _al_draw_bitmap_region_memory(parent, tint,
+               r[0] + xofs, r[1] + yofs, r[2], r[3], 0, 0, 0);
+            break;
+         case MEMORY_SOURCE:
+            if (!held)
+               display->vt->update_transformation(display, dest);
+            display->vt->draw_memory_bitmap_region(display, parent,
+               r[0] + xofs, r[1] + yofs, r[2], r[3], 0);
+            break;
+         case ACCELERATED:
+            parent->vt->draw_bitmap_region(parent, tint,
+               r[0] + xofs, r[1] + yofs, r[2], r[3], 0);
+            break;
+      }
+   }
+
+   al_use_transform(&backup);
+
+   if (how == ACCELERATED && !held)
+      al_hold_bitmap_drawing(false);
+}
+
+
 /* Function: al_draw_tinted_bitmap
  */
 void al_draw_tinted_bitmap(ALLEGRO_BITMAP *bitmap, ALLEGRO_COLOR tint,
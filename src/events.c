@@ -22,10 +22,12 @@
  */
 
 
+#include <limits.h>
 #include <string.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_events.h"
@@ -33,6 +35,39 @@
 
 
 
+/* Number of events in the ring of a lock-free queue, a power of two. */
+#define RING_SIZE 256
+
+
+/* A slot of the ring of a lock-free queue.  The slot for position pos in
+ * the ring can be written when seq == pos, and read when seq == pos + 1.
+ */
+typedef struct EVENT_CELL
+{
+   volatile _AL_ATOMIC seq;
+   ALLEGRO_EVENT event;
+} EVENT_CELL;
+
+
+/* Number of events a queue got from one of its sources. */
+typedef struct SOURCE_COUNT
+{
+   const ALLEGRO_EVENT_SOURCE *source;
+   int64_t count;
+} SOURCE_COUNT;
+
+
+/* Statistics of a queue created with ALLEGRO_EVENT_QUEUE_STATISTICS.
+ * Everything is updated with the queue locked.
+ */
+typedef struct QUEUE_STATS
+{
+   ALLEGRO_EVENT_QUEUE_STATS info;  /* depth is filled in when read */
+   _AL_VECTOR source_counts;        /* vector of SOURCE_COUNT */
+   unsigned int last_source;        /* where the last lookup succeeded */
+} QUEUE_STATS;
+
+
 struct ALLEGRO_EVENT_QUEUE
 {
    _AL_VECTOR sources;  /* vector of (ALLEGRO_EVENT_SOURCE *) */
@@ -40,26 +75,65 @@ struct ALLEGRO_EVENT_QUEUE
    unsigned int events_head;  /* write end of circular array */
    unsigned int events_tail;  /* read end of circular array */
    bool paused;
+   int flags;
    _AL_MUTEX mutex;
    _AL_COND cond;
+   volatile _AL_ATOMIC waiters;  /* threads waiting on cond */
+
+   /* Number of events merged into the previous one, see coalesce_event. */
+   int coalesced_mouse;
+   int coalesced_joystick;
+   int coalesced_touch;
+
+   /* With ALLEGRO_EVENT_QUEUE_LOCK_FREE, event sources put their events
+    * into this ring without taking the mutex.  Whoever holds the mutex moves
+    * them into the circular array, so there is only ever one reader.
+    */
+   EVENT_CELL *ring;          /* [RING_SIZE], or NULL */
+   volatile _AL_ATOMIC ring_head;  /* next position to write */
+   unsigned int ring_tail;    /* next position to read */
+
+   QUEUE_STATS *stats;        /* with ALLEGRO_EVENT_QUEUE_STATISTICS */
 };
 
 
 
-/* to prevent concurrent modification of user event reference counts */
-static _AL_MUTEX user_event_refcount_mutex = _AL_MUTEX_UNINITED;
+/* Descriptors of reference counted user events come from this pool, so
+ * emitting them doesn't need to allocate.  The free descriptors form a
+ * stack linked through their pool indices, guarded by
+ * user_event_pool_mutex, which is only held for a few instructions.  The
+ * pool grows in chunks, which are only freed on shutdown.  Beyond
+ * USER_EVENT_POOL_MAX_CHUNKS descriptors are allocated one by one.
+ */
+#define USER_EVENT_POOL_CHUNK_SIZE  1024
+#define USER_EVENT_POOL_MAX_CHUNKS  32
+#define USER_EVENT_POOL_NONE        -1
+
+static _AL_MUTEX user_event_pool_mutex = _AL_MUTEX_UNINITED;
+static ALLEGRO_USER_EVENT_DESCRIPTOR *
+   user_event_pool_chunks[USER_EVENT_POOL_MAX_CHUNKS];
+static int user_event_pool_num_chunks = 0;
+static int user_event_pool_head = USER_EVENT_POOL_NONE;
 
 
 
 /* forward declarations */
 static void shutdown_events(void);
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
-   ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout);
+   ALLEGRO_EVENT *ret_events, int max_events, int *num_events,
+   ALLEGRO_TIMEOUT *timeout);
 static void copy_event(ALLEGRO_EVENT *dest, const ALLEGRO_EVENT *src);
+static ALLEGRO_EVENT *alloc_event(ALLEGRO_EVENT_QUEUE *queue);
 static void ref_if_user_event(ALLEGRO_EVENT *event);
 static void unref_if_user_event(ALLEGRO_EVENT *event);
 static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
    const ALLEGRO_EVENT_SOURCE *source);
+static void forget_source_count(QUEUE_STATS *stats,
+   const ALLEGRO_EVENT_SOURCE *source);
+static void record_push(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event);
+static void record_taken(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *events, int n);
 
 
 
@@ -68,7 +142,7 @@ static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
  */
 void _al_init_events(void)
 {
-   _al_mutex_init(&user_event_refcount_mutex);
+   _al_mutex_init(&user_event_pool_mutex);
    _al_add_exit_func(shutdown_events, "shutdown_events");
 }
 
@@ -79,7 +153,16 @@ void _al_init_events(void)
  */
 static void shutdown_events(void)
 {
-   _al_mutex_destroy(&user_event_refcount_mutex);
+   int i;
+
+   for (i = 0; i < user_event_pool_num_chunks; i++) {
+      al_free(user_event_pool_chunks[i]);
+      user_event_pool_chunks[i] = NULL;
+   }
+   user_event_pool_num_chunks = 0;
+   user_event_pool_head = USER_EVENT_POOL_NONE;
+
+   _al_mutex_destroy(&user_event_pool_mutex);
 }
 
 
@@ -87,6 +170,15 @@ static void shutdown_events(void)
 /* Function: al_create_event_queue
  */
 ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
+{
+   return al_create_event_queue_flags(0);
+}
+
+
+
+/* Function: al_create_event_queue_flags
+ */
+ALLEGRO_EVENT_QUEUE *al_create_event_queue_flags(int flags)
 {
    ALLEGRO_EVENT_QUEUE *queue = al_malloc(sizeof *queue);
 
@@ -100,6 +192,32 @@ ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
       queue->events_head = 0;
       queue->events_tail = 0;
       queue->paused = false;
+      queue->flags = flags;
+      queue->waiters = 0;
+      queue->coalesced_mouse = 0;
+      queue->coalesced_joystick = 0;
+      queue->coalesced_touch = 0;
+
+      queue->stats = NULL;
+      if (flags & ALLEGRO_EVENT_QUEUE_STATISTICS) {
+         /* Without memory the queue works, just without statistics. */
+         queue->stats = al_calloc(1, sizeof(QUEUE_STATS));
+         if (queue->stats)
+            _al_vector_init(&queue->stats->source_counts,
+               sizeof(SOURCE_COUNT));
+      }
+
+      queue->ring = NULL;
+      queue->ring_head = 0;
+      queue->ring_tail = 0;
+      if (flags & ALLEGRO_EVENT_QUEUE_LOCK_FREE) {
+         int i;
+         queue->ring = al_malloc(RING_SIZE * sizeof(EVENT_CELL));
+         if (queue->ring) {
+            for (i = 0; i < RING_SIZE; i++)
+               queue->ring[i].seq = i;
+         }
+      }
 
       _AL_MARK_MUTEX_UNINITED(queue->mutex);
       _al_mutex_init(&queue->mutex);
@@ -133,6 +251,11 @@ void al_destroy_event_queue(ALLEGRO_EVENT_QUEUE *queue)
 
    ASSERT(queue->events_head == queue->events_tail);
    _al_vector_free(&queue->events);
+   al_free(queue->ring);
+   if (queue->stats) {
+      _al_vector_free(&queue->stats->source_counts);
+      al_free(queue->stats);
+   }
 
    _al_cond_destroy(&queue->cond);
    _al_mutex_destroy(&queue->mutex);
@@ -183,6 +306,8 @@ void al_unregister_event_source(ALLEGRO_EVENT_QUEUE *queue,
       /* Drop all the events in the queue that belonged to the source. */
       _al_mutex_lock(&queue->mutex);
       discard_events_of_source(queue, source);
+      if (queue->stats)
+         forget_source_count(queue->stats, source);
       _al_mutex_unlock(&queue->mutex);
    }
 }
@@ -229,25 +354,446 @@ static bool is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
 
 
 
-/* Function: al_is_event_queue_empty
+/* circ_array_next:
+ *  Return the next index in a circular array.
  */
-bool al_is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
+static unsigned int circ_array_next(const _AL_VECTOR *vector, unsigned int i)
+{
+   return (i + 1) % _al_vector_size(vector);
+}
+
+
+
+/* circ_array_prev:
+ *  Return the previous index in a circular array.
+ */
+static unsigned int circ_array_prev(const _AL_VECTOR *vector, unsigned int i)
+{
+   if (i == 0)
+      i = _al_vector_size(vector);
+   return i - 1;
+}
+
+
+
+/* find_joystick_axis_event:
+ *  Look back through the axis events of the same joystick at the end of
+ *  the queue for one of the same axis as the new event.  A joystick reports
+ *  its axes one after another, so the event pushed last is usually of
+ *  another axis.  Any other event stops the search, so nothing is moved
+ *  past it.
+ */
+static ALLEGRO_EVENT *find_joystick_axis_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   unsigned int i = queue->events_head;
+
+   while (i != queue->events_tail) {
+      ALLEGRO_EVENT *prev;
+      i = circ_array_prev(&queue->events, i);
+      prev = _al_vector_ref(&queue->events, i);
+      if (prev->type != ALLEGRO_EVENT_JOYSTICK_AXIS ||
+            prev->any.source != event->any.source ||
+            prev->joystick.id != event->joystick.id)
+         return NULL;
+      if (prev->joystick.stick == event->joystick.stick &&
+            prev->joystick.axis == event->joystick.axis)
+         return prev;
+   }
+
+   return NULL;
+}
+
+
+
+/* coalesce_event:
+ *  If the queue was created with one of the coalescing flags, and the
+ *  event pushed last is of the same kind from the same source as the new
+ *  one, update it in place instead of adding the new event.  Joystick axis
+ *  events may also update an earlier event, see find_joystick_axis_event.
+ *  Returns true if it did.  The event queue must be locked.
+ */
+static bool coalesce_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   ALLEGRO_EVENT *last;
+
+   if (!(queue->flags & (ALLEGRO_EVENT_QUEUE_COALESCE_MOUSE_AXES |
+         ALLEGRO_EVENT_QUEUE_COALESCE_JOYSTICK_AXES |
+         ALLEGRO_EVENT_QUEUE_COALESCE_TOUCH_MOVES)))
+      return false;
+
+   if (is_event_queue_empty(queue))
+      return false;
+
+   if (event->type == ALLEGRO_EVENT_JOYSTICK_AXIS) {
+      if (!(queue->flags & ALLEGRO_EVENT_QUEUE_COALESCE_JOYSTICK_AXES))
+         return false;
+      last = find_joystick_axis_event(queue, event);
+      if (!last)
+         return false;
+   }
+   else {
+      last = _al_vector_ref(&queue->events,
+         circ_array_prev(&queue->events, queue->events_head));
+      if (last->type != event->type ||
+            last->any.source != event->any.source)
+         return false;
+   }
+
+   switch (event->type) {
+      case ALLEGRO_EVENT_MOUSE_AXES:
+         if (!(queue->flags & ALLEGRO_EVENT_QUEUE_COALESCE_MOUSE_AXES) ||
+               last->mouse.display != event->mouse.display)
+            return false;
+         last->mouse.x = event->mouse.x;
+         last->mouse.y = event->mouse.y;
+         last->mouse.z = event->mouse.z;
+         last->mouse.w = event->mouse.w;
+         last->mouse.dx += event->mouse.dx;
+         last->mouse.dy += event->mouse.dy;
+         last->mouse.dz += event->mouse.dz;
+         last->mouse.dw += event->mouse.dw;
+         last->mouse.pressure = event->mouse.pressure;
+         queue->coalesced_mouse++;
+         break;
+
+      case ALLEGRO_EVENT_JOYSTICK_AXIS:
+         /* Only the position of the same axis is replaced. */
+         last->joystick.pos = event->joystick.pos;
+         queue->coalesced_joystick++;
+         break;
+
+      case ALLEGRO_EVENT_TOUCH_MOVE:
+         if (!(queue->flags & ALLEGRO_EVENT_QUEUE_COALESCE_TOUCH_MOVES) ||
+               last->touch.display != event->touch.display ||
+               last->touch.id != event->touch.id)
+            return false;
+         last->touch.x = event->touch.x;
+         last->touch.y = event->touch.y;
+         last->touch.dx += event->touch.dx;
+         last->touch.dy += event->touch.dy;
+         last->touch.primary = event->touch.primary;
+         queue->coalesced_touch++;
+         break;
+
+      default:
+         return false;
+   }
+
+   last->any.timestamp = event->any.timestamp;
+   return true;
+}
+
+
+
+/* peek_ring_event:
+ *  Return the oldest event in the ring of a lock-free queue, or NULL if
+ *  the ring is empty.  The event queue must be locked.
+ */
+static ALLEGRO_EVENT *peek_ring_event(ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int pos = queue->ring_tail;
+   EVENT_CELL *cell = &queue->ring[pos & (RING_SIZE - 1)];
+
+   if ((int)((unsigned int)_al_load_acquire(&cell->seq) - (pos + 1)) < 0)
+      return NULL;
+   return &cell->event;
+}
+
+
+
+/* drop_ring_event:
+ *  Give the slot of the event returned by peek_ring_event back to the
+ *  event sources.  The event queue must be locked.
+ */
+static void drop_ring_event(ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int pos = queue->ring_tail;
+   EVENT_CELL *cell = &queue->ring[pos & (RING_SIZE - 1)];
+
+   /* Free the slot only once the event has been read. */
+   _al_store_release(&cell->seq, pos + RING_SIZE);
+   queue->ring_tail = pos + 1;
+}
+
+
+
+/* move_ring_events:
+ *  Move the events event sources put into the ring of a lock-free queue
+ *  to the end of the circular array.  The event queue must be locked.
+ */
+static void move_ring_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_EVENT *event;
+
+   if (!queue->ring)
+      return;
+
+   while ((event = peek_ring_event(queue))) {
+      if (queue->stats)
+         record_push(queue, event);
+      if (!coalesce_event(queue, event))
+         copy_event(alloc_event(queue), event);
+      drop_ring_event(queue);
+   }
+}
+
+
+
+/* is_event_queue_empty_locked:
+ *  Like is_event_queue_empty, but also sees events which are still in the
+ *  ring of a lock-free queue.  The event queue must be locked.
+ */
+static bool is_event_queue_empty_locked(ALLEGRO_EVENT_QUEUE *queue)
+{
+   if (!is_event_queue_empty(queue))
+      return false;
+   return !(queue->ring && peek_ring_event(queue));
+}
+
+
+
+/* events_in_array:
+ *  Returns the number of events in the circular array, whose size is
+ *  always a power of two.  The event queue must be locked.
+ */
+static int events_in_array(const ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int size = _al_vector_size(&queue->events);
+   return (queue->events_head - queue->events_tail) & (size - 1);
+}
+
+
+
+/* find_source_count:
+ *  Returns the count of events from the source, adding it if needed, or
+ *  NULL if out of memory.  The last source found is tried first, as events
+ *  tend to come in runs.
+ */
+static SOURCE_COUNT *find_source_count(QUEUE_STATS *stats,
+   const ALLEGRO_EVENT_SOURCE *source)
+{
+   SOURCE_COUNT *sc;
+   unsigned int i;
+
+   if (stats->last_source < _al_vector_size(&stats->source_counts)) {
+      sc = _al_vector_ref(&stats->source_counts, stats->last_source);
+      if (sc->source == source)
+         return sc;
+   }
+
+   for (i = 0; i < _al_vector_size(&stats->source_counts); i++) {
+      sc = _al_vector_ref(&stats->source_counts, i);
+      if (sc->source == source) {
+         stats->last_source = i;
+         return sc;
+      }
+   }
+
+   sc = _al_vector_alloc_back(&stats->source_counts);
+   if (!sc)
+      return NULL;
+   sc->source = source;
+   sc->count = 0;
+   stats->last_source = i;
+   return sc;
+}
+
+
+
+/* forget_source_count:
+ *  Drops the count of an unregistered source, whose address may be reused.
+ */
+static void forget_source_count(QUEUE_STATS *stats,
+   const ALLEGRO_EVENT_SOURCE *source)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&stats->source_counts); i++) {
+      SOURCE_COUNT *sc = _al_vector_ref(&stats->source_counts, i);
+      if (sc->source == source) {
+         _al_vector_delete_at(&stats->source_counts, i);
+         break;
+      }
+   }
+}
+
+
+
+/* record_push:
+ *  Counts an event arriving in a queue with statistics.  The event queue
+ *  must be locked.
+ */
+static void record_push(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   SOURCE_COUNT *sc;
+
+   queue->stats->info.events_pushed++;
+   sc = find_source_count(queue->stats, event->any.source);
+   if (sc)
+      sc->count++;
+}
+
+
+
+/* record_taken:
+ *  Counts events taken out of a queue with statistics, and how long they
+ *  waited since their timestamp.  Bucket 0 of the histogram is for less
+ *  than a microsecond, bucket i for 2^(i-1) to 2^i microseconds, and the
+ *  last also for anything longer.  The event queue must be locked.
+ */
+static void record_taken(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *events, int n)
+{
+   ALLEGRO_EVENT_QUEUE_STATS *info = &queue->stats->info;
+   double now = al_get_time();
+   int i;
+
+   for (i = 0; i < n; i++) {
+      double latency = now - events[i].any.timestamp;
+      unsigned int micros;
+      int bucket = 0;
+
+      if (latency < 0)
+         latency = 0;
+      info->total_latency += latency;
+      if (latency > info->max_latency)
+         info->max_latency = latency;
+
+      /* Anything beyond about 71 minutes doesn't fit. */
+      micros = latency * 1e6 < (double)UINT_MAX ?
+         (unsigned int)(latency * 1e6) : UINT_MAX;
+      while (micros && bucket < ALLEGRO_EVENT_QUEUE_LATENCY_BUCKETS - 1) {
+         micros >>= 1;
+         bucket++;
+      }
+      info->latency_histogram[bucket]++;
+   }
+
+   info->events_taken += n;
+}
+
+
+
+/* Function: al_get_event_queue_stats
+ */
+bool al_get_event_queue_stats(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_QUEUE_STATS *stats)
 {
    ASSERT(queue);
+   ASSERT(stats);
 
-   heartbeat();
+   if (!queue->stats) {
+      memset(stats, 0, sizeof *stats);
+      return false;
+   }
 
-   return is_event_queue_empty(queue);
+   _al_mutex_lock(&queue->mutex);
+   /* Count what is still in the ring of a lock-free queue. */
+   move_ring_events(queue);
+   *stats = queue->stats->info;
+   stats->depth = events_in_array(queue);
+   _al_mutex_unlock(&queue->mutex);
+
+   return true;
 }
 
 
 
-/* circ_array_next:
- *  Return the next index in a circular array.
+/* Function: al_get_event_queue_source_count
  */
-static unsigned int circ_array_next(const _AL_VECTOR *vector, unsigned int i)
+int64_t al_get_event_queue_source_count(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_SOURCE *source)
 {
-   return (i + 1) % _al_vector_size(vector);
+   int64_t count = 0;
+   unsigned int i;
+
+   ASSERT(queue);
+   ASSERT(source);
+
+   if (!queue->stats)
+      return 0;
+
+   _al_mutex_lock(&queue->mutex);
+   move_ring_events(queue);
+   for (i = 0; i < _al_vector_size(&queue->stats->source_counts); i++) {
+      SOURCE_COUNT *sc = _al_vector_ref(&queue->stats->source_counts, i);
+      if (sc->source == source) {
+         count = sc->count;
+         break;
+      }
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
+/* Function: al_reset_event_queue_stats
+ */
+void al_reset_event_queue_stats(ALLEGRO_EVENT_QUEUE *queue)
+{
+   unsigned int i;
+
+   ASSERT(queue);
+
+   if (!queue->stats)
+      return;
+
+   _al_mutex_lock(&queue->mutex);
+   move_ring_events(queue);
+   memset(&queue->stats->info, 0, sizeof queue->stats->info);
+   queue->stats->info.max_depth = events_in_array(queue);
+   for (i = 0; i < _al_vector_size(&queue->stats->source_counts); i++) {
+      SOURCE_COUNT *sc = _al_vector_ref(&queue->stats->source_counts, i);
+      sc->count = 0;
+   }
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
+/* Function: al_get_event_queue_coalesced_count
+ */
+int al_get_event_queue_coalesced_count(ALLEGRO_EVENT_QUEUE *queue, int flags)
+{
+   int count = 0;
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   if (flags & ALLEGRO_EVENT_QUEUE_COALESCE_MOUSE_AXES)
+      count += queue->coalesced_mouse;
+   if (flags & ALLEGRO_EVENT_QUEUE_COALESCE_JOYSTICK_AXES)
+      count += queue->coalesced_joystick;
+   if (flags & ALLEGRO_EVENT_QUEUE_COALESCE_TOUCH_MOVES)
+      count += queue->coalesced_touch;
+   _al_mutex_unlock(&queue->mutex);
+
+   return count;
+}
+
+
+
+/* Function: al_is_event_queue_empty
+ */
+bool al_is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
+{
+   bool empty;
+   ASSERT(queue);
+
+   heartbeat();
+
+   if (!queue->ring)
+      return is_event_queue_empty(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   empty = is_event_queue_empty_locked(queue);
+   _al_mutex_unlock(&queue->mutex);
+
+   return empty;
 }
 
 
@@ -264,6 +810,8 @@ static ALLEGRO_EVENT *get_next_event_if_any(ALLEGRO_EVENT_QUEUE *queue,
 {
    ALLEGRO_EVENT *event;
 
+   move_ring_events(queue);
+
    if (is_event_queue_empty(queue)) {
       return NULL;
    }
@@ -277,11 +825,83 @@ static ALLEGRO_EVENT *get_next_event_if_any(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* wait_until_nonempty: [primary thread]
+ *  Block on the condition variable until the queue is non-empty, or until
+ *  the timeout expires if it is not NULL.  Returns false on timeout.  The
+ *  event queue must be locked before entering this function.
+ */
+static bool wait_until_nonempty(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_TIMEOUT *timeout)
+{
+   int result = 0;
+
+   while (is_event_queue_empty_locked(queue)) {
+      if (result == -1)
+         return false;
+
+      /* Event sources only signal the condition variable while a thread
+       * is waiting, so look once more after announcing ourselves.
+       */
+      _al_fetch_and_add1(&queue->waiters);
+      if (is_event_queue_empty_locked(queue)) {
+         if (timeout)
+            result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
+         else
+            _al_cond_wait(&queue->cond, &queue->mutex);
+      }
+      _al_sub1_and_fetch(&queue->waiters);
+   }
+
+   return true;
+}
+
+
+
+/* get_next_events:
+ *  Helper function.  Removes up to max_events events from the queue and
+ *  copies them into ret_events, returning how many were copied.  As with
+ *  al_get_next_event, user event reference counts are left as they are.
+ *  The event queue must be locked before entering this function.
+ */
+static int get_next_events(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_events, int max_events)
+{
+   ALLEGRO_EVENT *event;
+   int n = 0;
+
+   while (n < max_events && !is_event_queue_empty(queue)) {
+      copy_event(&ret_events[n],
+         _al_vector_ref(&queue->events, queue->events_tail));
+      queue->events_tail = circ_array_next(&queue->events, queue->events_tail);
+      n++;
+   }
+
+   /* Anything still in the ring is newer than the events in the array, and
+    * can be copied out directly.
+    */
+   if (queue->ring) {
+      while (n < max_events && (event = peek_ring_event(queue))) {
+         if (queue->stats)
+            record_push(queue, event);
+         copy_event(&ret_events[n], event);
+         drop_ring_event(queue);
+         n++;
+      }
+   }
+
+   if (queue->stats && n > 0)
+      record_taken(queue, ret_events, n);
+
+   return n;
+}
+
+
+
 /* Function: al_get_next_event
  */
 bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 {
-   ALLEGRO_EVENT *next_event;
+   int n;
    ASSERT(queue);
    ASSERT(ret_event);
 
@@ -289,15 +909,33 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    _al_mutex_lock(&queue->mutex);
 
-   next_event = get_next_event_if_any(queue, true);
-   if (next_event) {
-      copy_event(ret_event, next_event);
-      /* Don't increment reference count on user events. */
-   }
+   /* Don't increment reference count on user events. */
+   n = get_next_events(queue, ret_event, 1);
 
    _al_mutex_unlock(&queue->mutex);
 
-   return (next_event ? true : false);
+   return (n > 0);
+}
+
+
+
+/* Function: al_get_next_events
+ */
+int al_get_next_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_events,
+   int max_events)
+{
+   int n;
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max_events >= 0);
+
+   heartbeat();
+
+   _al_mutex_lock(&queue->mutex);
+   n = get_next_events(queue, ret_events, max_events);
+   _al_mutex_unlock(&queue->mutex);
+
+   return n;
 }
 
 
@@ -340,6 +978,8 @@ bool al_drop_next_event(ALLEGRO_EVENT_QUEUE *queue)
 
    next_event = get_next_event_if_any(queue, true);
    if (next_event) {
+      if (queue->stats)
+         record_taken(queue, next_event, 1);
       unref_if_user_event(next_event);
    }
 
@@ -361,6 +1001,8 @@ void al_flush_event_queue(ALLEGRO_EVENT_QUEUE *queue)
 
    _al_mutex_lock(&queue->mutex);
 
+   move_ring_events(queue);
+
    /* Decrement reference counts on all user events. */
    i = queue->events_tail;
    while (i != queue->events_head) {
@@ -380,21 +1022,16 @@ void al_flush_event_queue(ALLEGRO_EVENT_QUEUE *queue)
  */
 void al_wait_for_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 {
-   ALLEGRO_EVENT *next_event = NULL;
-
    ASSERT(queue);
 
    heartbeat();
 
    _al_mutex_lock(&queue->mutex);
    {
-      while (is_event_queue_empty(queue)) {
-         _al_cond_wait(&queue->cond, &queue->mutex);
-      }
+      wait_until_nonempty(queue, NULL);
 
       if (ret_event) {
-         next_event = get_next_event_if_any(queue, true);
-         copy_event(ret_event, next_event);
+         get_next_events(queue, ret_event, 1);
       }
    }
    _al_mutex_unlock(&queue->mutex);
@@ -402,6 +1039,33 @@ void al_wait_for_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
 
 
+/* [primary thread] */
+/* Function: al_wait_for_events
+ */
+int al_wait_for_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_events,
+   int max_events)
+{
+   int n;
+
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max_events > 0);
+
+   heartbeat();
+
+   _al_mutex_lock(&queue->mutex);
+   {
+      wait_until_nonempty(queue, NULL);
+
+      n = get_next_events(queue, ret_events, max_events);
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   return n;
+}
+
+
+
 /* [primary thread] */
 /* Function: al_wait_for_event_timed
  */
@@ -420,7 +1084,8 @@ bool al_wait_for_event_timed(ALLEGRO_EVENT_QUEUE *queue,
    else
       al_init_timeout(&timeout, secs);
 
-   return do_wait_for_event(queue, ret_event, &timeout);
+   return do_wait_for_event(queue, ret_event, ret_event ? 1 : 0, NULL,
+      &timeout);
 }
 
 
@@ -434,38 +1099,64 @@ bool al_wait_for_event_until(ALLEGRO_EVENT_QUEUE *queue,
 
    heartbeat();
 
-   return do_wait_for_event(queue, ret_event, timeout);
+   return do_wait_for_event(queue, ret_event, ret_event ? 1 : 0, NULL,
+      timeout);
+}
+
+
+
+/* [primary thread] */
+/* Function: al_wait_for_events_timed
+ */
+int al_wait_for_events_timed(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_events, int max_events, float secs)
+{
+   ALLEGRO_TIMEOUT timeout;
+   int n = 0;
+
+   ASSERT(queue);
+   ASSERT(ret_events);
+   ASSERT(max_events > 0);
+   ASSERT(secs >= 0);
+
+   heartbeat();
+
+   if (secs < 0.0)
+      al_init_timeout(&timeout, 0);
+   else
+      al_init_timeout(&timeout, secs);
+
+   do_wait_for_event(queue, ret_events, max_events, &n, &timeout);
+   return n;
 }
 
 
 
+/* do_wait_for_event:
+ *  Waits until the queue is non-empty or the timeout expires, and then
+ *  takes up to max_events events out of the queue.  The number of events
+ *  taken is stored into num_events if that is not NULL.  Returns false if
+ *  the wait timed out.
+ */
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
-   ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout)
+   ALLEGRO_EVENT *ret_events, int max_events, int *num_events,
+   ALLEGRO_TIMEOUT *timeout)
 {
    bool timed_out = false;
-   ALLEGRO_EVENT *next_event = NULL;
+   int n = 0;
 
    _al_mutex_lock(&queue->mutex);
    {
-      int result = 0;
-
-      /* Is the queue is non-empty?  If not, block on a condition
-       * variable, which will be signaled when an event is placed into
-       * the queue.
-       */
-      while (is_event_queue_empty(queue) && (result != -1)) {
-         result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
-      }
-
-      if (result == -1)
+      if (!wait_until_nonempty(queue, timeout))
          timed_out = true;
-      else if (ret_event) {
-         next_event = get_next_event_if_any(queue, true);
-         copy_event(ret_event, next_event);
-      }
+      else if (ret_events)
+         n = get_next_events(queue, ret_events, max_events);
    }
    _al_mutex_unlock(&queue->mutex);
 
+   if (num_events)
+      *num_events = n;
+
    if (timed_out)
       return false;
 
@@ -484,6 +1175,9 @@ static void expand_events_array(ALLEGRO_EVENT_QUEUE *queue)
    const size_t new_size = old_size * 2;
    unsigned int i;
 
+   if (queue->stats)
+      queue->stats->info.expansions++;
+
    for (i = old_size; i < new_size; i++) {
       _al_vector_alloc_back(&queue->events);
    }
@@ -519,6 +1213,13 @@ static ALLEGRO_EVENT *alloc_event(ALLEGRO_EVENT_QUEUE *queue)
 
    event = _al_vector_ref(&queue->events, queue->events_head);
    queue->events_head = adv_head;
+
+   if (queue->stats) {
+      int depth = events_in_array(queue);
+      if (depth > queue->stats->info.max_depth)
+         queue->stats->info.max_depth = depth;
+   }
+
    return event;
 }
 
@@ -545,9 +1246,8 @@ static void ref_if_user_event(ALLEGRO_EVENT *event)
    if (ALLEGRO_EVENT_TYPE_IS_USER(event->type)) {
       ALLEGRO_USER_EVENT_DESCRIPTOR *descr = event->user.__internal__descr;
       if (descr) {
-         _al_mutex_lock(&user_event_refcount_mutex);
-         descr->refcount++;
-         _al_mutex_unlock(&user_event_refcount_mutex);
+         ASSERT(descr->refcount >= 0);
+         _al_fetch_and_add1(&descr->refcount);
       }
    }
 }
@@ -566,6 +1266,78 @@ static void unref_if_user_event(ALLEGRO_EVENT *event)
 
 
 
+/* push_to_ring:
+ *  Put an event into the ring of a lock-free queue.  Any number of threads
+ *  may do this at the same time.  Returns false if the ring is full.
+ *
+ *  [runs in background threads]
+ */
+static bool push_to_ring(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *orig_event)
+{
+   _AL_ATOMIC pos = queue->ring_head;
+   EVENT_CELL *cell;
+
+   for (;;) {
+      int dif;
+
+      cell = &queue->ring[pos & (RING_SIZE - 1)];
+      dif = (int)((unsigned int)_al_load_acquire(&cell->seq) -
+         (unsigned int)pos);
+      if (dif == 0) {
+         /* The slot is free; claim it unless another thread was faster. */
+         if (_al_compare_and_swap(&queue->ring_head, pos,
+               (_AL_ATOMIC)((unsigned int)pos + 1)))
+            break;
+      }
+      else if (dif < 0) {
+         /* The slot still holds an event from the last time around. */
+         return false;
+      }
+      pos = queue->ring_head;
+   }
+
+   copy_event(&cell->event, orig_event);
+   ref_if_user_event(&cell->event);
+
+   /* Publish the event to the reader. */
+   _al_store_release(&cell->seq, (_AL_ATOMIC)((unsigned int)pos + 1));
+   return true;
+}
+
+
+
+/* push_event_lock_free:
+ *  Add an event to a lock-free queue.  The mutex is only taken if the ring
+ *  is full or a thread is waiting for an event.
+ *
+ *  [runs in background threads]
+ */
+static void push_event_lock_free(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *orig_event)
+{
+   while (!push_to_ring(queue, orig_event)) {
+      /* Make room by moving the ring into the array, which can grow. */
+      _al_mutex_lock(&queue->mutex);
+      move_ring_events(queue);
+      _al_mutex_unlock(&queue->mutex);
+   }
+
+   /* A waiting thread increments waiters before it looks at the ring, and
+    * we look at waiters after publishing the event, so at least one of us
+    * sees the other.  The waiter holds the mutex until it is blocked on the
+    * condition variable, so the broadcast cannot get lost.
+    */
+   _al_memory_barrier();
+   if (queue->waiters > 0) {
+      _al_mutex_lock(&queue->mutex);
+      _al_cond_broadcast(&queue->cond);
+      _al_mutex_unlock(&queue->mutex);
+   }
+}
+
+
+
 /* Internal function: _al_event_queue_push_event
  *  Event sources call this function when they have something to add to
  *  the queue.  If a queue cannot accept the event, the event's
@@ -584,16 +1356,27 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
    if (queue->paused)
       return;
 
+   if (queue->ring) {
+      push_event_lock_free(queue, orig_event);
+      return;
+   }
+
    _al_mutex_lock(&queue->mutex);
    {
-      new_event = alloc_event(queue);
-      copy_event(new_event, orig_event);
-      ref_if_user_event(new_event);
+      if (queue->stats)
+         record_push(queue, orig_event);
+
+      if (!coalesce_event(queue, orig_event)) {
+         new_event = alloc_event(queue);
+         copy_event(new_event, orig_event);
+         ref_if_user_event(new_event);
+      }
 
       /* Wake up threads that are waiting for an event to be placed in
        * the queue.
        */
-      _al_cond_broadcast(&queue->cond);
+      if (queue->waiters > 0)
+         _al_cond_broadcast(&queue->cond);
    }
    _al_mutex_unlock(&queue->mutex);
 }
@@ -648,6 +1431,8 @@ static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
    size_t new_size;
    unsigned int i;
 
+   move_ring_events(queue);
+
    if (!contains_event_of_source(queue, source)) {
       return;
    }
@@ -684,25 +1469,148 @@ static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* pool_descriptor:
+ *  Returns the pool's descriptor with the given index.
+ */
+static ALLEGRO_USER_EVENT_DESCRIPTOR *pool_descriptor(int index)
+{
+   return &user_event_pool_chunks[index / USER_EVENT_POOL_CHUNK_SIZE]
+      [index % USER_EVENT_POOL_CHUNK_SIZE];
+}
+
+
+
+/* push_free_descriptors:
+ *  Puts the chain of descriptors from first to last, linked through
+ *  next_free, on the free stack.  The pool mutex must be locked.
+ */
+static void push_free_descriptors(ALLEGRO_USER_EVENT_DESCRIPTOR *first,
+   ALLEGRO_USER_EVENT_DESCRIPTOR *last)
+{
+   last->next_free = user_event_pool_head;
+   user_event_pool_head = first->pool_index;
+}
+
+
+
+/* grow_user_event_pool:
+ *  Adds a chunk of free descriptors to the pool.  Returns false if the
+ *  pool is as large as it gets.  The pool mutex must be locked.
+ */
+static bool grow_user_event_pool(void)
+{
+   ALLEGRO_USER_EVENT_DESCRIPTOR *chunk;
+   int base;
+   int i;
+
+   if (user_event_pool_num_chunks == USER_EVENT_POOL_MAX_CHUNKS)
+      return false;
+
+   chunk = al_calloc(USER_EVENT_POOL_CHUNK_SIZE, sizeof *chunk);
+   if (!chunk)
+      return false;
+   base = user_event_pool_num_chunks * USER_EVENT_POOL_CHUNK_SIZE;
+   for (i = 0; i < USER_EVENT_POOL_CHUNK_SIZE; i++) {
+      chunk[i].pool_index = base + i;
+      chunk[i].next_free = base + i + 1;
+   }
+   user_event_pool_chunks[user_event_pool_num_chunks++] = chunk;
+
+   push_free_descriptors(&chunk[0], &chunk[USER_EVENT_POOL_CHUNK_SIZE - 1]);
+   return true;
+}
+
+
+
+/* _al_create_user_event_descriptor:
+ *  Returns a descriptor with a reference count of one, held by the caller,
+ *  or NULL if out of memory.
+ *
+ *  [may run in any thread]
+ */
+ALLEGRO_USER_EVENT_DESCRIPTOR *_al_create_user_event_descriptor(
+   void (*dtor)(ALLEGRO_USER_EVENT *))
+{
+   ALLEGRO_USER_EVENT_DESCRIPTOR *descr = NULL;
+
+   _al_mutex_lock(&user_event_pool_mutex);
+   if (user_event_pool_head != USER_EVENT_POOL_NONE ||
+         grow_user_event_pool()) {
+      descr = pool_descriptor(user_event_pool_head);
+      user_event_pool_head = descr->next_free;
+   }
+   _al_mutex_unlock(&user_event_pool_mutex);
+
+   if (!descr) {
+      descr = al_malloc(sizeof *descr);
+      if (!descr)
+         return NULL;
+      descr->pool_index = -1;
+   }
+
+   descr->dtor = dtor;
+   descr->refcount = 1;
+   descr->data_size = 0;
+   return descr;
+}
+
+
+
+/* free_user_event_descriptor:
+ *  Returns a descriptor to the pool.
+ */
+static void free_user_event_descriptor(ALLEGRO_USER_EVENT_DESCRIPTOR *descr)
+{
+   if (descr->pool_index >= 0) {
+      _al_mutex_lock(&user_event_pool_mutex);
+      push_free_descriptors(descr, descr);
+      _al_mutex_unlock(&user_event_pool_mutex);
+   }
+   else {
+      al_free(descr);
+   }
+}
+
+
+
+/* Function: al_get_user_event_data
+ */
+const void *al_get_user_event_data(const ALLEGRO_USER_EVENT *event,
+   size_t *size)
+{
+   ALLEGRO_USER_EVENT_DESCRIPTOR *descr;
+
+   ASSERT(event);
+
+   descr = event->__internal__descr;
+   if (!descr || descr->data_size == 0) {
+      if (size)
+         *size = 0;
+      return NULL;
+   }
+
+   if (size)
+      *size = descr->data_size;
+   return descr->data.bytes;
+}
+
+
+
 /* Function: al_unref_user_event
  */
 void al_unref_user_event(ALLEGRO_USER_EVENT *event)
 {
    ALLEGRO_USER_EVENT_DESCRIPTOR *descr;
-   int refcount;
 
    ASSERT(event);
 
    descr = event->__internal__descr;
    if (descr) {
-      _al_mutex_lock(&user_event_refcount_mutex);
       ASSERT(descr->refcount > 0);
-      refcount = --descr->refcount;
-      _al_mutex_unlock(&user_event_refcount_mutex);
-
-      if (refcount == 0) {
-         (descr->dtor)(event);
-         al_free(descr);
+      if (_al_sub1_and_fetch(&descr->refcount) == 0) {
+         if (descr->dtor)
+            (descr->dtor)(event);
+         free_user_event_descriptor(descr);
       }
    }
 }
@@ -19,6 +19,8 @@
  */
 
 
+#include <string.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_dtor.h"
@@ -212,34 +214,27 @@ void al_destroy_user_event_source(ALLEGRO_EVENT_SOURCE *src)
 
 
 
-/* Function: al_emit_user_event
+/* emit_user_event:
+ *  Emits the event.  The caller holds the one reference to its descriptor,
+ *  if any.  With a single queue that reference is handed to the queue.
+ *  With several queues it is kept until the event is in all of them, so
+ *  the descriptor can't go away while the queues are still being filled.
  */
-bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
-   ALLEGRO_EVENT *event, void (*dtor)(ALLEGRO_USER_EVENT *))
+static bool emit_user_event(ALLEGRO_EVENT_SOURCE *src, ALLEGRO_EVENT *event)
 {
+   ALLEGRO_USER_EVENT_DESCRIPTOR *descr = event->user.__internal__descr;
    size_t num_queues;
    bool rc;
 
-   ASSERT(src);
-   ASSERT(event);
-   ASSERT(ALLEGRO_EVENT_TYPE_IS_USER(event->any.type));
-
-   if (dtor) {
-      ALLEGRO_USER_EVENT_DESCRIPTOR *descr = al_malloc(sizeof(*descr));
-      descr->refcount = 0;
-      descr->dtor = dtor;
-      event->user.__internal__descr = descr;
-   }
-   else {
-      event->user.__internal__descr = NULL;
-   }
-
    _al_event_source_lock(src);
    {
       ALLEGRO_EVENT_SOURCE_REAL *rsrc = (ALLEGRO_EVENT_SOURCE_REAL *)src;
 
       num_queues = _al_vector_size(&rsrc->queues);
       if (num_queues > 0) {
+         /* The queue takes its own reference. */
+         if (descr && num_queues == 1)
+            descr->refcount = 0;
          event->user.timestamp = al_get_time();
          _al_event_source_emit_event(src, event);
          rc = true;
@@ -250,16 +245,69 @@ bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
    }
    _al_event_source_unlock(src);
 
-   if (dtor && !rc) {
-      dtor(&event->user);
-      al_free(event->user.__internal__descr);
-   }
+   /* Calls the destructor if no queue took the event. */
+   if (descr && num_queues != 1)
+      al_unref_user_event(&event->user);
 
    return rc;
 }
 
 
 
+/* Function: al_emit_user_event
+ */
+bool al_emit_user_event(ALLEGRO_EVENT_SOURCE *src,
+   ALLEGRO_EVENT *event, void (*dtor)(ALLEGRO_USER_EVENT *))
+{
+   ASSERT(src);
+   ASSERT(event);
+   ASSERT(ALLEGRO_EVENT_TYPE_IS_USER(event->any.type));
+
+   if (dtor) {
+      event->user.__internal__descr = _al_create_user_event_descriptor(dtor);
+      if (!event->user.__internal__descr) {
+         /* As if no queue had taken the event. */
+         dtor(&event->user);
+         return false;
+      }
+   }
+   else {
+      event->user.__internal__descr = NULL;
+   }
+
+   return emit_user_event(src, event);
+}
+
+
+
+/* Function: al_emit_user_event_with_data
+ */
+bool al_emit_user_event_with_data(ALLEGRO_EVENT_SOURCE *src,
+   ALLEGRO_EVENT *event, const void *data, size_t size)
+{
+   ALLEGRO_USER_EVENT_DESCRIPTOR *descr;
+
+   ASSERT(src);
+   ASSERT(event);
+   ASSERT(ALLEGRO_EVENT_TYPE_IS_USER(event->any.type));
+   ASSERT(data || size == 0);
+   ASSERT(size <= ALLEGRO_USER_EVENT_DATA_SIZE);
+
+   if (size > ALLEGRO_USER_EVENT_DATA_SIZE)
+      return false;
+
+   descr = _al_create_user_event_descriptor(NULL);
+   if (!descr)
+      return false;
+   memcpy(descr->data.bytes, data, size);
+   descr->data_size = size;
+   event->user.__internal__descr = descr;
+
+   return emit_user_event(src, event);
+}
+
+
+
 /* Function: al_set_event_source_data
  */
 void al_set_event_source_data(ALLEGRO_EVENT_SOURCE *source, intptr_t data)
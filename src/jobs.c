@@ -0,0 +1,682 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Job system.
+ *
+ *      A fixed pool of worker threads, each with its own deque of jobs.
+ *      A worker pushes and pops jobs at the bottom of its own deque and
+ *      steals from the top of the others' when it runs dry.  Jobs
+ *      submitted from outside the pool go to a shared injection deque.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <stdlib.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_jobs.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_tls.h"
+
+#if defined(ALLEGRO_WINDOWS)
+   #include <windows.h>
+#elif defined(ALLEGRO_UNIX) || defined(ALLEGRO_MACOSX)
+   #include <unistd.h>
+#endif
+
+ALLEGRO_DEBUG_CHANNEL("jobs")
+
+
+typedef struct JOB JOB;
+
+struct JOB {
+   void (*proc)(void *arg);
+   void *arg;
+   ALLEGRO_JOB_COUNTER *counter;
+   JOB *next;              /* in the list of jobs waiting for a counter */
+};
+
+
+struct ALLEGRO_JOB_COUNTER {
+   volatile _AL_ATOMIC count;
+   JOB *waiting;           /* protected by pool_mutex */
+};
+
+
+typedef struct JOB_DEQUE {
+   _AL_MUTEX mutex;
+   JOB **jobs;
+   unsigned int capacity;  /* always a power of two */
+   volatile unsigned int top;    /* thieves take from here */
+   volatile unsigned int bottom; /* the owner pushes and pops here */
+} JOB_DEQUE;
+
+
+typedef struct JOB_WORKER {
+   _AL_THREAD thread;
+   JOB_DEQUE deque;
+   int index;
+} JOB_WORKER;
+
+
+/* pool_mutex protects starting and stopping the pool, the lists of waiting
+ * jobs of all counters, and is the mutex for pool_cond.  Threads which have
+ * nothing to do sleep on pool_cond, and are counted in sleeping_threads.
+ */
+static _AL_MUTEX pool_mutex = _AL_MUTEX_UNINITED;
+static _AL_COND pool_cond;
+static volatile _AL_ATOMIC pool_started = 0;
+static bool pool_stopping = false;
+static JOB_WORKER *workers = NULL;
+static int num_workers = 0;
+static JOB_DEQUE injected;
+
+/* Number of jobs sitting in any deque. */
+static volatile _AL_ATOMIC queued_jobs = 0;
+static volatile _AL_ATOMIC sleeping_threads = 0;
+
+#define INITIAL_DEQUE_CAPACITY   64
+
+
+
+/* deque_init:
+ *  Prepares an empty deque.
+ */
+static void deque_init(JOB_DEQUE *deque)
+{
+   _al_mutex_init(&deque->mutex);
+   deque->capacity = INITIAL_DEQUE_CAPACITY;
+   deque->jobs = al_malloc(deque->capacity * sizeof(JOB *));
+   deque->top = 0;
+   deque->bottom = 0;
+}
+
+
+
+/* deque_destroy:
+ *  Frees a deque and any jobs still in it, which are never run.
+ */
+static void deque_destroy(JOB_DEQUE *deque)
+{
+   while (deque->top != deque->bottom) {
+      al_free(deque->jobs[deque->top++ & (deque->capacity - 1)]);
+   }
+   al_free(deque->jobs);
+   deque->jobs = NULL;
+   _al_mutex_destroy(&deque->mutex);
+}
+
+
+
+/* deque_push_bottom:
+ *  Adds a job at the bottom of a deque, growing it if needed.
+ */
+static void deque_push_bottom(JOB_DEQUE *deque, JOB *job)
+{
+   unsigned int size;
+
+   _al_mutex_lock(&deque->mutex);
+
+   size = deque->bottom - deque->top;
+   if (size == deque->capacity) {
+      JOB **jobs = al_malloc(deque->capacity * 2 * sizeof(JOB *));
+      unsigned int i;
+      for (i = 0; i < size; i++) {
+         jobs[i] = deque->jobs[(deque->top + i) & (deque->capacity - 1)];
+      }
+      al_free(deque->jobs);
+      deque->jobs = jobs;
+      deque->capacity *= 2;
+      deque->top = 0;
+      deque->bottom = size;
+   }
+
+   deque->jobs[deque->bottom & (deque->capacity - 1)] = job;
+   deque->bottom++;
+
+   _al_mutex_unlock(&deque->mutex);
+}
+
+
+
+/* deque_take:
+ *  Removes a job from the bottom (the owner) or the top (a thief) of
+ *  a deque.  Returns NULL if the deque is empty.
+ */
+static JOB *deque_take(JOB_DEQUE *deque, bool from_bottom)
+{
+   JOB *job = NULL;
+
+   /* Don't bother with the lock for an empty deque, which is the common
+    * case when stealing.  A job pushed just now is found on the next round.
+    */
+   if (deque->top == deque->bottom)
+      return NULL;
+
+   _al_mutex_lock(&deque->mutex);
+   if (deque->top != deque->bottom) {
+      if (from_bottom) {
+         deque->bottom--;
+         job = deque->jobs[deque->bottom & (deque->capacity - 1)];
+      }
+      else {
+         job = deque->jobs[deque->top & (deque->capacity - 1)];
+         deque->top++;
+      }
+   }
+   _al_mutex_unlock(&deque->mutex);
+
+   if (job)
+      _al_sub1_and_fetch(&queued_jobs);
+
+   return job;
+}
+
+
+
+/* current_worker:
+ *  Returns the worker the calling thread is, or NULL if it is not one of
+ *  the pool's threads.
+ */
+static JOB_WORKER *current_worker(void)
+{
+   int index = *_al_tls_get_job_worker();
+
+   if (index == 0)
+      return NULL;
+   return &workers[index - 1];
+}
+
+
+
+/* find_job:
+ *  Looks for a job to run, first in the worker's own deque (if self is not
+ *  NULL), then in the injection deque, then in the other workers' deques.
+ */
+static JOB *find_job(JOB_WORKER *self)
+{
+   JOB *job;
+   int start;
+   int i;
+
+   if (self) {
+      job = deque_take(&self->deque, true);
+      if (job)
+         return job;
+   }
+
+   job = deque_take(&injected, false);
+   if (job)
+      return job;
+
+   start = self ? self->index + 1 : 0;
+   for (i = 0; i < num_workers; i++) {
+      JOB_WORKER *victim = &workers[(start + i) % num_workers];
+      if (victim == self)
+         continue;
+      job = deque_take(&victim->deque, false);
+      if (job)
+         return job;
+   }
+
+   return NULL;
+}
+
+
+
+/* wake_sleepers:
+ *  Wakes up threads sleeping on pool_cond, if there are any.  The caller
+ *  must have made its change (queued a job or finished a counter) visible
+ *  before, with a full barrier, as the atomic operations provide.
+ */
+static void wake_sleepers(void)
+{
+   if (sleeping_threads > 0) {
+      _al_mutex_lock(&pool_mutex);
+      _al_cond_broadcast(&pool_cond);
+      _al_mutex_unlock(&pool_mutex);
+   }
+}
+
+
+
+/* submit_job:
+ *  Makes a job available to the pool.  Workers push to their own deque,
+ *  everyone else to the injection deque.
+ */
+static void submit_job(JOB *job)
+{
+   JOB_WORKER *self = current_worker();
+
+   deque_push_bottom(self ? &self->deque : &injected, job);
+   _al_fetch_and_add1(&queued_jobs);
+   wake_sleepers();
+}
+
+
+
+/* finish_job:
+ *  Counts down the job's counter, and submits the jobs waiting for it when
+ *  it reaches zero.  The last count is taken under pool_mutex, so that
+ *  al_wait_for_job_counter can make sure nobody touches the counter anymore
+ *  before it returns.
+ */
+static void finish_job(JOB *job)
+{
+   ALLEGRO_JOB_COUNTER *counter = job->counter;
+   JOB *waiting = NULL;
+
+   al_free(job);
+
+   if (!counter)
+      return;
+
+   for (;;) {
+      _AL_ATOMIC count = counter->count;
+      if (count <= 1)
+         break;
+      if (_al_compare_and_swap(&counter->count, count, count - 1))
+         return;
+   }
+
+   _al_mutex_lock(&pool_mutex);
+   if (_al_sub1_and_fetch(&counter->count) == 0) {
+      waiting = counter->waiting;
+      counter->waiting = NULL;
+      _al_cond_broadcast(&pool_cond);
+   }
+   _al_mutex_unlock(&pool_mutex);
+
+   while (waiting) {
+      JOB *next = waiting->next;
+      submit_job(waiting);
+      waiting = next;
+   }
+}
+
+
+
+/* run_job:
+ *  Runs a job taken from a deque.
+ */
+static void run_job(JOB *job)
+{
+   job->proc(job->arg);
+   finish_job(job);
+}
+
+
+
+/* sleep_until:
+ *  Blocks the calling thread until there are queued jobs, or the counter
+ *  (if not NULL) reaches zero, or the pool is being stopped.  Must be
+ *  called with pool_mutex held.
+ */
+static void sleep_until(ALLEGRO_JOB_COUNTER *counter)
+{
+   _al_fetch_and_add1(&sleeping_threads);
+   while (queued_jobs == 0 && !pool_stopping &&
+         (!counter || counter->count > 0)) {
+      _al_cond_wait(&pool_cond, &pool_mutex);
+   }
+   _al_sub1_and_fetch(&sleeping_threads);
+}
+
+
+
+/* worker_proc:
+ *  Main loop of the pool's threads.
+ */
+static void worker_proc(_AL_THREAD *thread, void *arg)
+{
+   JOB_WORKER *self = arg;
+   (void)thread;
+
+   *_al_tls_get_job_worker() = self->index + 1;
+
+   for (;;) {
+      JOB *job = find_job(self);
+      if (job) {
+         run_job(job);
+         continue;
+      }
+
+      _al_mutex_lock(&pool_mutex);
+      if (pool_stopping) {
+         _al_mutex_unlock(&pool_mutex);
+         break;
+      }
+      sleep_until(NULL);
+      _al_mutex_unlock(&pool_mutex);
+   }
+
+   *_al_tls_get_job_worker() = 0;
+}
+
+
+
+/* get_num_cpus:
+ *  Returns the number of CPU cores available, or 1 if unknown.
+ */
+static int get_num_cpus(void)
+{
+#if defined(ALLEGRO_WINDOWS)
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? n : 1;
+#else
+   return 1;
+#endif
+}
+
+
+
+/* start_pool:
+ *  Creates the worker threads, unless another thread got there first.
+ *  The threads which wait for jobs help running them, so by default
+ *  there is one worker less than there are cores.
+ */
+static void start_pool(void)
+{
+   const char *value;
+   int i;
+
+   _al_mutex_lock(&pool_mutex);
+
+   if (pool_started) {
+      _al_mutex_unlock(&pool_mutex);
+      return;
+   }
+
+   num_workers = 0;
+   value = al_get_config_value(al_get_system_config(), "jobs", "threads");
+   if (value)
+      num_workers = atoi(value);
+   if (num_workers <= 0)
+      num_workers = get_num_cpus() - 1;
+   if (num_workers < 1)
+      num_workers = 1;
+
+   ALLEGRO_INFO("Starting %d job threads.\n", num_workers);
+
+   deque_init(&injected);
+   workers = al_calloc(num_workers, sizeof(JOB_WORKER));
+   for (i = 0; i < num_workers; i++) {
+      workers[i].index = i;
+      deque_init(&workers[i].deque);
+   }
+   pool_stopping = false;
+
+   /* The workers look at each other's deques, so start them only once
+    * all are set up.
+    */
+   for (i = 0; i < num_workers; i++) {
+      _al_thread_create(&workers[i].thread, worker_proc, &workers[i]);
+   }
+
+   _al_store_release(&pool_started, 1);
+
+   _al_mutex_unlock(&pool_mutex);
+}
+
+
+
+/* shutdown_jobs:
+ *  Stops the worker threads once they are done with the job they are
+ *  running.  Jobs which have not been started are discarded.
+ */
+static void shutdown_jobs(void)
+{
+   int i;
+
+   if (pool_started) {
+      _al_mutex_lock(&pool_mutex);
+      pool_stopping = true;
+      _al_cond_broadcast(&pool_cond);
+      _al_mutex_unlock(&pool_mutex);
+
+      for (i = 0; i < num_workers; i++) {
+         _al_thread_join(&workers[i].thread);
+      }
+      for (i = 0; i < num_workers; i++) {
+         deque_destroy(&workers[i].deque);
+      }
+      deque_destroy(&injected);
+      al_free(workers);
+      workers = NULL;
+      num_workers = 0;
+      queued_jobs = 0;
+      pool_started = 0;
+   }
+
+   _al_cond_destroy(&pool_cond);
+   _al_mutex_destroy(&pool_mutex);
+}
+
+
+
+void _al_init_jobs(void)
+{
+   _al_mutex_init(&pool_mutex);
+   _al_cond_init(&pool_cond);
+   _al_add_exit_func(shutdown_jobs, "shutdown_jobs");
+}
+
+
+
+/* Function: al_create_job_counter
+ */
+ALLEGRO_JOB_COUNTER *al_create_job_counter(void)
+{
+   ALLEGRO_JOB_COUNTER *counter = al_calloc(1, sizeof *counter);
+   return counter;
+}
+
+
+
+/* Function: al_destroy_job_counter
+ */
+void al_destroy_job_counter(ALLEGRO_JOB_COUNTER *counter)
+{
+   if (counter) {
+      ASSERT(counter->count == 0);
+      al_free(counter);
+   }
+}
+
+
+
+/* Function: al_get_job_counter_value
+ */
+int al_get_job_counter_value(ALLEGRO_JOB_COUNTER *counter)
+{
+   ASSERT(counter);
+   return _al_load_acquire(&counter->count);
+}
+
+
+
+/* create_job:
+ *  Allocates a job and counts it in its counter.
+ */
+static JOB *create_job(void (*proc)(void *arg), void *arg,
+   ALLEGRO_JOB_COUNTER *counter)
+{
+   JOB *job = al_malloc(sizeof *job);
+
+   job->proc = proc;
+   job->arg = arg;
+   job->counter = counter;
+   job->next = NULL;
+
+   if (counter)
+      _al_fetch_and_add1(&counter->count);
+
+   if (!_al_load_acquire(&pool_started))
+      start_pool();
+
+   return job;
+}
+
+
+
+/* Function: al_run_job
+ */
+void al_run_job(void (*proc)(void *arg), void *arg,
+   ALLEGRO_JOB_COUNTER *counter)
+{
+   ASSERT(proc);
+
+   submit_job(create_job(proc, arg, counter));
+}
+
+
+
+/* Function: al_run_job_after
+ */
+void al_run_job_after(ALLEGRO_JOB_COUNTER *after,
+   void (*proc)(void *arg), void *arg, ALLEGRO_JOB_COUNTER *counter)
+{
+   JOB *job;
+
+   ASSERT(after);
+   ASSERT(proc);
+
+   job = create_job(proc, arg, counter);
+
+   /* finish_job takes the waiting jobs under the same lock after the
+    * count reaches zero, so the job is either queued here or there.
+    */
+   _al_mutex_lock(&pool_mutex);
+   if (after->count > 0) {
+      job->next = after->waiting;
+      after->waiting = job;
+      job = NULL;
+   }
+   _al_mutex_unlock(&pool_mutex);
+
+   if (job)
+      submit_job(job);
+}
+
+
+
+/* Function: al_wait_for_job_counter
+ */
+void al_wait_for_job_counter(ALLEGRO_JOB_COUNTER *counter)
+{
+   JOB_WORKER *self;
+
+   ASSERT(counter);
+
+   if (!_al_load_acquire(&pool_started))
+      return;
+
+   self = current_worker();
+
+   while (_al_load_acquire(&counter->count) > 0) {
+      JOB *job = find_job(self);
+      if (job) {
+         run_job(job);
+         continue;
+      }
+
+      _al_mutex_lock(&pool_mutex);
+      sleep_until(counter);
+      _al_mutex_unlock(&pool_mutex);
+   }
+
+   /* The thread which took the count to zero may still be in finish_job. */
+   _al_mutex_lock(&pool_mutex);
+   _al_mutex_unlock(&pool_mutex);
+}
+
+
+
+typedef struct PARALLEL_FOR_RANGE {
+   void (*proc)(int begin, int end, void *arg);
+   void *arg;
+   int begin;
+   int end;
+} PARALLEL_FOR_RANGE;
+
+
+
+static void parallel_for_job(void *arg)
+{
+   PARALLEL_FOR_RANGE *range = arg;
+   range->proc(range->begin, range->end, range->arg);
+}
+
+
+
+/* Function: al_parallel_for
+ */
+void al_parallel_for(int begin, int end, int grain,
+   void (*proc)(int begin, int end, void *arg), void *arg)
+{
+   ALLEGRO_JOB_COUNTER counter;
+   PARALLEL_FOR_RANGE *ranges;
+   int count = end - begin;
+   int num_ranges;
+   int i;
+
+   ASSERT(proc);
+
+   if (count <= 0)
+      return;
+   if (grain < 1)
+      grain = 1;
+
+   if (!_al_load_acquire(&pool_started))
+      start_pool();
+
+   /* A few ranges per thread, so threads which finish early can steal
+    * from the others.
+    */
+   num_ranges = (count + grain - 1) / grain;
+   if (num_ranges > (num_workers + 1) * 4)
+      num_ranges = (num_workers + 1) * 4;
+
+   if (num_ranges == 1) {
+      proc(begin, end, arg);
+      return;
+   }
+
+   ranges = al_malloc(num_ranges * sizeof *ranges);
+   counter.count = 0;
+   counter.waiting = NULL;
+
+   for (i = 0; i < num_ranges; i++) {
+      ranges[i].proc = proc;
+      ranges[i].arg = arg;
+      ranges[i].begin = begin + (int)((int64_t)count * i / num_ranges);
+      ranges[i].end = begin + (int)((int64_t)count * (i + 1) / num_ranges);
+   }
+
+   /* The calling thread runs the first range itself. */
+   for (i = 1; i < num_ranges; i++) {
+      al_run_job(parallel_for_job, &ranges[i], &counter);
+   }
+   parallel_for_job(&ranges[0]);
+   al_wait_for_job_counter(&counter);
+
+   al_free(ranges);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
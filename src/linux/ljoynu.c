@@ -130,12 +130,11 @@ static volatile bool config_needs_merging;
 static ALLEGRO_MUTEX *config_mutex;
 #ifdef SUPPORT_HOTPLUG
 static int inotify_fd = -1;
-static ALLEGRO_THREAD *hotplug_thread;
-static ALLEGRO_MUTEX *hotplug_mutex;
-static ALLEGRO_COND *hotplug_cond;
-static bool hotplug_ended = false;
 #endif
 
+/* The highest device number we look at. */
+#define MAX_DEVICES  32
+
 
 /* Return true if a joystick-related button or key:
  *
@@ -229,12 +228,11 @@ static bool have_joystick_axis(int fd)
 
 
 
-static bool ljoy_detect_device_name(int num, ALLEGRO_USTR *device_name)
+static void ljoy_get_device_name(int num, ALLEGRO_USTR *device_name)
 {
    ALLEGRO_CONFIG *cfg;
    char key[80];
    const char *value;
-   struct stat stbuf;
 
    al_ustr_truncate(device_name, 0);
 
@@ -248,6 +246,15 @@ static bool ljoy_detect_device_name(int num, ALLEGRO_USTR *device_name)
 
    if (al_ustr_size(device_name) == 0)
       al_ustr_appendf(device_name, "/dev/input/event%d", num);
+}
+
+
+
+static bool ljoy_detect_device_name(int num, ALLEGRO_USTR *device_name)
+{
+   struct stat stbuf;
+
+   ljoy_get_device_name(num, device_name);
 
    return (stat(al_cstr(device_name), &stbuf) == 0);
 }
@@ -263,7 +270,13 @@ static ALLEGRO_JOYSTICK_LINUX *ljoy_by_device_name(
       ALLEGRO_JOYSTICK_LINUX **slot = _al_vector_ref(&joysticks, i);
       ALLEGRO_JOYSTICK_LINUX *joy = *slot;
 
-      if (joy && al_ustr_equal(device_name, joy->device_name))
+      /* A dying joystick whose device file shows up again has been
+       * unplugged and plugged back in; that is a new joystick.
+       */
+      if (joy->config_state == LJOY_STATE_UNUSED ||
+            joy->config_state == LJOY_STATE_DYING)
+         continue;
+      if (al_ustr_equal(device_name, joy->device_name))
          return joy;
    }
 
@@ -457,9 +470,73 @@ static bool fill_joystick_buttons(ALLEGRO_JOYSTICK_LINUX *joy, int fd)
 
 
 
-static void ljoy_scan(bool configure)
+/* ljoy_add_device:
+ *  Opens the device if it is a joystick we don't know yet, and schedules it
+ *  to be added.  Marks it if we know it already.
+ */
+static void ljoy_add_device(const ALLEGRO_USTR *device_name)
 {
+   ALLEGRO_JOYSTICK_LINUX *joy;
    int fd;
+
+   joy = ljoy_by_device_name(device_name);
+   if (joy) {
+      ALLEGRO_DEBUG("Device %s still exists\n", al_cstr(device_name));
+      joy->marked = true;
+      return;
+   }
+
+   /* Try to open the device. The device must be opened in O_RDWR mode to
+    * allow writing of haptic effects! The haptic driver for linux
+    * reuses the joystick driver's fd.
+    */
+   fd = open(al_cstr(device_name), O_RDWR|O_NONBLOCK);
+   if (fd == -1) {
+      ALLEGRO_WARN("Failed to open device %s\n", al_cstr(device_name));
+      return;
+   }
+
+   /* The device must have at least one joystick-related axis, and one
+    * joystick-related button.  Some devices, such as mouse pads, have ABS_X
+    * and ABS_Y axes like a joystick but not joystick-related buttons.  By
+    * checking for both axes and buttons, such devices can be excluded.
+    */
+   if (!have_joystick_button(fd) || !have_joystick_axis(fd)) {
+      ALLEGRO_DEBUG("Device %s not a joystick\n", al_cstr(device_name));
+      close(fd);
+      return;
+   }
+
+   ALLEGRO_DEBUG("Device %s is new\n", al_cstr(device_name));
+
+   joy = ljoy_allocate_structure();
+   joy->fd = fd;
+   joy->device_name = al_ustr_dup(device_name);
+   joy->config_state = LJOY_STATE_BORN;
+   joy->marked = true;
+   config_needs_merging = true;
+
+   if (ioctl(fd, EVIOCGNAME(sizeof(joy->name)), joy->name) < 0)
+      strcpy(joy->name, "Unknown");
+
+   /* Map Linux input API axis and button numbers to ours, and fill in
+    * information.
+    */
+   if (!fill_joystick_axes(joy, fd) || !fill_joystick_buttons(joy, fd)) {
+      ALLEGRO_ERROR("fill_joystick_info failed %s\n", al_cstr(device_name));
+      inactivate_joy(joy);
+      close(fd);
+      return;
+   }
+
+   /* Register the joystick with the fdwatch subsystem.  */
+   _al_unix_start_watching_fd(joy->fd, ljoy_process_new_data, joy);
+}
+
+
+
+static void ljoy_scan(bool configure)
+{
    ALLEGRO_JOYSTICK_LINUX *joy, **joypp;
    int num;
    ALLEGRO_USTR *device_name;
@@ -477,62 +554,11 @@ static void ljoy_scan(bool configure)
    /* This is a big number, but there can be gaps and other unrelated event
     * device files.  Perhaps it would be better to use glob() here.
     */
-   for (num = 0; num < 32; num++) {
+   for (num = 0; num < MAX_DEVICES; num++) {
       if (!ljoy_detect_device_name(num, device_name))
          continue;
 
-      joy = ljoy_by_device_name(device_name);
-      if (joy) {
-         ALLEGRO_DEBUG("Device %s still exists\n", al_cstr(device_name));
-         joy->marked = true;
-         continue;
-      }
-
-      /* Try to open the device. The device must be opened in O_RDWR mode to
-       * allow writing of haptic effects! The haptic driver for linux
-       * reuses the joystick driver's fd.
-       */
-      fd = open(al_cstr(device_name), O_RDWR|O_NONBLOCK);
-      if (fd == -1) {
-         ALLEGRO_WARN("Failed to open device %s\n", al_cstr(device_name));
-         continue;
-      }
-
-      /* The device must have at least one joystick-related axis, and one
-       * joystick-related button.  Some devices, such as mouse pads, have ABS_X
-       * and ABS_Y axes like a joystick but not joystick-related buttons.  By
-       * checking for both axes and buttons, such devices can be excluded.
-       */
-      if (!have_joystick_button(fd) || !have_joystick_axis(fd)) {
-         ALLEGRO_DEBUG("Device %s not a joystick\n", al_cstr(device_name));
-         close(fd);
-         continue;
-      }
-
-      ALLEGRO_DEBUG("Device %s is new\n", al_cstr(device_name));
-
-      joy = ljoy_allocate_structure();
-      joy->fd = fd;
-      joy->device_name = al_ustr_dup(device_name);
-      joy->config_state = LJOY_STATE_BORN;
-      joy->marked = true;
-      config_needs_merging = true;
-
-      if (ioctl(fd, EVIOCGNAME(sizeof(joy->name)), joy->name) < 0)
-         strcpy(joy->name, "Unknown");
-
-      /* Map Linux input API axis and button numbers to ours, and fill in
-       * information.
-       */
-      if (!fill_joystick_axes(joy, fd) || !fill_joystick_buttons(joy, fd)) {
-         ALLEGRO_ERROR("fill_joystick_info failed %s\n", al_cstr(device_name));
-         inactivate_joy(joy);
-         close(fd);
-         continue;
-      }
-
-      /* Register the joystick with the fdwatch subsystem.  */
-      _al_unix_start_watching_fd(joy->fd, ljoy_process_new_data, joy);
+      ljoy_add_device(device_name);
    }
 
    al_ustr_free(device_name);
@@ -594,46 +620,115 @@ static void ljoy_merge(void)
 
 
 #ifdef SUPPORT_HOTPLUG
-/* ljoy_config_dev_changed: [fdwatch thread]
- *  Called when the /dev hierarchy changes.
+/* ljoy_is_device_name:
+ *  Returns true if the device would be found by ljoy_scan.
  */
-static void ljoy_config_dev_changed(void *data)
+static bool ljoy_is_device_name(const ALLEGRO_USTR *device_name)
 {
-   char buf[128];
-   (void)data;
+   ALLEGRO_USTR *name = al_ustr_new("");
+   bool found = false;
+   int num;
 
-   /* Empty the event buffer. We only care that some inotify event was sent but it
-    * doesn't matter what it is since we are going to do a full scan anyway once
-    * the timer_fd fires.
-    */
-   while (read(inotify_fd, buf, sizeof(buf)) > 0) {
+   for (num = 0; num < MAX_DEVICES && !found; num++) {
+      ljoy_get_device_name(num, name);
+      found = al_ustr_equal(name, device_name);
    }
 
-   al_signal_cond(hotplug_cond);
+   al_ustr_free(name);
+   return found;
 }
 
-static void *hotplug_proc(ALLEGRO_THREAD *thread, void *data)
+
+
+/* ljoy_remove_device:
+ *  Schedules a joystick whose device file is gone to be removed.
+ */
+static void ljoy_remove_device(const ALLEGRO_USTR *device_name)
+{
+   ALLEGRO_JOYSTICK_LINUX *joy = ljoy_by_device_name(device_name);
+
+   if (!joy)
+      return;
+
+   if (joy->config_state == LJOY_STATE_ALIVE) {
+      ALLEGRO_DEBUG("Device %s to be inactivated\n", al_cstr(device_name));
+      joy->config_state = LJOY_STATE_DYING;
+      config_needs_merging = true;
+   }
+   else if (joy->config_state == LJOY_STATE_BORN) {
+      /* The user has never seen it. */
+      ALLEGRO_DEBUG("Device %s gone before merging\n", al_cstr(device_name));
+      inactivate_joy(joy);
+   }
+}
+
+
+
+/* ljoy_config_dev_changed: [fdwatch thread]
+ *  Called when the /dev/input directory changes.  Only the devices named
+ *  in the inotify events are looked at.  Udev often creates the device
+ *  file before it sets its permissions, so a device which cannot be opened
+ *  on IN_CREATE is tried again on IN_ATTRIB.
+ */
+static void ljoy_config_dev_changed(void *data)
 {
+   union {
+      struct inotify_event event;
+      char buf[4096];
+   } u;
+   ALLEGRO_USTR *device_name = al_ustr_new("");
+   bool rescan = false;
+   bool pending;
+   ssize_t len;
    (void)data;
 
-   while (!al_get_thread_should_stop(thread)) {
-      if (!hotplug_ended) {
-         al_wait_cond(hotplug_cond, hotplug_mutex);
-      }
-      if (hotplug_ended) {
-         break;
+   al_lock_mutex(config_mutex);
+
+   /* Only tell the user about changes made here, not for every event on
+    * some unrelated device while a merge is pending.
+    */
+   pending = config_needs_merging;
+   config_needs_merging = false;
+
+   while ((len = read(inotify_fd, u.buf, sizeof(u.buf))) > 0) {
+      char *p = u.buf;
+
+      while (p < u.buf + len) {
+         struct inotify_event *event = (struct inotify_event *)p;
+         p += sizeof(struct inotify_event) + event->len;
+
+         if (event->mask & IN_Q_OVERFLOW) {
+            rescan = true;
+            continue;
+         }
+         if (event->len == 0)
+            continue;
+
+         al_ustr_assign_cstr(device_name, "/dev/input/");
+         al_ustr_append_cstr(device_name, event->name);
+         if (!ljoy_is_device_name(device_name))
+            continue;
+
+         if (event->mask & IN_DELETE)
+            ljoy_remove_device(device_name);
+         else
+            ljoy_add_device(device_name);
       }
+   }
 
-      al_rest(1);
+   if (rescan) {
+      ALLEGRO_DEBUG("inotify queue overflow, rescanning\n");
+      ljoy_scan(false);
+   }
 
-      al_lock_mutex(config_mutex);
-      ljoy_scan(true);
-      al_unlock_mutex(config_mutex);
+   if (config_needs_merging) {
+      ljoy_generate_configure_event();
    }
+   config_needs_merging = config_needs_merging || pending;
 
-   hotplug_ended = false;
+   al_unlock_mutex(config_mutex);
 
-   return NULL;
+   al_ustr_free(device_name);
 }
 #endif
 
@@ -656,29 +751,12 @@ static bool ljoy_init_joystick(void)
    ljoy_merge();
 
 #ifdef SUPPORT_HOTPLUG
-   if (!(hotplug_mutex = al_create_mutex())) {
-      al_destroy_mutex(config_mutex);
-      return false;
-   }
-   if (!(hotplug_cond = al_create_cond())) {
-      al_destroy_mutex(config_mutex);
-      al_destroy_mutex(hotplug_mutex);
-      return false;
-   }
-   if (!(hotplug_thread = al_create_thread(hotplug_proc, NULL))) {
-      al_destroy_mutex(config_mutex);
-      al_destroy_mutex(hotplug_mutex);
-      al_destroy_cond(hotplug_cond);
-      return false;
-   }
-
-   al_start_thread(hotplug_thread);
-
    inotify_fd = inotify_init();
    if (inotify_fd != -1) {
       fcntl(inotify_fd, F_SETFL, O_NONBLOCK);
       /* Modern Linux probably only needs to monitor /dev/input. */
-      inotify_add_watch(inotify_fd, "/dev/input", IN_CREATE|IN_DELETE);
+      inotify_add_watch(inotify_fd, "/dev/input",
+         IN_CREATE|IN_DELETE|IN_ATTRIB);
       _al_unix_start_watching_fd(inotify_fd, ljoy_config_dev_changed, NULL);
       ALLEGRO_INFO("Hotplugging enabled\n");
    }
@@ -709,9 +787,6 @@ static void ljoy_exit_joystick(void)
       close(inotify_fd);
       inotify_fd = -1;
    }
-   hotplug_ended = true;
-   al_signal_cond(hotplug_cond);
-   al_join_thread(hotplug_thread, NULL);
 #endif
 
    al_destroy_mutex(config_mutex);
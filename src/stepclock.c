@@ -0,0 +1,213 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Fixed step clocks.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <math.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+
+
+struct ALLEGRO_STEP_CLOCK
+{
+   double step_secs;
+   int max_steps;       /* 0 for no limit */
+   bool started;
+   double origin;       /* al_get_time() when step 0 was due */
+   double stopped_at;   /* al_get_time() when the clock was stopped */
+   int64_t count;       /* steps returned so far */
+   int64_t dropped;     /* steps skipped because of max_steps */
+};
+
+
+
+/* Function: al_create_step_clock
+ */
+ALLEGRO_STEP_CLOCK *al_create_step_clock(double step_secs)
+{
+   ALLEGRO_STEP_CLOCK *clock;
+   ASSERT(step_secs > 0);
+
+   clock = al_malloc(sizeof *clock);
+   if (clock) {
+      clock->step_secs = step_secs;
+      clock->max_steps = 0;
+      clock->started = false;
+      clock->origin = 0;
+      clock->stopped_at = 0;
+      clock->count = 0;
+      clock->dropped = 0;
+   }
+
+   return clock;
+}
+
+
+
+/* Function: al_destroy_step_clock
+ */
+void al_destroy_step_clock(ALLEGRO_STEP_CLOCK *clock)
+{
+   al_free(clock);
+}
+
+
+
+/* Function: al_start_step_clock
+ */
+void al_start_step_clock(ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   if (clock->started)
+      return;
+
+   /* Carry on where the clock was stopped. */
+   clock->origin += al_get_time() - clock->stopped_at;
+   clock->started = true;
+}
+
+
+
+/* Function: al_stop_step_clock
+ */
+void al_stop_step_clock(ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   if (!clock->started)
+      return;
+
+   clock->stopped_at = al_get_time();
+   clock->started = false;
+}
+
+
+
+/* Function: al_get_step_clock_started
+ */
+bool al_get_step_clock_started(const ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   return clock->started;
+}
+
+
+
+/* Function: al_get_step_clock_speed
+ */
+double al_get_step_clock_speed(const ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   return clock->step_secs;
+}
+
+
+
+/* Function: al_set_step_clock_max_steps
+ */
+void al_set_step_clock_max_steps(ALLEGRO_STEP_CLOCK *clock, int max_steps)
+{
+   ASSERT(clock);
+   ASSERT(max_steps >= 0);
+
+   clock->max_steps = max_steps;
+}
+
+
+
+/* Function: al_get_step_clock_max_steps
+ */
+int al_get_step_clock_max_steps(const ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   return clock->max_steps;
+}
+
+
+
+/* Function: al_get_step_clock_count
+ */
+int64_t al_get_step_clock_count(const ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   return clock->count;
+}
+
+
+
+/* Function: al_get_step_clock_dropped
+ */
+int64_t al_get_step_clock_dropped(const ALLEGRO_STEP_CLOCK *clock)
+{
+   ASSERT(clock);
+
+   return clock->dropped;
+}
+
+
+
+/* Function: al_update_step_clock
+ */
+int al_update_step_clock(ALLEGRO_STEP_CLOCK *clock, double *alpha)
+{
+   double now;
+   double steps;
+   int64_t due;
+   ASSERT(clock);
+
+   now = clock->started ? al_get_time() : clock->stopped_at;
+
+   /* Steps are due at fixed times after the origin, so rounding errors
+    * do not add up however often the clock is updated.
+    */
+   steps = (now - clock->origin) / clock->step_secs;
+   due = (int64_t)floor(steps) - clock->count;
+   if (due < 0)
+      due = 0;
+
+   if (clock->max_steps > 0 && due > clock->max_steps) {
+      /* Give up on the steps we cannot catch up with, as if the clock had
+       * been stopped for that long.
+       */
+      int64_t skip = due - clock->max_steps;
+      clock->origin += skip * clock->step_secs;
+      clock->dropped += skip;
+      steps -= skip;
+      due = clock->max_steps;
+   }
+
+   clock->count += due;
+
+   if (alpha) {
+      double a = steps - clock->count;
+      *alpha = (a < 0) ? 0 : a;
+   }
+
+   return (int)due;
+}
+
+
+/*
+ * Local Variables:
+ * c-basic-offset: 3
+ * indent-tabs-mode: nil
+ * End:
+ */
+/* vim: set sts=3 sw=3 et: */
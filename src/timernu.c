@@ -16,6 +16,7 @@
  */
 
 
+#include <math.h>
 #include <stdlib.h>
 
 #include "allegro5/allegro.h"
@@ -34,8 +35,8 @@
 
 
 /* forward declarations */
-static double timer_thread_handle_tick(double interval);
-static void timer_handle_tick(ALLEGRO_TIMER *timer);
+static void timer_thread_handle_ticks(double now);
+static void timer_handle_tick(ALLEGRO_TIMER *timer, double error);
 
 
 struct ALLEGRO_TIMER
@@ -44,7 +45,14 @@ struct ALLEGRO_TIMER
    bool started;
    double speed_secs;
    int64_t count;
-   double counter;		/* counts down to zero=blastoff */
+   double deadline;     /* al_get_time() of the next tick */
+   unsigned int heap_index;  /* position in active_timers */
+
+   /* How late the ticks since the timer was started were handled. */
+   int64_t jitter_ticks;
+   double jitter_sum;
+   double jitter_sum_sq;
+   double jitter_max;
 };
 
 
@@ -54,11 +62,107 @@ struct ALLEGRO_TIMER
  */
 
 static _AL_MUTEX timers_mutex = _AL_MUTEX_UNINITED;
+static _AL_COND timers_cond;
+/* Binary min-heap of the started timers, ordered by deadline. */
 static _AL_VECTOR active_timers = _AL_VECTOR_INITIALIZER(ALLEGRO_TIMER *);
 static _AL_THREAD * volatile timer_thread = NULL;
 
 
 
+static ALLEGRO_TIMER *heap_get(unsigned int i)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   return *slot;
+}
+
+
+
+static void heap_set(unsigned int i, ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   *slot = timer;
+   timer->heap_index = i;
+}
+
+
+
+/* heap_sift_up, heap_sift_down:
+ *  Move the timer at index i towards the root or the leaves of the heap
+ *  until it is in order again.
+ */
+static void heap_sift_up(unsigned int i)
+{
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+      ALLEGRO_TIMER *p = heap_get(parent);
+      if (p->deadline <= timer->deadline)
+         break;
+      heap_set(i, p);
+      i = parent;
+   }
+   heap_set(i, timer);
+}
+
+
+
+static void heap_sift_down(unsigned int i)
+{
+   unsigned int n = _al_vector_size(&active_timers);
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   for (;;) {
+      unsigned int child = 2 * i + 1;
+      ALLEGRO_TIMER *c;
+      if (child >= n)
+         break;
+      c = heap_get(child);
+      if (child + 1 < n && heap_get(child + 1)->deadline < c->deadline) {
+         child++;
+         c = heap_get(child);
+      }
+      if (timer->deadline <= c->deadline)
+         break;
+      heap_set(i, c);
+      i = child;
+   }
+   heap_set(i, timer);
+}
+
+
+
+static void heap_insert(ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_alloc_back(&active_timers);
+   *slot = timer;
+   heap_sift_up(_al_vector_size(&active_timers) - 1);
+}
+
+
+
+static void heap_remove(ALLEGRO_TIMER *timer)
+{
+   unsigned int i = timer->heap_index;
+   unsigned int last = _al_vector_size(&active_timers) - 1;
+
+   ASSERT(heap_get(i) == timer);
+
+   if (i != last) {
+      /* Fill the hole with the last timer and put that in order. */
+      ALLEGRO_TIMER *moved = heap_get(last);
+      heap_set(i, moved);
+      _al_vector_delete_at(&active_timers, last);
+      heap_sift_up(i);
+      heap_sift_down(moved->heap_index);
+   }
+   else {
+      _al_vector_delete_at(&active_timers, last);
+   }
+}
+
+
+
 /* timer_thread_proc: [timer thread]
  *  The timer thread procedure itself.
  */
@@ -94,57 +198,50 @@ static void timer_thread_proc(_AL_THREAD *self, void *unused)
    }
 #endif
 
-   double old_time = al_get_time();
-   double new_time;
-   double interval = 0.032768;
+   /* Sleep until the earliest deadline, or until a timer is started,
+    * stopped or changes speed.  Deadlines are absolute, so however long
+    * each wakeup takes, it does not add up over the ticks.  When the last
+    * timer is stopped, or a new thread took over, timer_thread changes.
+    */
+   _al_mutex_lock(&timers_mutex);
+   while (timer_thread == self && _al_vector_is_nonempty(&active_timers)) {
+      ALLEGRO_TIMEOUT timeout;
 
-   while (!_al_get_thread_should_stop(self)) {
-      al_rest(interval);
+      timer_thread_handle_ticks(al_get_time());
 
-      _al_mutex_lock(&timers_mutex);
-      {
-         /* Calculate actual time elapsed.  */
-         new_time = al_get_time();
-         interval = new_time - old_time;
-         old_time = new_time;
-
-         /* Handle a tick.  */
-         interval = timer_thread_handle_tick(interval);
-      }
-      _al_mutex_unlock(&timers_mutex);
+      al_init_timeout(&timeout, heap_get(0)->deadline - al_get_time());
+      _al_cond_timedwait(&timers_cond, &timers_mutex, &timeout);
    }
+   _al_mutex_unlock(&timers_mutex);
 
    (void)unused;
 }
 
 
 
-/* timer_thread_handle_tick: [timer thread]
- *  Call handle_tick() method of every timer in active_timers, and
- *  returns the duration that the timer thread should try to sleep
- *  next time.
+/* timer_thread_handle_ticks: [timer thread]
+ *  Handle the ticks of all timers whose deadline has passed.  A timer
+ *  which fell more than one period behind ticks several times.
  */
-static double timer_thread_handle_tick(double interval)
+static void timer_thread_handle_ticks(double now)
 {
-   double new_delay = 0.032768;
-   unsigned int i;
-
-   for (i = 0; i < _al_vector_size(&active_timers); i++) {
-      ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
-      ALLEGRO_TIMER *timer = *slot;
-
-      timer->counter -= interval;
-
-      while (timer->counter <= 0) {
-         timer_handle_tick(timer);
-         timer->counter += timer->speed_secs;
-      }
-
-      if ((timer->counter > 0) && (timer->counter < new_delay))
-         new_delay = timer->counter;
+   while (_al_vector_is_nonempty(&active_timers)) {
+      ALLEGRO_TIMER *timer = heap_get(0);
+      double error = now - timer->deadline;
+
+      if (error < 0)
+         break;
+
+      timer->jitter_ticks++;
+      timer->jitter_sum += error;
+      timer->jitter_sum_sq += error * error;
+      if (error > timer->jitter_max)
+         timer->jitter_max = error;
+
+      timer_handle_tick(timer, error);
+      timer->deadline += timer->speed_secs;
+      heap_sift_down(0);
    }
-
-   return new_delay;
 }
 
 
@@ -154,6 +251,7 @@ static void shutdown_timers(void)
    ASSERT(_al_vector_size(&active_timers) == 0);
    ASSERT(timer_thread == NULL);
 
+   _al_cond_destroy(&timers_cond);
    _al_mutex_destroy(&timers_mutex);
 }
 
@@ -162,6 +260,7 @@ static void shutdown_timers(void)
 void _al_init_timers(void)
 {
    _al_mutex_init(&timers_mutex);
+   _al_cond_init(&timers_cond);
    _al_add_exit_func(shutdown_timers, "shutdown_timers");
 }
 
@@ -193,7 +292,12 @@ ALLEGRO_TIMER *al_create_timer(double speed_secs)
          timer->started = false;
          timer->count = 0;
          timer->speed_secs = speed_secs;
-         timer->counter = 0;
+         timer->deadline = 0;
+         timer->heap_index = 0;
+         timer->jitter_ticks = 0;
+         timer->jitter_sum = 0;
+         timer->jitter_sum_sq = 0;
+         timer->jitter_max = 0;
 
          _al_register_destructor(_al_dtor_list, timer,
             (void (*)(void *)) al_destroy_timer);
@@ -227,29 +331,30 @@ void al_start_timer(ALLEGRO_TIMER *timer)
 {
    ASSERT(timer);
    {
-      size_t new_size;
-
       if (timer->started)
          return;
 
       _al_mutex_lock(&timers_mutex);
       {
-         ALLEGRO_TIMER **slot;
-
          timer->started = true;
-         timer->counter = timer->speed_secs;
+         timer->deadline = al_get_time() + timer->speed_secs;
+         timer->jitter_ticks = 0;
+         timer->jitter_sum = 0;
+         timer->jitter_sum_sq = 0;
+         timer->jitter_max = 0;
 
-         slot = _al_vector_alloc_back(&active_timers);
-         *slot = timer;
+         heap_insert(timer);
 
-         new_size = _al_vector_size(&active_timers);
+         if (_al_vector_size(&active_timers) == 1) {
+            timer_thread = al_malloc(sizeof(_AL_THREAD));
+            _al_thread_create(timer_thread, timer_thread_proc, NULL);
+         }
+         else if (timer->heap_index == 0) {
+            /* The timer thread has to wake up earlier now. */
+            _al_cond_broadcast(&timers_cond);
+         }
       }
       _al_mutex_unlock(&timers_mutex);
-
-      if (new_size == 1) {
-         timer_thread = al_malloc(sizeof(_AL_THREAD));
-         _al_thread_create(timer_thread, timer_thread_proc, NULL);
-      }
    }
 }
 
@@ -268,13 +373,14 @@ void al_stop_timer(ALLEGRO_TIMER *timer)
 
       _al_mutex_lock(&timers_mutex);
       {
-         _al_vector_find_and_delete(&active_timers, &timer);
+         heap_remove(timer);
          timer->started = false;
 
          if (_al_vector_size(&active_timers) == 0) {
             _al_vector_free(&active_timers);
             thread_to_join = timer_thread;
             timer_thread = NULL;
+            _al_cond_broadcast(&timers_cond);
          }
       }
       _al_mutex_unlock(&timers_mutex);
@@ -320,8 +426,11 @@ void al_set_timer_speed(ALLEGRO_TIMER *timer, double new_speed_secs)
    _al_mutex_lock(&timers_mutex);
    {
       if (timer->started) {
-         timer->counter -= timer->speed_secs;
-         timer->counter += new_speed_secs;
+         timer->deadline -= timer->speed_secs;
+         timer->deadline += new_speed_secs;
+         heap_sift_up(timer->heap_index);
+         heap_sift_down(timer->heap_index);
+         _al_cond_broadcast(&timers_cond);
       }
 
       timer->speed_secs = new_speed_secs;
@@ -373,9 +482,9 @@ void al_add_timer_count(ALLEGRO_TIMER *timer, int64_t diff)
 
 
 /* timer_handle_tick: [timer thread]
- *  Handle a single tick.
+ *  Handle a single tick, error seconds after it was due.
  */
-static void timer_handle_tick(ALLEGRO_TIMER *timer)
+static void timer_handle_tick(ALLEGRO_TIMER *timer, double error)
 {
    /* Lock out event source helper functions (e.g. the release hook
     * could be invoked simultaneously with this function).
@@ -391,7 +500,7 @@ static void timer_handle_tick(ALLEGRO_TIMER *timer)
          event.timer.type = ALLEGRO_EVENT_TIMER;
          event.timer.timestamp = al_get_time();
          event.timer.count = timer->count;
-         event.timer.error = -timer->counter;
+         event.timer.error = error;
          _al_event_source_emit_event(&timer->es, &event);
       }
    }
@@ -400,6 +509,37 @@ static void timer_handle_tick(ALLEGRO_TIMER *timer)
 
 
 
+/* Function: al_get_timer_jitter
+ */
+void al_get_timer_jitter(ALLEGRO_TIMER *timer, double *mean,
+   double *deviation, double *max)
+{
+   double m = 0, d = 0, x = 0;
+   ASSERT(timer);
+
+   _al_mutex_lock(&timers_mutex);
+   {
+      if (timer->jitter_ticks > 0) {
+         double n = (double)timer->jitter_ticks;
+         double variance;
+         m = timer->jitter_sum / n;
+         variance = timer->jitter_sum_sq / n - m * m;
+         d = variance > 0 ? sqrt(variance) : 0;
+         x = timer->jitter_max;
+      }
+   }
+   _al_mutex_unlock(&timers_mutex);
+
+   if (mean)
+      *mean = m;
+   if (deviation)
+      *deviation = d;
+   if (max)
+      *max = x;
+}
+
+
+
 /* Function: al_get_timer_event_source
  */
 ALLEGRO_EVENT_SOURCE *al_get_timer_event_source(ALLEGRO_TIMER *timer)
@@ -100,6 +100,9 @@ typedef struct thread_local_state {
 
    /* Destructor ownership count */
    int dtor_owner_count;
+
+   /* Index of the job pool worker this thread is, plus one; or zero */
+   int job_worker;
 } thread_local_state;
 
 
@@ -883,4 +886,14 @@ int *_al_tls_get_dtor_owner_count(void)
 
 
 
+int *_al_tls_get_job_worker(void)
+{
+   thread_local_state *tls;
+
+   tls = tls_get();
+   return &tls->job_worker;
+}
+
+
+
 /* vim: set sts=3 sw=3 et: */
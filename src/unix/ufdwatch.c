@@ -17,13 +17,20 @@
  *      This module implements a background thread that waits for data
  *      to arrive in file descriptors, at which point it dispatches to
  *      functions which will process that data.
+ *
+ *      On Linux the thread sleeps in epoll_wait, so it costs nothing while
+ *      idle and is not limited by FD_SETSIZE.  Elsewhere it falls back to
+ *      select().  Either way it is woken through a pipe (an eventfd on
+ *      Linux) when it needs to notice a change right away.
  */
 
 
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <unistd.h>
 
 #include "allegro5/allegro.h"
@@ -32,6 +39,20 @@
 #include "allegro5/internal/aintern_vector.h"
 #include "allegro5/platform/aintunix.h"
 
+#if defined(ALLEGRO_HAVE_SYS_EPOLL_H)
+   #define USE_EPOLL
+   #include <sys/epoll.h>
+#else
+   #include <sys/select.h>
+#endif
+
+#if defined(ALLEGRO_HAVE_SYS_EVENTFD_H)
+   #define USE_EVENTFD
+   #include <sys/eventfd.h>
+#endif
+
+ALLEGRO_DEBUG_CHANNEL("fdwatch")
+
 
 
 typedef struct WATCH_ITEM
@@ -43,72 +64,376 @@ typedef struct WATCH_ITEM
 
 
 static _AL_THREAD fd_watch_thread;
+static bool fd_watch_running = false;
 static _AL_MUTEX fd_watch_mutex = _AL_MUTEX_UNINITED;
+static _AL_COND fd_watch_cond;
 static _AL_VECTOR fd_watch_list = _AL_VECTOR_INITIALIZER(WATCH_ITEM);
 
+/* The fd whose callback is running right now, or -1.  Protected by
+ * fd_watch_mutex; fd_watch_cond is broadcast when it changes back to -1.
+ */
+static int fd_watch_running_fd = -1;
+
+/* Writing to wake_fds[1] makes the thread return from the wait.  With an
+ * eventfd both are the same.
+ */
+static int wake_fds[2] = { -1, -1 };
+
+#ifdef USE_EPOLL
+static int epoll_fd = -1;
+#define MAX_EPOLL_EVENTS   32
+#endif
+
+
+
+/* find_watch_item:
+ *  Returns the index of fd in the watch list, or -1.  Must be called with
+ *  fd_watch_mutex held.
+ */
+static int find_watch_item(int fd)
+{
+   unsigned int i;
+
+   for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+      WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+      if (wi->fd == fd)
+         return i;
+   }
+
+   return -1;
+}
+
+
+
+/* in_fd_watch_thread:
+ *  Returns true if called from the background thread, i.e. from a callback.
+ */
+static bool in_fd_watch_thread(void)
+{
+   return pthread_equal(pthread_self(), fd_watch_thread.thread);
+}
+
+
+
+/* open_wake_fds:
+ *  Creates the non-blocking pipe or eventfd used to wake up the thread.
+ */
+static bool open_wake_fds(void)
+{
+#ifdef USE_EVENTFD
+   wake_fds[0] = wake_fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   return wake_fds[0] != -1;
+#else
+   if (pipe(wake_fds) != 0) {
+      wake_fds[0] = wake_fds[1] = -1;
+      return false;
+   }
+   fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+   fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+   fcntl(wake_fds[0], F_SETFD, FD_CLOEXEC);
+   fcntl(wake_fds[1], F_SETFD, FD_CLOEXEC);
+   return true;
+#endif
+}
+
+
+
+static void close_wake_fds(void)
+{
+   if (wake_fds[0] != -1)
+      close(wake_fds[0]);
+   if (wake_fds[1] != wake_fds[0])
+      close(wake_fds[1]);
+   wake_fds[0] = wake_fds[1] = -1;
+}
+
+
+
+/* wake_fd_watch_thread:
+ *  Makes the thread return from its wait.  If the pipe is full the thread
+ *  is going to wake up anyway, so errors are ignored.
+ */
+static void wake_fd_watch_thread(void)
+{
+#ifdef USE_EVENTFD
+   uint64_t one = 1;
+   ssize_t ret = write(wake_fds[1], &one, sizeof one);
+#else
+   char one = 1;
+   ssize_t ret = write(wake_fds[1], &one, sizeof one);
+#endif
+   (void)ret;
+}
+
+
+
+static void drain_wake_fd(void)
+{
+   char buf[64];
+
+   while (read(wake_fds[0], buf, sizeof buf) > 0) {
+   }
+}
+
+
+
+/* dispatch_fd: [fdwatch thread]
+ *  Runs the callback for fd, if it is still being watched.  The callback
+ *  runs without the mutex held, so other threads are never held up by it.
+ *  _al_unix_stop_watching_fd waits for a running callback of the fd it
+ *  removes, so the callback data stays valid meanwhile.
+ */
+static void dispatch_fd(int fd, bool hangup)
+{
+   void (*callback)(void *);
+   void *cb_data;
+   int i;
+
+   _al_mutex_lock(&fd_watch_mutex);
+   i = find_watch_item(fd);
+   if (i < 0) {
+      _al_mutex_unlock(&fd_watch_mutex);
+      return;
+   }
+   {
+      WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+      callback = wi->callback;
+      cb_data = wi->cb_data;
+   }
+   fd_watch_running_fd = fd;
+   _al_mutex_unlock(&fd_watch_mutex);
+
+   callback(cb_data);
+
+   _al_mutex_lock(&fd_watch_mutex);
+   fd_watch_running_fd = -1;
+#ifdef USE_EPOLL
+   /* A hung up fd (e.g. an unplugged device) would wake us up forever.
+    * Stop polling it, but leave it in the list until its owner is done
+    * with it.
+    */
+   if (hangup && find_watch_item(fd) >= 0) {
+      ALLEGRO_DEBUG("fd %d hung up, no longer polled\n", fd);
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+   }
+#else
+   (void)hangup;
+#endif
+   _al_cond_broadcast(&fd_watch_cond);
+   _al_mutex_unlock(&fd_watch_mutex);
+}
+
+
+
+#ifdef USE_EPOLL
+
+/* fd_watch_thread_func: [fdwatch thread]
+ *  The thread loop function.
+ */
+static void fd_watch_thread_func(_AL_THREAD *self, void *unused)
+{
+   struct epoll_event events[MAX_EPOLL_EVENTS];
+   (void)unused;
+
+   while (!_al_get_thread_should_stop(self)) {
+      int n, i;
+
+      n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+      if (n < 0) {
+         if (errno != EINTR) {
+            ALLEGRO_ERROR("epoll_wait failed: %s\n", strerror(errno));
+            break;
+         }
+         continue;
+      }
+
+      for (i = 0; i < n; i++) {
+         int fd = events[i].data.fd;
+         if (fd == wake_fds[0]) {
+            drain_wake_fd();
+            continue;
+         }
+         dispatch_fd(fd, events[i].events & (EPOLLERR | EPOLLHUP));
+      }
+   }
+}
+
+
+
+static bool start_polling(void)
+{
+   struct epoll_event ev;
+
+   epoll_fd = epoll_create(MAX_EPOLL_EVENTS);
+   if (epoll_fd == -1)
+      return false;
+   fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+
+   memset(&ev, 0, sizeof ev);
+   ev.events = EPOLLIN;
+   ev.data.fd = wake_fds[0];
+   return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fds[0], &ev) == 0;
+}
+
+
+
+static void stop_polling(void)
+{
+   if (epoll_fd != -1)
+      close(epoll_fd);
+   epoll_fd = -1;
+}
 
 
+
+/* poll_fd:
+ *  Adds or removes fd from the set the thread waits on.  An epoll set can
+ *  be changed while the thread is waiting on it.
+ */
+static void poll_fd(int fd, bool add)
+{
+   if (add) {
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof ev);
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+         ALLEGRO_ERROR("Cannot watch fd %d: %s\n", fd, strerror(errno));
+      }
+   }
+   else {
+      /* Fails harmlessly if the fd hung up before. */
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+   }
+}
+
+#else /* !USE_EPOLL */
+
 /* fd_watch_thread_func: [fdwatch thread]
  *  The thread loop function.
  */
 static void fd_watch_thread_func(_AL_THREAD *self, void *unused)
 {
+   _AL_VECTOR ready = _AL_VECTOR_INITIALIZER(int);
    (void)unused;
 
    while (!_al_get_thread_should_stop(self)) {
 
       fd_set rfds;
       int max_fd;
+      unsigned int i;
 
       /* set up max_fd and rfds */
+      FD_ZERO(&rfds);
+      FD_SET(wake_fds[0], &rfds);
+      max_fd = wake_fds[0];
+
       _al_mutex_lock(&fd_watch_mutex);
-      {
-         WATCH_ITEM *wi;
-         unsigned int i;
-
-         FD_ZERO(&rfds);
-         max_fd = -1;
-
-         for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-            wi = _al_vector_ref(&fd_watch_list, i);
-            FD_SET(wi->fd, &rfds);
-            if (wi->fd > max_fd)
-               max_fd = wi->fd;
-         }
+      for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+         WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+         FD_SET(wi->fd, &rfds);
+         if (wi->fd > max_fd)
+            max_fd = wi->fd;
       }
       _al_mutex_unlock(&fd_watch_mutex);
 
-      /* wait for something to happen on one of the fds */
-      {
-         struct timeval tv;
-         int retval;
-
-         tv.tv_sec = 0;
-         tv.tv_usec = 250000;
+      /* wait for something to happen on one of the fds, changes to the
+       * list come through the wake pipe
+       */
+      if (select(max_fd+1, &rfds, NULL, NULL, NULL) < 1)
+         continue;
 
-         retval = select(max_fd+1, &rfds, NULL, NULL, &tv);
-         if (retval < 1)
-            continue;
-      }
+      if (FD_ISSET(wake_fds[0], &rfds))
+         drain_wake_fd();
 
       /* one or more of the fds has activity */
+      _al_vector_clear(&ready);
       _al_mutex_lock(&fd_watch_mutex);
-      {
-         WATCH_ITEM *wi;
-         unsigned int i;
-
-         for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-            wi = _al_vector_ref(&fd_watch_list, i);
-            if (FD_ISSET(wi->fd, &rfds)) {
-               /* The callback is allowed to modify the watch list so the mutex
-                * must be recursive.
-                */
-               wi->callback(wi->cb_data);
-            }
+      for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
+         WATCH_ITEM *wi = _al_vector_ref(&fd_watch_list, i);
+         if (FD_ISSET(wi->fd, &rfds)) {
+            int *slot = _al_vector_alloc_back(&ready);
+            *slot = wi->fd;
          }
       }
       _al_mutex_unlock(&fd_watch_mutex);
+
+      for (i = 0; i < _al_vector_size(&ready); i++) {
+         int *fd = _al_vector_ref(&ready, i);
+         dispatch_fd(*fd, false);
+      }
    }
+
+   _al_vector_free(&ready);
+}
+
+
+
+static bool start_polling(void)
+{
+   return true;
+}
+
+
+
+static void stop_polling(void)
+{
+}
+
+
+
+static void poll_fd(int fd, bool add)
+{
+   (void)fd;
+   (void)add;
+   wake_fd_watch_thread();
+}
+
+#endif /* !USE_EPOLL */
+
+
+
+/* start_fd_watch_thread: [primary thread]
+ *  Sets up the polling and starts the background thread.
+ */
+static bool start_fd_watch_thread(void)
+{
+   if (!open_wake_fds()) {
+      ALLEGRO_ERROR("Cannot create wake up fd: %s\n", strerror(errno));
+      return false;
+   }
+   if (!start_polling()) {
+      ALLEGRO_ERROR("Cannot set up polling: %s\n", strerror(errno));
+      stop_polling();
+      close_wake_fds();
+      return false;
+   }
+
+   _al_mutex_init(&fd_watch_mutex);
+   _al_cond_init(&fd_watch_cond);
+   fd_watch_running_fd = -1;
+   _al_thread_create(&fd_watch_thread, fd_watch_thread_func, NULL);
+   fd_watch_running = true;
+   return true;
+}
+
+
+
+/* stop_fd_watch_thread: [primary thread]
+ *  Stops the background thread and frees everything.
+ */
+static void stop_fd_watch_thread(void)
+{
+   _al_thread_set_should_stop(&fd_watch_thread);
+   wake_fd_watch_thread();
+   _al_thread_join(&fd_watch_thread);
+
+   stop_polling();
+   close_wake_fds();
+   _al_cond_destroy(&fd_watch_cond);
+   _al_mutex_destroy(&fd_watch_mutex);
+   _al_vector_free(&fd_watch_list);
+   fd_watch_running = false;
 }
 
 
@@ -122,7 +447,8 @@ static void fd_watch_thread_func(_AL_THREAD *self, void *unused)
  *
  *  Note: the callback is run from the background thread.  You can
  *  assume there is only one callback being called from the fdwatch
- *  module at a time.
+ *  module at a time.  The callback may start and stop watching fds,
+ *  including its own.
  */
 void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
 {
@@ -130,12 +456,9 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
    ASSERT(callback);
 
    /* start the background thread if necessary */
-   if (_al_vector_size(&fd_watch_list) == 0) {
-      /* We need a recursive mutex to allow callbacks to modify the fd watch
-       * list.
-       */
-      _al_mutex_init_recursive(&fd_watch_mutex);
-      _al_thread_create(&fd_watch_thread, fd_watch_thread_func, NULL);
+   if (!fd_watch_running) {
+      if (!start_fd_watch_thread())
+         return;
    }
 
    /* now add the watch item to the list */
@@ -147,6 +470,7 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
       wi->callback = callback;
       wi->cb_data = cb_data;
    }
+   poll_fd(fd, true);
    _al_mutex_unlock(&fd_watch_mutex);
 }
 
@@ -157,34 +481,38 @@ void _al_unix_start_watching_fd(int fd, void (*callback)(void *), void *cb_data)
  *  Stop watching for data on `fd'.  Once there are no more file
  *  descriptors to watch, the background thread will be stopped.  This
  *  function is synchronised with the background thread, so you don't
- *  have to do any locking before calling it.
+ *  have to do any locking before calling it.  When it returns, the
+ *  callback for fd is not running and won't be called again.
  */
 void _al_unix_stop_watching_fd(int fd)
 {
    bool list_empty = false;
+   int i;
+
+   if (!fd_watch_running)
+      return;
 
    /* find the fd in the watch list and remove it */
    _al_mutex_lock(&fd_watch_mutex);
-   {
-      WATCH_ITEM *wi;
-      unsigned int i;
-
-      for (i = 0; i < _al_vector_size(&fd_watch_list); i++) {
-         wi = _al_vector_ref(&fd_watch_list, i);
-         if (wi->fd == fd) {
-            _al_vector_delete_at(&fd_watch_list, i);
-            list_empty = _al_vector_is_empty(&fd_watch_list);
-            break;
-         }
+   i = find_watch_item(fd);
+   if (i >= 0) {
+      _al_vector_delete_at(&fd_watch_list, i);
+      poll_fd(fd, false);
+
+      /* Wait for the callback to return, unless we are called from it. */
+      if (!in_fd_watch_thread()) {
+         while (fd_watch_running_fd == fd)
+            _al_cond_wait(&fd_watch_cond, &fd_watch_mutex);
       }
    }
+   list_empty = _al_vector_is_empty(&fd_watch_list);
    _al_mutex_unlock(&fd_watch_mutex);
 
-   /* if no more fd's are being watched, stop the background thread */
-   if (list_empty) {
-      _al_thread_join(&fd_watch_thread);
-      _al_mutex_destroy(&fd_watch_mutex);
-      _al_vector_free(&fd_watch_list);
+   /* if no more fd's are being watched, stop the background thread; when
+    * called from a callback the thread stays around for the next fd
+    */
+   if (list_empty && !in_fd_watch_thread()) {
+      stop_fd_watch_thread();
    }
 }
 
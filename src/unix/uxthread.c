@@ -18,6 +18,9 @@
 
 #define _XOPEN_SOURCE 500       /* for Unix98 recursive mutexes */
                                 /* XXX: added configure test */
+#ifdef __linux__
+#define _GNU_SOURCE             /* for syscall() */
+#endif
 
 #include <sys/time.h>
 
@@ -30,6 +33,15 @@
 #include "allegro5/internal/aintern_android.h"
 #endif
 
+#ifdef ALLEGRO_CFG_FUTEX
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 
 
 /* threads */
@@ -102,6 +114,245 @@ void _al_thread_detach(_AL_THREAD *thread)
 }
 
 
+#ifdef ALLEGRO_CFG_FUTEX
+
+/* mutexes */
+
+/* How often a contended lock looks at the mutex again before going to
+ * sleep.  The owner cannot release the mutex while we spin on a single
+ * processor, so we don't spin there.
+ */
+#define MUTEX_SPIN_COUNT   100
+
+static int mutex_spin_count = -1;
+
+
+static int sys_futex(volatile _AL_ATOMIC *addr, int op, int val,
+   const struct timespec *timeout, volatile _AL_ATOMIC *addr2, int val3)
+{
+   return syscall(SYS_futex, addr, op, val, timeout, addr2, val3);
+}
+
+
+static void cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+   __asm__ __volatile__ ("pause" ::: "memory");
+#else
+   __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+
+/* mark_contended:
+ *  Sets the mutex state to 2 and returns the previous state, which is 0
+ *  if the mutex was free and has now been taken.
+ */
+static _AL_ATOMIC mark_contended(volatile _AL_ATOMIC *state)
+{
+   _AL_ATOMIC c;
+
+   do {
+      c = _al_load_acquire(state);
+   } while (c != 2 && !_al_compare_and_swap(state, c, 2));
+
+   return c;
+}
+
+
+/* lock_marked:
+ *  Takes the mutex, leaving it marked as contended.
+ */
+static void lock_marked(_AL_MUTEX *mutex)
+{
+   while (mark_contended(&mutex->state) != 0)
+      sys_futex(&mutex->state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+}
+
+
+void _al_mutex_init(_AL_MUTEX *mutex)
+{
+   ASSERT(mutex);
+
+   mutex->recursive = false;
+   mutex->state = 0;
+   mutex->owner = (pthread_t)0;
+   mutex->count = 0;
+   mutex->inited = true;
+}
+
+
+void _al_mutex_init_recursive(_AL_MUTEX *mutex)
+{
+   ASSERT(mutex);
+
+   _al_mutex_init(mutex);
+   mutex->recursive = true;
+}
+
+
+void _al_mutex_destroy(_AL_MUTEX *mutex)
+{
+   ASSERT(mutex);
+   ASSERT(mutex->state == 0);
+
+   mutex->inited = false;
+}
+
+
+/* _al_mutex_lock_contended:
+ *  Called by _al_mutex_lock if the mutex was not free.  Spins for a
+ *  while in the hope that the owner releases the mutex soon, then
+ *  sleeps until it does.
+ */
+void _al_mutex_lock_contended(_AL_MUTEX *mutex)
+{
+   int i;
+
+   if (mutex_spin_count < 0)
+      mutex_spin_count = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ?
+         MUTEX_SPIN_COUNT : 0;
+
+   for (i = 0; i < mutex_spin_count; i++) {
+      cpu_relax();
+      if (_al_load_acquire(&mutex->state) == 0 &&
+            _al_compare_and_swap(&mutex->state, 0, 1))
+         return;
+   }
+
+   lock_marked(mutex);
+}
+
+
+/* _al_mutex_wake:
+ *  Called by _al_mutex_unlock if other threads may be sleeping on the
+ *  mutex.  Releases it and wakes one of them.
+ */
+void _al_mutex_wake(_AL_MUTEX *mutex)
+{
+   _al_store_release(&mutex->state, 0);
+   sys_futex(&mutex->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+/* The owner is cleared before a recursive mutex is released, so it can
+ * only be equal to the calling thread if that thread holds the mutex.
+ */
+void _al_mutex_lock_recursive(_AL_MUTEX *mutex)
+{
+   pthread_t self = pthread_self();
+
+   if (pthread_equal(mutex->owner, self)) {
+      mutex->count++;
+      return;
+   }
+
+   if (!_al_compare_and_swap(&mutex->state, 0, 1))
+      _al_mutex_lock_contended(mutex);
+   mutex->owner = self;
+   mutex->count = 1;
+}
+
+
+void _al_mutex_unlock_recursive(_AL_MUTEX *mutex)
+{
+   ASSERT(pthread_equal(mutex->owner, pthread_self()));
+   ASSERT(mutex->count > 0);
+
+   if (--mutex->count > 0)
+      return;
+
+   mutex->owner = (pthread_t)0;
+   if (_al_sub1_and_fetch(&mutex->state) != 0)
+      _al_mutex_wake(mutex);
+}
+
+
+/* condition variables */
+
+/* cond_wait:
+ *  Waits until seq changes.  Returns -1 if abstime (measured by the real
+ *  time clock) passed first, 0 otherwise.
+ */
+static int cond_wait(_AL_COND *cond, _AL_MUTEX *mutex,
+   const struct timespec *abstime)
+{
+   _AL_ATOMIC seq;
+   int count = 0;
+   int ret;
+
+   ASSERT(mutex->inited);
+
+   cond->mutex = mutex;
+   _al_fetch_and_add1(&cond->waiters);
+   seq = _al_load_acquire(&cond->seq);
+
+   /* Release the mutex completely, even if it is locked recursively. */
+   if (mutex->recursive) {
+      count = mutex->count;
+      mutex->count = 1;
+   }
+   _al_mutex_unlock(mutex);
+
+   ret = sys_futex(&cond->seq, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME,
+      seq, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+   if (ret == -1 && errno == ETIMEDOUT)
+      ret = -1;
+   else
+      ret = 0;
+
+   _al_sub1_and_fetch(&cond->waiters);
+
+   /* A broadcast may have moved us over to the mutex, so other waiters
+    * may be sleeping on it.
+    */
+   lock_marked(mutex);
+   if (mutex->recursive) {
+      mutex->owner = pthread_self();
+      mutex->count = count;
+   }
+
+   return ret;
+}
+
+
+void _al_cond_wait(_AL_COND *cond, _AL_MUTEX *mutex)
+{
+   cond_wait(cond, mutex, NULL);
+}
+
+
+int _al_cond_timedwait(_AL_COND *cond, _AL_MUTEX *mutex,
+   const ALLEGRO_TIMEOUT *timeout)
+{
+   ALLEGRO_TIMEOUT_UNIX *unix_timeout = (ALLEGRO_TIMEOUT_UNIX *) timeout;
+
+   return cond_wait(cond, mutex, &unix_timeout->abstime);
+}
+
+
+/* _al_cond_wake:
+ *  Wakes one waiter, or all of them.  All but one of the waiters would
+ *  only go back to sleep on the mutex, so a broadcast wakes one and moves
+ *  the others over to the mutex directly.  That fails if seq changed
+ *  again meanwhile, in which case everyone is woken.
+ */
+void _al_cond_wake(_AL_COND *cond, bool all)
+{
+   _AL_ATOMIC seq = _al_fetch_and_add1(&cond->seq) + 1;
+   _AL_MUTEX *mutex = cond->mutex;
+
+   if (!all) {
+      sys_futex(&cond->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+   }
+   else if (!mutex || sys_futex(&cond->seq, FUTEX_CMP_REQUEUE_PRIVATE, 1,
+         (const struct timespec *)(intptr_t)INT_MAX, &mutex->state, seq) == -1) {
+      sys_futex(&cond->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+   }
+}
+
+#else
+
 /* mutexes */
 
 void _al_mutex_init(_AL_MUTEX *mutex)
@@ -158,6 +409,8 @@ int _al_cond_timedwait(_AL_COND *cond, _AL_MUTEX *mutex,
    return (retcode == ETIMEDOUT) ? -1 : 0;
 }
 
+#endif
+
 
 /*
  * Local Variables:
@@ -14,6 +14,11 @@
 #include <allegro5/allegro_font.h>
 #include <allegro5/allegro_ttf.h>
 #include <allegro5/allegro_primitives.h>
+#ifdef ALLEGRO_TEST_AUDIO
+#include <allegro5/allegro_audio.h>
+#include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_memfile.h>
+#endif
 
 #define MAX_BITMAPS  128
 #define MAX_TRANS    8
@@ -430,6 +435,100 @@ static void fill_lock_region(LockRegion *lr, float alphafactor, bool blended)
    }
 }
 
+#ifdef ALLEGRO_TEST_AUDIO
+static float get_sample_value(void const *data, ALLEGRO_AUDIO_DEPTH depth,
+   unsigned int i)
+{
+   switch (depth) {
+      case ALLEGRO_AUDIO_DEPTH_INT8:
+         return ((int8_t const *)data)[i] / 128.0f;
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         return (((uint8_t const *)data)[i] - 128) / 128.0f;
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         return ((int16_t const *)data)[i] / 32768.0f;
+      case ALLEGRO_AUDIO_DEPTH_UINT16:
+         return (((uint16_t const *)data)[i] - 32768) / 32768.0f;
+      case ALLEGRO_AUDIO_DEPTH_INT24:
+         return ((int32_t const *)data)[i] / 8388608.0f;
+      case ALLEGRO_AUDIO_DEPTH_UINT24:
+         return (((int32_t const *)data)[i] - 0x800000) / 8388608.0f;
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         return ((float const *)data)[i];
+   }
+   return 0.0f;
+}
+
+/* Draws the waveform of each channel of a sample in its own band across
+ * the target bitmap.  Each column shows the range of the samples in its
+ * part of the sample, so the length matters as well as the data.
+ */
+static void draw_sample_waveform(ALLEGRO_SAMPLE *spl, ALLEGRO_COLOR color)
+{
+   ALLEGRO_BITMAP *target = al_get_target_bitmap();
+   int w = al_get_bitmap_width(target);
+   int h = al_get_bitmap_height(target);
+   void const *data = al_get_sample_data(spl);
+   unsigned int len = al_get_sample_length(spl);
+   ALLEGRO_AUDIO_DEPTH depth = al_get_sample_depth(spl);
+   int channels = al_get_channel_count(al_get_sample_channels(spl));
+   int band_h = h / channels;
+   int x, c;
+   unsigned int i;
+
+   if (len == 0)
+      return;
+
+   for (c = 0; c < channels; c++) {
+      for (x = 0; x < w; x++) {
+         unsigned int start = (uint64_t)x * len / w;
+         unsigned int end = (uint64_t)(x + 1) * len / w;
+         float lo = 1.0f, hi = -1.0f;
+         int y0, y1;
+
+         if (end <= start)
+            end = start + 1;
+         for (i = start; i < end && i < len; i++) {
+            float v = get_sample_value(data, depth, i * channels + c);
+            if (v < lo)
+               lo = v;
+            if (v > hi)
+               hi = v;
+         }
+
+         y0 = c * band_h + (int)((1.0f - hi) * 0.5f * (band_h - 1));
+         y1 = c * band_h + (int)((1.0f - lo) * 0.5f * (band_h - 1));
+         al_draw_filled_rectangle(x, y0, x + 1, y1 + 1, color);
+      }
+   }
+}
+
+static ALLEGRO_SAMPLE *load_sample_hex(char const *hex, char const *ext)
+{
+   size_t size = strlen(hex) / 2;
+   unsigned char *buf = malloc(size);
+   ALLEGRO_FILE *f;
+   ALLEGRO_SAMPLE *spl = NULL;
+   size_t i;
+
+   if (!buf)
+      fatal_error("out of memory");
+   for (i = 0; i < size; i++) {
+      unsigned int byte;
+      if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+         fatal_error("bad hex data: %s", hex);
+      buf[i] = byte;
+   }
+
+   f = al_open_memfile(buf, size, "r");
+   if (f) {
+      spl = al_load_sample_f(f, ext);
+      al_fclose(f);
+   }
+   free(buf);
+   return spl;
+}
+#endif
+
 static int get_load_font_flags(char const *v)
 {
    return streq(v, "ALLEGRO_NO_PREMULTIPLIED_ALPHA") ? ALLEGRO_NO_PREMULTIPLIED_ALPHA
@@ -990,6 +1089,11 @@ static void do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+      if (SCAN("set_system_config_value", 3)) {
+         al_set_config_value(al_get_system_config(), V(0), V(1), V(2));
+         continue;
+      }
+
       if (SCAN("al_clear_to_color", 1)) {
          al_clear_to_color(C(0));
          continue;
@@ -1120,6 +1224,28 @@ static void do_test(ALLEGRO_CONFIG *cfg, char const *testname,
          continue;
       }
 
+#ifdef ALLEGRO_TEST_AUDIO
+      if (SCAN("draw_sample_waveform", 2)) {
+         ALLEGRO_SAMPLE *spl = al_load_sample(V(0));
+         if (!spl)
+            fprintf(stderr, "test_driver: failed to load %s\n", V(0));
+         else {
+            draw_sample_waveform(spl, C(1));
+            al_destroy_sample(spl);
+         }
+         continue;
+      }
+
+      if (SCAN("draw_sample_waveform_hex", 3)) {
+         ALLEGRO_SAMPLE *spl = load_sample_hex(V(0), V(1));
+         if (spl) {
+            draw_sample_waveform(spl, C(2));
+            al_destroy_sample(spl);
+         }
+         continue;
+      }
+#endif
+
       if (SCAN("al_hold_bitmap_drawing", 1)) {
          al_hold_bitmap_drawing(get_bool(V(0)));
          continue;
@@ -1208,6 +1334,16 @@ static void do_test(ALLEGRO_CONFIG *cfg, char const *testname,
             get_font_align(V(6)), V(7));
          continue;
       }
+      if (SCAN("al_draw_multiline_text", 8)) {
+         /* Config values can't hold newlines, so allow escapes. */
+         ALLEGRO_USTR *text = al_ustr_new(V(7));
+         al_ustr_find_replace_cstr(text, 0, "\\n", "\n");
+         al_ustr_find_replace_cstr(text, 0, "\\t", "\t");
+         al_draw_multiline_ustr(get_font(V(0)), C(1), F(2), F(3), F(4), F(5),
+            get_font_align(V(6)), text);
+         al_ustr_free(text);
+         continue;
+      }
       if (SCANLVAL("al_get_text_width", 2)) {
          int w = al_get_text_width(get_font(V(0)), V(1));
          set_config_int(cfg, testname, lval, w);
@@ -1622,6 +1758,11 @@ int main(int _argc, char *_argv[])
    al_init_font_addon();
    al_init_ttf_addon();
    al_init_primitives_addon();
+#ifdef ALLEGRO_TEST_AUDIO
+   /* Samples can be loaded even if there is no audio device to play them. */
+   al_install_audio();
+   al_init_acodec_addon();
+#endif
 
    for (; argc > 0; argc--, argv++) {
       char const *opt = argv[0];